@@ -22,6 +22,7 @@
 #include <grub/command.h>
 #include <grub/i18n.h>
 #include <grub/disk.h>
+#include <grub/fshelp.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -31,19 +32,40 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
     char *argv[] __attribute__ ((unused)))
 {
   unsigned long hits, misses;
+  grub_disk_dev_t dev;
 
   grub_disk_cache_get_performance (&hits, &misses);
   if (hits + misses)
     {
       unsigned long ratio = hits * 10000 / (hits + misses);
-      grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu\n"), hits, ratio / 100, ratio % 100,
+		    misses);
     }
   else
     grub_printf ("%s\n", _("No disk cache statistics available\n"));    
 
+  for (dev = grub_disk_dev_list; dev; dev = dev->next)
+    {
+      unsigned long ratio;
+
+      grub_disk_cache_get_dev_performance (dev->id, &hits, &misses);
+      if (! (hits + misses))
+	continue;
+      ratio = hits * 10000 / (hits + misses);
+      grub_printf ("%s: hits = %lu (%lu.%02lu%%), misses = %lu\n",
+		   dev->name, hits, ratio / 100, ratio % 100, misses);
+    }
+
+  {
+    unsigned long negative_hits;
+
+    grub_fshelp_dentry_cache_get_stats (&hits, &negative_hits, &misses);
+    grub_printf_ (N_("Directory lookup cache: %lu directory scans saved"
+		     " (%lu found, %lu not found), %lu misses\n"),
+		  hits + negative_hits, hits, negative_hits, misses);
+  }
+
  return 0;
 }
 
@@ -26,6 +26,7 @@
 #include <grub/file.h>
 #include <grub/procfs.h>
 #include <grub/partition.h>
+#include <grub/loader.h>
 
 #ifdef GRUB_UTIL
 #include <grub/emu/hostdisk.h>
@@ -46,6 +47,8 @@ static const struct grub_arg_option options[] =
 
 /* Our irreducible polynom is x^128+x^7+x^2+x+1. Lowest byte of it is:  */
 #define GF_POLYNOM 0x87
+/* Number of sectors whose IVs are generated together.  */
+#define GRUB_CRYPTODISK_BATCH_SECTORS 64
 static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
 {
   return 1U << (dev->log_sector_size - GRUB_CRYPTODISK_GF_LOG_BYTES);
@@ -54,24 +57,6 @@ static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
 static grub_cryptodisk_t cryptodisk_list = NULL;
 static grub_uint8_t last_cryptodisk_id = 0;
 
-static void
-gf_mul_x (grub_uint8_t *g)
-{
-  int over = 0, over2 = 0;
-  unsigned j;
-
-  for (j = 0; j < GRUB_CRYPTODISK_GF_BYTES; j++)
-    {
-      over2 = !!(g[j] & 0x80);
-      g[j] <<= 1;
-      g[j] |= over;
-      over = over2;
-    }
-  if (over)
-    g[0] ^= GF_POLYNOM;
-}
-
-
 static void
 gf_mul_x_be (grub_uint8_t *g)
 {
@@ -221,41 +206,27 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+/* Compute the IVs of N sectors starting at SECTOR, one cipher block each.  */
 static gcry_err_code_t
-grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
-			   grub_uint8_t * data, grub_size_t len,
-			   grub_disk_addr_t sector, int do_encrypt)
+generate_ivs (struct grub_cryptodisk *dev, grub_uint8_t *ivs,
+	      grub_disk_addr_t sector, grub_size_t n)
 {
-  grub_size_t i;
-  gcry_err_code_t err;
-
-  if (dev->cipher->cipher->blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
-    return GPG_ERR_INV_ARG;
-
-  /* The only mode without IV.  */
-  if (dev->mode == GRUB_CRYPTODISK_MODE_ECB && !dev->rekey)
-    return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
-	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
-
-  for (i = 0; i < len; i += (1U << dev->log_sector_size))
+  grub_size_t blocksize = dev->cipher->cipher->blocksize;
+  grub_size_t sz = ((blocksize + sizeof (grub_uint32_t) - 1)
+		    / sizeof (grub_uint32_t));
+  grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
+  void *ctx = NULL;
+  grub_size_t k;
+
+  if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH)
     {
-      grub_size_t sz = ((dev->cipher->cipher->blocksize
-			 + sizeof (grub_uint32_t) - 1)
-			/ sizeof (grub_uint32_t));
-      grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
-
-      if (dev->rekey)
-	{
-	  grub_uint64_t zone = sector >> dev->rekey_shift;
-	  if (zone != dev->last_rekey)
-	    {
-	      err = dev->rekey (dev, zone);
-	      if (err)
-		return err;
-	      dev->last_rekey = zone;
-	    }
-	}
+      ctx = grub_zalloc (dev->iv_hash->contextsize);
+      if (!ctx)
+	return GPG_ERR_OUT_OF_MEMORY;
+    }
 
+  for (k = 0; k < n; k++, sector++)
+    {
       grub_memset (iv, 0, sizeof (iv));
       switch (dev->mode_iv)
 	{
@@ -264,11 +235,6 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	case GRUB_CRYPTODISK_MODE_IV_BYTECOUNT64_HASH:
 	  {
 	    grub_uint64_t tmp;
-	    void *ctx;
-
-	    ctx = grub_zalloc (dev->iv_hash->contextsize);
-	    if (!ctx)
-	      return GPG_ERR_OUT_OF_MEMORY;
 
 	    tmp = grub_cpu_to_le64 (sector << dev->log_sector_size);
 	    dev->iv_hash->init (ctx);
@@ -277,7 +243,6 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    dev->iv_hash->final (ctx);
 
 	    grub_memcpy (iv, dev->iv_hash->read (ctx), sizeof (iv));
-	    grub_free (ctx);
 	  }
 	  break;
 	case GRUB_CRYPTODISK_MODE_IV_PLAIN64:
@@ -300,98 +265,155 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	  break;
 	case GRUB_CRYPTODISK_MODE_IV_ESSIV:
 	  iv[0] = grub_cpu_to_le32 (sector & 0xFFFFFFFF);
-	  err = grub_crypto_ecb_encrypt (dev->essiv_cipher, iv, iv,
-					 dev->cipher->cipher->blocksize);
-	  if (err)
-	    return err;
+	  break;
 	}
+      grub_memcpy (ivs + k * blocksize, iv, blocksize);
+    }
+  grub_free (ctx);
+
+  /* Encrypt the ESSIV salts of the whole batch at once.  */
+  if (dev->mode_iv == GRUB_CRYPTODISK_MODE_IV_ESSIV)
+    return grub_crypto_ecb_encrypt (dev->essiv_cipher, ivs, ivs,
+				    n * blocksize);
+  return GPG_ERR_NO_ERROR;
+}
+
+static gcry_err_code_t
+grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
+			   grub_uint8_t * data, grub_size_t len,
+			   grub_disk_addr_t sector, int do_encrypt)
+{
+  grub_size_t i, k, n;
+  grub_size_t blocksize = dev->cipher->cipher->blocksize;
+  grub_size_t sector_size = 1U << dev->log_sector_size;
+  grub_uint8_t ivs[GRUB_CRYPTODISK_BATCH_SECTORS
+		   * GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE];
+  gcry_err_code_t err;
+
+  if (blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
+    return GPG_ERR_INV_ARG;
+
+  /* The only mode without IV.  */
+  if (dev->mode == GRUB_CRYPTODISK_MODE_ECB && !dev->rekey)
+    return (do_encrypt ? grub_crypto_ecb_encrypt (dev->cipher, data, data, len)
+	    : grub_crypto_ecb_decrypt (dev->cipher, data, data, len));
 
-      switch (dev->mode)
+  /* Work on batches of sectors: generate all their IVs first, then let the
+     cipher go through as many blocks as the mode allows in one call.  */
+  for (i = 0; i < len; i += n << dev->log_sector_size, sector += n)
+    {
+      n = (len - i + sector_size - 1) >> dev->log_sector_size;
+      if (n > GRUB_CRYPTODISK_BATCH_SECTORS)
+	n = GRUB_CRYPTODISK_BATCH_SECTORS;
+
+      if (dev->rekey)
+	{
+	  grub_uint64_t zone = sector >> dev->rekey_shift;
+	  grub_uint64_t zone_end = (zone + 1) << dev->rekey_shift;
+
+	  if (zone != dev->last_rekey)
+	    {
+	      err = dev->rekey (dev, zone);
+	      if (err)
+		return err;
+	      dev->last_rekey = zone;
+	    }
+	  /* A batch must not span two keys.  */
+	  if (n > zone_end - sector)
+	    n = zone_end - sector;
+	}
+
+      err = generate_ivs (dev, ivs, sector, n);
+      if (err)
+	return err;
+
+      if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
 	{
-	case GRUB_CRYPTODISK_MODE_CBC:
 	  if (do_encrypt)
-	    err = grub_crypto_cbc_encrypt (dev->cipher, data + i, data + i,
-					   (1U << dev->log_sector_size), iv);
+	    err = grub_crypto_xts_encrypt_sectors (dev->cipher,
+						   dev->secondary_cipher,
+						   data + i,
+						   n << dev->log_sector_size,
+						   sector_size, ivs);
 	  else
-	    err = grub_crypto_cbc_decrypt (dev->cipher, data + i, data + i,
-					   (1U << dev->log_sector_size), iv);
+	    err = grub_crypto_xts_decrypt_sectors (dev->cipher,
+						   dev->secondary_cipher,
+						   data + i,
+						   n << dev->log_sector_size,
+						   sector_size, ivs);
 	  if (err)
 	    return err;
-	  break;
+	  continue;
+	}
 
-	case GRUB_CRYPTODISK_MODE_PCBC:
-	  if (do_encrypt)
-	    err = grub_crypto_pcbc_encrypt (dev->cipher, data + i, data + i,
-					    (1U << dev->log_sector_size), iv);
-	  else
-	    err = grub_crypto_pcbc_decrypt (dev->cipher, data + i, data + i,
-					    (1U << dev->log_sector_size), iv);
+      if (dev->mode == GRUB_CRYPTODISK_MODE_CBC && !do_encrypt)
+	{
+	  err = grub_crypto_cbc_decrypt_sectors (dev->cipher, data + i,
+						 n << dev->log_sector_size,
+						 sector_size, ivs);
 	  if (err)
 	    return err;
-	  break;
-	case GRUB_CRYPTODISK_MODE_XTS:
-	  {
-	    unsigned j;
-	    err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
-					   dev->cipher->cipher->blocksize);
-	    if (err)
-	      return err;
-	    
-	    for (j = 0; j < (1U << dev->log_sector_size);
-		 j += dev->cipher->cipher->blocksize)
+	  continue;
+	}
+
+      /* Modes chaining from one block to the next: one sector at a time.  */
+      for (k = 0; k < n; k++)
+	{
+	  grub_uint8_t *sec_data = data + i + (k << dev->log_sector_size);
+	  grub_uint32_t iv[(GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE + 3) / 4];
+
+	  grub_memcpy (iv, ivs + k * blocksize, blocksize);
+	  switch (dev->mode)
+	    {
+	    case GRUB_CRYPTODISK_MODE_CBC:
+	      err = grub_crypto_cbc_encrypt (dev->cipher, sec_data, sec_data,
+					     sector_size, iv);
+	      if (err)
+		return err;
+	      break;
+
+	    case GRUB_CRYPTODISK_MODE_PCBC:
+	      if (do_encrypt)
+		err = grub_crypto_pcbc_encrypt (dev->cipher, sec_data, sec_data,
+						sector_size, iv);
+	      else
+		err = grub_crypto_pcbc_decrypt (dev->cipher, sec_data, sec_data,
+						sector_size, iv);
+	      if (err)
+		return err;
+	      break;
+	    case GRUB_CRYPTODISK_MODE_LRW:
 	      {
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
+		struct lrw_sector sec;
+
+		generate_lrw_sector (&sec, dev, (grub_uint8_t *) iv);
+		lrw_xor (&sec, dev, sec_data);
+
 		if (do_encrypt)
-		  err = grub_crypto_ecb_encrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
+		  err = grub_crypto_ecb_encrypt (dev->cipher, sec_data,
+						 sec_data, sector_size);
 		else
-		  err = grub_crypto_ecb_decrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
+		  err = grub_crypto_ecb_decrypt (dev->cipher, sec_data,
+						 sec_data, sector_size);
 		if (err)
 		  return err;
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
-		gf_mul_x ((grub_uint8_t *) iv);
+		lrw_xor (&sec, dev, sec_data);
 	      }
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_LRW:
-	  {
-	    struct lrw_sector sec;
-
-	    generate_lrw_sector (&sec, dev, (grub_uint8_t *) iv);
-	    lrw_xor (&sec, dev, data + i);
-
-	    if (do_encrypt)
-	      err = grub_crypto_ecb_encrypt (dev->cipher, data + i, 
-					     data + i,
-					     (1U << dev->log_sector_size));
-	    else
-	      err = grub_crypto_ecb_decrypt (dev->cipher, data + i, 
-					     data + i,
-					     (1U << dev->log_sector_size));
-	    if (err)
-	      return err;
-	    lrw_xor (&sec, dev, data + i);
-	  }
-	  break;
-	case GRUB_CRYPTODISK_MODE_ECB:
-	  if (do_encrypt)
-	    err = grub_crypto_ecb_encrypt (dev->cipher, data + i, data + i,
-					   (1U << dev->log_sector_size));
-	  else
-	    err = grub_crypto_ecb_decrypt (dev->cipher, data + i, data + i,
-					   (1U << dev->log_sector_size));
-	  if (err)
-	    return err;
-	  break;
-	default:
-	  return GPG_ERR_NOT_IMPLEMENTED;
+	      break;
+	    case GRUB_CRYPTODISK_MODE_ECB:
+	      if (do_encrypt)
+		err = grub_crypto_ecb_encrypt (dev->cipher, sec_data, sec_data,
+					       sector_size);
+	      else
+		err = grub_crypto_ecb_decrypt (dev->cipher, sec_data, sec_data,
+					       sector_size);
+	      if (err)
+		return err;
+	      break;
+	    default:
+	      return GPG_ERR_NOT_IMPLEMENTED;
+	    }
 	}
-      sector++;
     }
   return GPG_ERR_NO_ERROR;
 }
@@ -980,6 +1002,128 @@ cryptodisk_close (grub_cryptodisk_t dev)
   grub_free (dev);
 }
 
+#define MAX_PASSPHRASE 256
+
+/* Passphrases which opened a volume, most recently used first.  Volumes
+   unlocked together usually share one, so trying these before asking spares
+   the user from typing it again for every disk.  */
+struct cached_passphrase
+{
+  struct cached_passphrase *next;
+  char *passphrase;
+};
+
+static struct cached_passphrase *passphrase_cache;
+
+static void
+passphrase_cache_free (struct cached_passphrase *cached)
+{
+  grub_memset (cached->passphrase, 0, grub_strlen (cached->passphrase));
+  grub_free (cached->passphrase);
+  grub_free (cached);
+}
+
+static void
+passphrase_cache_clear (void)
+{
+  struct cached_passphrase *cached, *next;
+
+  for (cached = passphrase_cache; cached; cached = next)
+    {
+      next = cached->next;
+      passphrase_cache_free (cached);
+    }
+  passphrase_cache = NULL;
+}
+
+#ifndef GRUB_UTIL
+static struct grub_preboot *passphrase_cache_preboot_hnd;
+
+/* Don't leave the passphrases in the memory handed over to the OS.  */
+static grub_err_t
+passphrase_cache_preboot (int noreturn __attribute__ ((unused)))
+{
+  passphrase_cache_clear ();
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+passphrase_cache_preboot_rest (void)
+{
+  return GRUB_ERR_NONE;
+}
+#endif
+
+static void
+passphrase_cache_add (const char *passphrase)
+{
+  struct cached_passphrase *cached;
+
+  cached = grub_malloc (sizeof (*cached));
+  if (!cached)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  cached->passphrase = grub_strdup (passphrase);
+  if (!cached->passphrase)
+    {
+      grub_free (cached);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  cached->next = passphrase_cache;
+  passphrase_cache = cached;
+}
+
+grub_err_t
+grub_cryptodisk_recover_passphrase (grub_disk_t source, grub_cryptodisk_t dev,
+				    grub_cryptodisk_passphrase_hook_t hook,
+				    void *hook_data)
+{
+  struct cached_passphrase *cached, **prev;
+  char passphrase[MAX_PASSPHRASE] = "";
+  char *tmp;
+  grub_err_t err;
+
+  for (prev = &passphrase_cache; *prev; prev = &cached->next)
+    {
+      cached = *prev;
+      grub_dprintf ("cryptodisk", "trying a cached passphrase for %s\n",
+		    dev->uuid);
+      err = hook (source, dev, cached->passphrase, hook_data);
+      if (err == GRUB_ERR_NONE)
+	{
+	  /* Move it to the front.  */
+	  *prev = cached->next;
+	  cached->next = passphrase_cache;
+	  passphrase_cache = cached;
+	  return GRUB_ERR_NONE;
+	}
+      if (err != GRUB_ERR_ACCESS_DENIED)
+	return err;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  /* Get the passphrase from the user.  */
+  tmp = NULL;
+  if (source->partition)
+    tmp = grub_partition_get_name (source->partition);
+  grub_printf_ (N_("Enter passphrase for %s%s%s (%s): "), source->name,
+		source->partition ? "," : "", tmp ? : "",
+		dev->uuid);
+  grub_free (tmp);
+  if (!grub_password_get (passphrase, MAX_PASSPHRASE))
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, "Passphrase not supplied");
+
+  err = hook (source, dev, passphrase, hook_data);
+  if (err == GRUB_ERR_NONE)
+    passphrase_cache_add (passphrase);
+
+  grub_memset (passphrase, 0, sizeof (passphrase));
+  return err;
+}
+
 static grub_err_t
 grub_cryptodisk_scan_device_real (const char *name, grub_disk_t source)
 {
@@ -1305,11 +1449,21 @@ GRUB_MOD_INIT (cryptodisk)
 			      N_("SOURCE|-u UUID|-a|-b"),
 			      N_("Mount a crypto device."), options);
   grub_procfs_register ("luks_script", &luks_script);
+#ifndef GRUB_UTIL
+  passphrase_cache_preboot_hnd
+    = grub_loader_register_preboot_hook (passphrase_cache_preboot,
+					 passphrase_cache_preboot_rest,
+					 GRUB_LOADER_PREBOOT_HOOK_PRIO_NORMAL);
+#endif
 }
 
 GRUB_MOD_FINI (cryptodisk)
 {
   grub_disk_dev_unregister (&grub_cryptodisk_dev);
   cryptodisk_cleanup ();
+  passphrase_cache_clear ();
+#ifndef GRUB_UTIL
+  grub_loader_unregister_preboot_hook (passphrase_cache_preboot_hnd);
+#endif
   grub_procfs_unregister (&luks_script);
 }
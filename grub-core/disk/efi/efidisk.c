@@ -33,11 +33,14 @@ struct grub_efidisk_data
   grub_efi_device_path_t *device_path;
   grub_efi_device_path_t *last_device_path;
   grub_efi_block_io_t *block_io;
+  /* NULL if the firmware can't read in the background.  */
+  grub_efi_block_io2_t *block_io2;
   struct grub_efidisk_data *next;
 };
 
 /* GUID.  */
 static grub_efi_guid_t block_io_guid = GRUB_EFI_BLOCK_IO_GUID;
+static grub_efi_guid_t block_io2_guid = GRUB_EFI_BLOCK_IO2_GUID;
 
 static struct grub_efidisk_data *fd_devices;
 static struct grub_efidisk_data *hd_devices;
@@ -107,6 +110,8 @@ make_devices (void)
       d->device_path = dp;
       d->last_device_path = ldp;
       d->block_io = bio;
+      d->block_io2 = grub_efi_open_protocol (*handle, &block_io2_guid,
+					     GRUB_EFI_OPEN_PROTOCOL_GET_PROTOCOL);
       d->next = devices;
       devices = d;
     }
@@ -607,6 +612,101 @@ grub_efidisk_read (struct grub_disk *disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
+/* A read in progress through EFI_BLOCK_IO2.  */
+struct grub_efidisk_request
+{
+  grub_efi_block_io2_token_t token;
+  /* Bounce buffer if the caller's one isn't aligned enough.  */
+  char *aligned_buf;
+};
+
+static grub_err_t
+grub_efidisk_read_start (struct grub_disk *disk,
+			 struct grub_disk_request *req)
+{
+  struct grub_efidisk_data *d = disk->data;
+  grub_efi_block_io2_t *bio2 = d->block_io2;
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efidisk_request *r;
+  grub_efi_status_t status;
+  grub_size_t io_align, num_bytes;
+
+  if (! bio2)
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  grub_dprintf ("efidisk",
+		"starting to read 0x%lx sectors at the sector 0x%llx from %s\n",
+		(unsigned long) req->size, (unsigned long long) req->sector,
+		disk->name);
+
+  r = grub_zalloc (sizeof (*r));
+  if (! r)
+    return grub_errno;
+
+  io_align = bio2->media->io_align ? bio2->media->io_align : 1;
+  num_bytes = req->size << disk->log_sector_size;
+  if ((grub_addr_t) req->buf & (io_align - 1))
+    {
+      r->aligned_buf = grub_memalign (io_align, num_bytes);
+      if (! r->aligned_buf)
+	{
+	  grub_free (r);
+	  return grub_errno;
+	}
+    }
+
+  /* The event is only checked, never waited for or notified.  */
+  status = efi_call_5 (b->create_event, 0, GRUB_EFI_TPL_CALLBACK, NULL, NULL,
+		       &r->token.event);
+  if (status != GRUB_EFI_SUCCESS)
+    goto fail;
+
+  status = efi_call_6 (bio2->read_blocks_ex, bio2, bio2->media->media_id,
+		       (grub_efi_uint64_t) req->sector, &r->token,
+		       (grub_efi_uintn_t) num_bytes,
+		       r->aligned_buf ? : req->buf);
+  if (status != GRUB_EFI_SUCCESS)
+    {
+      efi_call_1 (b->close_event, r->token.event);
+      goto fail;
+    }
+
+  req->data = r;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (r->aligned_buf);
+  grub_free (r);
+  return grub_error (GRUB_ERR_READ_ERROR,
+		     N_("failure reading sector 0x%llx from `%s'"),
+		     (unsigned long long) req->sector, disk->name);
+}
+
+static int
+grub_efidisk_read_poll (struct grub_disk *disk,
+			struct grub_disk_request *req)
+{
+  grub_efi_boot_services_t *b = grub_efi_system_table->boot_services;
+  struct grub_efidisk_request *r = req->data;
+
+  if (efi_call_1 (b->check_event, r->token.event) == GRUB_EFI_NOT_READY)
+    return 0;
+
+  if (r->token.transaction_status == GRUB_EFI_NO_MEDIA)
+    req->err = GRUB_ERR_OUT_OF_RANGE;
+  else if (r->token.transaction_status != GRUB_EFI_SUCCESS)
+    req->err = GRUB_ERR_READ_ERROR;
+  else if (r->aligned_buf)
+    grub_memcpy (req->buf, r->aligned_buf,
+		 req->size << disk->log_sector_size);
+
+  efi_call_1 (b->close_event, r->token.event);
+  grub_free (r->aligned_buf);
+  grub_free (r);
+  req->data = NULL;
+  return 1;
+}
+
 static grub_err_t
 grub_efidisk_write (struct grub_disk *disk, grub_disk_addr_t sector,
 		    grub_size_t size, const char *buf)
@@ -638,6 +738,8 @@ static struct grub_disk_dev grub_efidisk_dev =
     .disk_close = grub_efidisk_close,
     .disk_read = grub_efidisk_read,
     .disk_write = grub_efidisk_write,
+    .disk_read_start = grub_efidisk_read_start,
+    .disk_read_poll = grub_efidisk_read_poll,
     .next = 0
   };
 
@@ -55,6 +55,7 @@
 #include <grub/crypto.h>
 #include <grub/partition.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -135,8 +136,6 @@ const char *algorithms[] = {
   [0x16] = "aes"
 };
 
-#define MAX_PASSPHRASE 256
-
 static gcry_err_code_t
 geli_rekey (struct grub_cryptodisk *dev, grub_uint64_t zoneno)
 {
@@ -397,68 +396,48 @@ configure_ciphers (grub_disk_t disk, const char *check_uuid,
   return newdev;
 }
 
-static grub_err_t
-recover_key (grub_disk_t source, grub_cryptodisk_t dev)
+struct geli_recover_ctx
 {
+  struct grub_geli_phdr header;
   grub_size_t keysize;
+};
+
+static grub_err_t
+geli_try_passphrase (grub_disk_t source __attribute__ ((unused)),
+		     grub_cryptodisk_t dev, const char *passphrase, void *data)
+{
+  struct geli_recover_ctx *ctx = data;
+  struct grub_geli_phdr *header = &ctx->header;
+  grub_size_t keysize = ctx->keysize;
   grub_uint8_t digest[GRUB_CRYPTO_MAX_MDLEN];
   grub_uint8_t geomkey[GRUB_CRYPTO_MAX_MDLEN];
   grub_uint8_t verify_key[GRUB_CRYPTO_MAX_MDLEN];
   grub_uint8_t zero[GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE];
   grub_uint8_t geli_cipher_key[64];
-  char passphrase[MAX_PASSPHRASE] = "";
   unsigned i;
   gcry_err_code_t gcry_err;
-  struct grub_geli_phdr header;
-  char *tmp;
-  grub_disk_addr_t sector;
-  grub_err_t err;
-
-  if (dev->cipher->cipher->blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
-    return grub_error (GRUB_ERR_BUG, "cipher block is too long");
 
-  if (dev->hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
-    return grub_error (GRUB_ERR_BUG, "mdlen is too long");
-
-  sector = grub_disk_get_size (source);
-  if (sector == GRUB_DISK_SIZE_UNKNOWN || sector == 0)
-    return grub_error (GRUB_ERR_BUG, "not a geli");
-
-  /* Read the GELI header.  */
-  err = grub_disk_read (source, sector - 1, 0, sizeof (header), &header);
-  if (err)
-    return err;
-
-  keysize = grub_le_to_cpu16 (header.keylen) / GRUB_CHAR_BIT;
   grub_memset (zero, 0, sizeof (zero));
 
-  grub_puts_ (N_("Attempting to decrypt master key..."));
-
-  /* Get the passphrase from the user.  */
-  tmp = NULL;
-  if (source->partition)
-    tmp = grub_partition_get_name (source->partition);
-  grub_printf_ (N_("Enter passphrase for %s%s%s (%s): "), source->name,
-		source->partition ? "," : "", tmp ? : "",
-		dev->uuid);
-  grub_free (tmp);
-  if (!grub_password_get (passphrase, MAX_PASSPHRASE))
-    return grub_error (GRUB_ERR_BAD_ARGUMENT, "Passphrase not supplied");
-
   /* Calculate the PBKDF2 of the user supplied passphrase.  */
-  if (grub_le_to_cpu32 (header.niter) != 0)
+  if (grub_le_to_cpu32 (header->niter) != 0)
     {
       grub_uint8_t pbkdf_key[64];
+      grub_uint64_t start = grub_get_time_ms ();
+
       gcry_err = grub_crypto_pbkdf2 (dev->hash, (grub_uint8_t *) passphrase,
 				     grub_strlen (passphrase),
-				     header.salt,
-				     sizeof (header.salt),
-				     grub_le_to_cpu32 (header.niter),
+				     header->salt,
+				     sizeof (header->salt),
+				     grub_le_to_cpu32 (header->niter),
 				     pbkdf_key, sizeof (pbkdf_key));
 
       if (gcry_err)
 	return grub_crypto_gcry_error (gcry_err);
 
+      grub_dprintf ("geli", "PBKDF2 done in %llu ms\n",
+		    (unsigned long long) (grub_get_time_ms () - start));
+
       gcry_err = grub_crypto_hmac_buffer (dev->hash, NULL, 0, pbkdf_key,
 					  sizeof (pbkdf_key), geomkey);
       if (gcry_err)
@@ -472,7 +451,7 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
       if (!hnd)
 	return grub_crypto_gcry_error (GPG_ERR_OUT_OF_MEMORY);
 
-      grub_crypto_hmac_write (hnd, header.salt, sizeof (header.salt));
+      grub_crypto_hmac_write (hnd, header->salt, sizeof (header->salt));
       grub_crypto_hmac_write (hnd, passphrase, grub_strlen (passphrase));
 
       gcry_err = grub_crypto_hmac_fini (hnd, geomkey);
@@ -493,13 +472,13 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
   grub_dprintf ("geli", "keylen = %" PRIuGRUB_SIZE "\n", keysize);
 
   /* Try to recover master key from each active keyslot.  */
-  for (i = 0; i < ARRAY_SIZE (header.keys); i++)
+  for (i = 0; i < ARRAY_SIZE (header->keys); i++)
     {
       struct grub_geli_key candidate_key;
       grub_uint8_t key_hmac[GRUB_CRYPTO_MAX_MDLEN];
 
       /* Check if keyslot is enabled.  */
-      if (! (header.keys_used & (1 << i)))
+      if (! (header->keys_used & (1 << i)))
 	  continue;
 
       grub_dprintf ("geli", "Trying keyslot %d\n", i);
@@ -510,7 +489,7 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
 	return grub_crypto_gcry_error (gcry_err);
 
       gcry_err = grub_crypto_cbc_decrypt (dev->cipher, &candidate_key,
-					  &header.keys[i],
+					  &header->keys[i],
 					  sizeof (candidate_key),
 					  zero);
       if (gcry_err)
@@ -529,7 +508,7 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
 	continue;
       grub_printf_ (N_("Slot %d opened\n"), i);
 
-      if (grub_le_to_cpu32 (header.version) >= 7)
+      if (grub_le_to_cpu32 (header->version) >= 7)
         {
           /* GELI >=7 uses the cipher_key */
 	  grub_memcpy (geli_cipher_key, candidate_key.cipher_key,
@@ -546,7 +525,7 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
       if (!dev->rekey)
 	{
 	  grub_size_t real_keysize = keysize;
-	  if (grub_le_to_cpu16 (header.alg) == 0x16)
+	  if (grub_le_to_cpu16 (header->alg) == 0x16)
 	    real_keysize *= 2;
 	  gcry_err = grub_cryptodisk_setkey (dev, candidate_key.cipher_key,
 					     real_keysize); 
@@ -556,7 +535,7 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
       else
 	{
 	  grub_size_t real_keysize = keysize;
-	  if (grub_le_to_cpu16 (header.alg) == 0x16)
+	  if (grub_le_to_cpu16 (header->alg) == 0x16)
 	    real_keysize *= 2;
 
 	  grub_memcpy (dev->rekey_key, geli_cipher_key,
@@ -579,6 +558,37 @@ recover_key (grub_disk_t source, grub_cryptodisk_t dev)
   return GRUB_ACCESS_DENIED;
 }
 
+static grub_err_t
+recover_key (grub_disk_t source, grub_cryptodisk_t dev)
+{
+  struct geli_recover_ctx ctx;
+  grub_disk_addr_t sector;
+  grub_err_t err;
+
+  if (dev->cipher->cipher->blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE)
+    return grub_error (GRUB_ERR_BUG, "cipher block is too long");
+
+  if (dev->hash->mdlen > GRUB_CRYPTO_MAX_MDLEN)
+    return grub_error (GRUB_ERR_BUG, "mdlen is too long");
+
+  sector = grub_disk_get_size (source);
+  if (sector == GRUB_DISK_SIZE_UNKNOWN || sector == 0)
+    return grub_error (GRUB_ERR_BUG, "not a geli");
+
+  /* Read the GELI header.  */
+  err = grub_disk_read (source, sector - 1, 0, sizeof (ctx.header),
+			&ctx.header);
+  if (err)
+    return err;
+
+  ctx.keysize = grub_le_to_cpu16 (ctx.header.keylen) / GRUB_CHAR_BIT;
+
+  grub_puts_ (N_("Attempting to decrypt master key..."));
+
+  return grub_cryptodisk_recover_passphrase (source, dev, geli_try_passphrase,
+					     &ctx);
+}
+
 struct grub_cryptodisk_dev geli_crypto = {
   .scan = configure_ciphers,
   .recover_key = recover_key
@@ -25,6 +25,10 @@
 #include <grub/extcmd.h>
 #include <grub/i18n.h>
 
+#ifdef GRUB_UTIL
+#include <stdlib.h>
+#endif
+
 GRUB_MOD_LICENSE ("GPLv3+");
 
 struct grub_loopback
@@ -208,6 +212,41 @@ grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
   return 0;
 }
 
+#ifdef GRUB_UTIL
+/* Number of polls after which a simulated background read completes, or
+   -1 to read synchronously.  Set from GRUB_LOOPBACK_ASYNC in the host
+   environment, so that the tests can go through the asynchronous paths of
+   the disk layer.  */
+static int async_polls = -1;
+
+static grub_err_t
+grub_loopback_read_start (grub_disk_t disk __attribute__ ((unused)),
+			  struct grub_disk_request *req)
+{
+  if (async_polls < 0)
+    return grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		       "background reads are disabled");
+  req->data = (void *) (grub_addr_t) async_polls;
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_loopback_read_poll (grub_disk_t disk, struct grub_disk_request *req)
+{
+  grub_addr_t left = (grub_addr_t) req->data;
+
+  if (left)
+    {
+      req->data = (void *) (left - 1);
+      return 0;
+    }
+
+  req->err = grub_loopback_read (disk, req->sector, req->size, req->buf);
+  grub_errno = GRUB_ERR_NONE;
+  return 1;
+}
+#endif
+
 static grub_err_t
 grub_loopback_write (grub_disk_t disk __attribute ((unused)),
 		     grub_disk_addr_t sector __attribute ((unused)),
@@ -226,6 +265,10 @@ static struct grub_disk_dev grub_loopback_dev =
     .disk_open = grub_loopback_open,
     .disk_read = grub_loopback_read,
     .disk_write = grub_loopback_write,
+#ifdef GRUB_UTIL
+    .disk_read_start = grub_loopback_read_start,
+    .disk_read_poll = grub_loopback_read_poll,
+#endif
     .next = 0
   };
 
@@ -233,6 +276,12 @@ static grub_extcmd_t cmd;
 
 GRUB_MOD_INIT(loopback)
 {
+#ifdef GRUB_UTIL
+  const char *async = getenv ("GRUB_LOOPBACK_ASYNC");
+
+  if (async)
+    async_polls = strtoul (async, NULL, 0);
+#endif
   cmd = grub_register_extcmd ("loopback", grub_cmd_loopback, 0,
 			      N_("[-d] DEVICENAME FILE."),
 			      /* TRANSLATORS: The file itself is not destroyed
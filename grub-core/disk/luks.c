@@ -26,11 +26,10 @@
 #include <grub/crypto.h>
 #include <grub/partition.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-#define MAX_PASSPHRASE 256
-
 #define LUKS_KEY_ENABLED  0x00AC71F3
 
 /* On disk LUKS header */
@@ -149,140 +148,99 @@ configure_ciphers (grub_disk_t disk, const char *check_uuid,
   return newdev;
 }
 
-static grub_err_t
-luks_recover_key (grub_disk_t source,
-		  grub_cryptodisk_t dev)
+struct luks_recover_ctx
 {
   struct grub_luks_phdr header;
   grub_size_t keysize;
-  grub_uint8_t *split_key = NULL;
-  char passphrase[MAX_PASSPHRASE] = "";
-  grub_uint8_t candidate_digest[sizeof (header.mkDigest)];
+  grub_uint8_t *split_key;
+};
+
+static grub_err_t
+luks_try_passphrase (grub_disk_t source, grub_cryptodisk_t dev,
+		     const char *passphrase, void *data)
+{
+  struct luks_recover_ctx *ctx = data;
+  struct grub_luks_phdr *header = &ctx->header;
+  grub_size_t keysize = ctx->keysize;
+  grub_uint8_t *split_key = ctx->split_key;
+  grub_uint8_t candidate_digest[sizeof (header->mkDigest)];
   unsigned i;
   grub_size_t length;
   grub_err_t err;
-  grub_size_t max_stripes = 1;
-  char *tmp;
-
-  err = grub_disk_read (source, 0, 0, sizeof (header), &header);
-  if (err)
-    return err;
-
-  grub_puts_ (N_("Attempting to decrypt master key..."));
-  keysize = grub_be_to_cpu32 (header.keyBytes);
-  if (keysize > GRUB_CRYPTODISK_MAX_KEYLEN)
-    return grub_error (GRUB_ERR_BAD_FS, "key is too long");
-
-  for (i = 0; i < ARRAY_SIZE (header.keyblock); i++)
-    if (grub_be_to_cpu32 (header.keyblock[i].active) == LUKS_KEY_ENABLED
-	&& grub_be_to_cpu32 (header.keyblock[i].stripes) > max_stripes)
-      max_stripes = grub_be_to_cpu32 (header.keyblock[i].stripes);
-
-  split_key = grub_malloc (keysize * max_stripes);
-  if (!split_key)
-    return grub_errno;
-
-  /* Get the passphrase from the user.  */
-  tmp = NULL;
-  if (source->partition)
-    tmp = grub_partition_get_name (source->partition);
-  grub_printf_ (N_("Enter passphrase for %s%s%s (%s): "), source->name,
-	       source->partition ? "," : "", tmp ? : "",
-	       dev->uuid);
-  grub_free (tmp);
-  if (!grub_password_get (passphrase, MAX_PASSPHRASE))
-    {
-      grub_free (split_key);
-      return grub_error (GRUB_ERR_BAD_ARGUMENT, "Passphrase not supplied");
-    }
 
   /* Try to recover master key from each active keyslot.  */
-  for (i = 0; i < ARRAY_SIZE (header.keyblock); i++)
+  for (i = 0; i < ARRAY_SIZE (header->keyblock); i++)
     {
       gcry_err_code_t gcry_err;
       grub_uint8_t candidate_key[GRUB_CRYPTODISK_MAX_KEYLEN];
       grub_uint8_t digest[GRUB_CRYPTODISK_MAX_KEYLEN];
+      grub_uint64_t start;
 
       /* Check if keyslot is enabled.  */
-      if (grub_be_to_cpu32 (header.keyblock[i].active) != LUKS_KEY_ENABLED)
+      if (grub_be_to_cpu32 (header->keyblock[i].active) != LUKS_KEY_ENABLED)
 	continue;
 
       grub_dprintf ("luks", "Trying keyslot %d\n", i);
 
       /* Calculate the PBKDF2 of the user supplied passphrase.  */
+      start = grub_get_time_ms ();
       gcry_err = grub_crypto_pbkdf2 (dev->hash, (grub_uint8_t *) passphrase,
 				     grub_strlen (passphrase),
-				     header.keyblock[i].passwordSalt,
-				     sizeof (header.keyblock[i].passwordSalt),
-				     grub_be_to_cpu32 (header.keyblock[i].
+				     header->keyblock[i].passwordSalt,
+				     sizeof (header->keyblock[i].passwordSalt),
+				     grub_be_to_cpu32 (header->keyblock[i].
 						       passwordIterations),
 				     digest, keysize);
 
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
+	return grub_crypto_gcry_error (gcry_err);
 
-      grub_dprintf ("luks", "PBKDF2 done\n");
+      grub_dprintf ("luks", "PBKDF2 done in %llu ms\n",
+		    (unsigned long long) (grub_get_time_ms () - start));
 
       gcry_err = grub_cryptodisk_setkey (dev, digest, keysize); 
+      grub_memset (digest, 0, sizeof (digest));
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
+	return grub_crypto_gcry_error (gcry_err);
 
-      length = (keysize * grub_be_to_cpu32 (header.keyblock[i].stripes));
+      length = (keysize * grub_be_to_cpu32 (header->keyblock[i].stripes));
 
       /* Read and decrypt the key material from the disk.  */
       err = grub_disk_read (source,
-			    grub_be_to_cpu32 (header.keyblock
+			    grub_be_to_cpu32 (header->keyblock
 					      [i].keyMaterialOffset), 0,
 			    length, split_key);
       if (err)
-	{
-	  grub_free (split_key);
-	  return err;
-	}
+	return err;
 
       gcry_err = grub_cryptodisk_decrypt (dev, split_key, length, 0);
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
+	return grub_crypto_gcry_error (gcry_err);
 
       /* Merge the decrypted key material to get the candidate master key.  */
       gcry_err = AF_merge (dev->hash, split_key, candidate_key, keysize,
-			   grub_be_to_cpu32 (header.keyblock[i].stripes));
+			   grub_be_to_cpu32 (header->keyblock[i].stripes));
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
+	return grub_crypto_gcry_error (gcry_err);
 
       grub_dprintf ("luks", "candidate key recovered\n");
 
       /* Calculate the PBKDF2 of the candidate master key.  */
       gcry_err = grub_crypto_pbkdf2 (dev->hash, candidate_key,
-				     grub_be_to_cpu32 (header.keyBytes),
-				     header.mkDigestSalt,
-				     sizeof (header.mkDigestSalt),
+				     grub_be_to_cpu32 (header->keyBytes),
+				     header->mkDigestSalt,
+				     sizeof (header->mkDigestSalt),
 				     grub_be_to_cpu32
-				     (header.mkDigestIterations),
+				     (header->mkDigestIterations),
 				     candidate_digest,
 				     sizeof (candidate_digest));
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
+	return grub_crypto_gcry_error (gcry_err);
 
       /* Compare the calculated PBKDF2 to the digest stored
          in the header to see if it's correct.  */
-      if (grub_memcmp (candidate_digest, header.mkDigest,
-		       sizeof (header.mkDigest)) != 0)
+      if (grub_memcmp (candidate_digest, header->mkDigest,
+		       sizeof (header->mkDigest)) != 0)
 	{
 	  grub_dprintf ("luks", "bad digest\n");
 	  continue;
@@ -294,21 +252,50 @@ luks_recover_key (grub_disk_t source,
 
       /* Set the master key.  */
       gcry_err = grub_cryptodisk_setkey (dev, candidate_key, keysize); 
+      grub_memset (candidate_key, 0, sizeof (candidate_key));
       if (gcry_err)
-	{
-	  grub_free (split_key);
-	  return grub_crypto_gcry_error (gcry_err);
-	}
-
-      grub_free (split_key);
+	return grub_crypto_gcry_error (gcry_err);
 
       return GRUB_ERR_NONE;
     }
 
-  grub_free (split_key);
   return GRUB_ACCESS_DENIED;
 }
 
+static grub_err_t
+luks_recover_key (grub_disk_t source,
+		  grub_cryptodisk_t dev)
+{
+  struct luks_recover_ctx ctx;
+  unsigned i;
+  grub_err_t err;
+  grub_size_t max_stripes = 1;
+
+  err = grub_disk_read (source, 0, 0, sizeof (ctx.header), &ctx.header);
+  if (err)
+    return err;
+
+  grub_puts_ (N_("Attempting to decrypt master key..."));
+  ctx.keysize = grub_be_to_cpu32 (ctx.header.keyBytes);
+  if (ctx.keysize > GRUB_CRYPTODISK_MAX_KEYLEN)
+    return grub_error (GRUB_ERR_BAD_FS, "key is too long");
+
+  for (i = 0; i < ARRAY_SIZE (ctx.header.keyblock); i++)
+    if (grub_be_to_cpu32 (ctx.header.keyblock[i].active) == LUKS_KEY_ENABLED
+	&& grub_be_to_cpu32 (ctx.header.keyblock[i].stripes) > max_stripes)
+      max_stripes = grub_be_to_cpu32 (ctx.header.keyblock[i].stripes);
+
+  ctx.split_key = grub_malloc (ctx.keysize * max_stripes);
+  if (!ctx.split_key)
+    return grub_errno;
+
+  err = grub_cryptodisk_recover_passphrase (source, dev, luks_try_passphrase,
+					    &ctx);
+
+  grub_free (ctx.split_key);
+  return err;
+}
+
 struct grub_cryptodisk_dev luks_crypto = {
   .scan = configure_ciphers,
   .recover_key = luks_recover_key
@@ -26,6 +26,7 @@
 #include <grub/crypto.h>
 #include <grub/partition.h>
 #include <grub/i18n.h>
+#include <grub/time.h>
 
 #include <base64.h>
 #include <json.h>
@@ -35,11 +36,10 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define LUKS_MAGIC_1ST "LUKS\xBA\xBE"
 #define LUKS_MAGIC_2ND "SKUL\xBA\xBE"
 
-#define MAX_PASSPHRASE 256
-
 enum grub_luks2_kdf_type
 {
   LUKS2_KDF_TYPE_ARGON2I,
+  LUKS2_KDF_TYPE_ARGON2ID,
   LUKS2_KDF_TYPE_PBKDF2
 };
 typedef enum grub_luks2_kdf_type grub_luks2_kdf_type_t;
@@ -158,7 +158,10 @@ luks2_parse_keyslot (grub_luks2_keyslot_t *out, const grub_json_t *keyslot)
     return grub_error (GRUB_ERR_BAD_ARGUMENT, "Missing or invalid KDF");
   else if (!grub_strcmp (type, "argon2i") || !grub_strcmp (type, "argon2id"))
     {
-      out->kdf.type = LUKS2_KDF_TYPE_ARGON2I;
+      if (!grub_strcmp (type, "argon2i"))
+	out->kdf.type = LUKS2_KDF_TYPE_ARGON2I;
+      else
+	out->kdf.type = LUKS2_KDF_TYPE_ARGON2ID;
       if (grub_json_getint64 (&out->kdf.u.argon2i.time, &kdf, "time") ||
 	  grub_json_getint64 (&out->kdf.u.argon2i.memory, &kdf, "memory") ||
 	  grub_json_getint64 (&out->kdf.u.argon2i.cpus, &kdf, "cpus"))
@@ -432,8 +435,34 @@ luks2_decrypt_key (grub_uint8_t *out_key,
   switch (k->kdf.type)
     {
       case LUKS2_KDF_TYPE_ARGON2I:
-	ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Argon2 not supported");
-	goto err;
+      case LUKS2_KDF_TYPE_ARGON2ID:
+	if (k->kdf.u.argon2i.time <= 0 || k->kdf.u.argon2i.time > GRUB_UINT_MAX
+	    || k->kdf.u.argon2i.memory <= 0
+	    || k->kdf.u.argon2i.memory > GRUB_UINT_MAX
+	    || k->kdf.u.argon2i.cpus <= 0
+	    || k->kdf.u.argon2i.cpus > GRUB_UINT_MAX)
+	  {
+	    ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid Argon2 parameters");
+	    goto err;
+	  }
+
+	gcry_ret = grub_crypto_argon2 (k->kdf.type == LUKS2_KDF_TYPE_ARGON2I
+				       ? GRUB_CRYPTO_ARGON2I
+				       : GRUB_CRYPTO_ARGON2ID,
+				       (grub_uint8_t *) passphrase,
+				       passphraselen,
+				       salt, saltlen,
+				       k->kdf.u.argon2i.time,
+				       k->kdf.u.argon2i.memory,
+				       k->kdf.u.argon2i.cpus,
+				       area_key, k->area.key_size);
+	if (gcry_ret)
+	  {
+	    ret = grub_crypto_gcry_error (gcry_ret);
+	    goto err;
+	  }
+
+	break;
       case LUKS2_KDF_TYPE_PBKDF2:
 	hash = grub_crypto_lookup_md_by_name (k->kdf.u.pbkdf2.hash);
 	if (!hash)
@@ -522,20 +551,123 @@ luks2_decrypt_key (grub_uint8_t *out_key,
   return ret;
 }
 
+/* Keyslot priorities: 0 never opens the volume, 2 is tried first.  */
+#define LUKS2_PRIORITY_IGNORE 0
+#define LUKS2_PRIORITY_NORMAL 1
+#define LUKS2_PRIORITY_HIGH   2
+
+struct luks2_recover_ctx
+{
+  grub_json_t *json;
+  grub_size_t nkeyslots;
+};
+
 static grub_err_t
-luks2_recover_key (grub_disk_t disk,
-		   grub_cryptodisk_t crypt)
+luks2_try_passphrase (grub_disk_t disk, grub_cryptodisk_t crypt,
+		      const char *passphrase, void *data)
 {
+  struct luks2_recover_ctx *ctx = data;
   grub_uint8_t candidate_key[GRUB_CRYPTODISK_MAX_KEYLEN];
-  char passphrase[MAX_PASSPHRASE], cipher[32];
-  char *json_header = NULL, *part = NULL, *ptr;
-  grub_size_t candidate_key_len = 0, i, size;
-  grub_luks2_header_t header;
+  char cipher[32], *ptr;
+  grub_size_t candidate_key_len = 0, i;
   grub_luks2_keyslot_t keyslot;
   grub_luks2_digest_t digest;
   grub_luks2_segment_t segment;
   gcry_err_code_t gcry_ret;
-  grub_json_t *json = NULL, keyslots;
+  grub_uint64_t start;
+  grub_err_t ret;
+  int high;
+
+  /* Try all keyslots, those with high priority first. */
+  for (high = 1; high >= 0 && candidate_key_len == 0; high--)
+    for (i = 0; i < ctx->nkeyslots; i++)
+      {
+	ret = luks2_get_keyslot (&keyslot, &digest, &segment, ctx->json, i);
+	if (ret)
+	  return ret;
+
+	if (keyslot.priority == LUKS2_PRIORITY_IGNORE)
+	  {
+	    if (high)
+	      grub_dprintf ("luks2", "Ignoring keyslot %"PRIuGRUB_SIZE" due to priority\n", i);
+	    continue;
+	  }
+	if ((keyslot.priority >= LUKS2_PRIORITY_HIGH) != high)
+	  continue;
+
+	grub_dprintf ("luks2", "Trying keyslot %"PRIuGRUB_SIZE"\n", i);
+
+	/* Set up disk according to keyslot's segment. */
+	crypt->offset = grub_divmod64 (segment.offset, segment.sector_size, NULL);
+	crypt->log_sector_size = sizeof (unsigned int) * 8
+		  - __builtin_clz ((unsigned int) segment.sector_size) - 1;
+	if (grub_strcmp (segment.size, "dynamic") == 0)
+	  crypt->total_length = grub_disk_get_size (disk) - crypt->offset;
+	else
+	  crypt->total_length = grub_strtoull (segment.size, NULL, 10);
+
+	start = grub_get_time_ms ();
+	ret = luks2_decrypt_key (candidate_key, disk, crypt, &keyslot,
+				 (const grub_uint8_t *) passphrase, grub_strlen (passphrase));
+	grub_dprintf ("luks2", "Keyslot %"PRIuGRUB_SIZE" key derivation took %llu ms\n",
+		      i, (unsigned long long) (grub_get_time_ms () - start));
+	if (ret)
+	  {
+	    grub_dprintf ("luks2", "Decryption with keyslot %"PRIuGRUB_SIZE" failed\n", i);
+	    continue;
+	  }
+
+	ret = luks2_verify_key (&digest, candidate_key, keyslot.key_size);
+	if (ret)
+	  {
+	    grub_dprintf ("luks2", "Could not open keyslot %"PRIuGRUB_SIZE"\n", i);
+	    continue;
+	  }
+
+	/*
+	 * TRANSLATORS: It's a cryptographic key slot: one element of an array
+	 * where each element is either empty or holds a key.
+	 */
+	grub_printf_ (N_("Slot %"PRIuGRUB_SIZE" opened\n"), i);
+
+	candidate_key_len = keyslot.key_size;
+	break;
+      }
+  if (candidate_key_len == 0)
+    return grub_error (GRUB_ERR_ACCESS_DENIED, "Invalid passphrase");
+
+  /* Set up disk cipher. */
+  grub_strncpy (cipher, segment.encryption, sizeof (cipher));
+  ptr = grub_memchr (cipher, '-', grub_strlen (cipher));
+  if (!ptr)
+    {
+      ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid encryption");
+      goto err;
+    }
+  *ptr = '\0';
+
+  ret = grub_cryptodisk_setcipher (crypt, cipher, ptr + 1);
+  if (ret)
+    goto err;
+
+  /* Set the master key. */
+  gcry_ret = grub_cryptodisk_setkey (crypt, candidate_key, candidate_key_len);
+  if (gcry_ret)
+    ret = grub_crypto_gcry_error (gcry_ret);
+
+ err:
+  grub_memset (candidate_key, 0, sizeof (candidate_key));
+  return ret;
+}
+
+static grub_err_t
+luks2_recover_key (grub_disk_t disk,
+		   grub_cryptodisk_t crypt)
+{
+  struct luks2_recover_ctx ctx = { .json = NULL };
+  char *json_header = NULL, *ptr;
+  grub_luks2_header_t header;
+  grub_json_t keyslots;
   grub_err_t ret;
 
   ret = luks2_read_header (disk, &header);
@@ -556,109 +688,26 @@ luks2_recover_key (grub_disk_t disk,
   if (!ptr)
     goto err;
 
-  ret = grub_json_parse (&json, json_header, grub_be_to_cpu64 (header.hdr_size));
+  ret = grub_json_parse (&ctx.json, json_header, grub_be_to_cpu64 (header.hdr_size));
   if (ret)
     {
       ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid LUKS2 JSON header");
       goto err;
     }
 
-  /* Get the passphrase from the user. */
-  if (disk->partition)
-    part = grub_partition_get_name (disk->partition);
-  grub_printf_ (N_("Enter passphrase for %s%s%s (%s): "), disk->name,
-		disk->partition ? "," : "", part ? : "",
-		crypt->uuid);
-  if (!grub_password_get (passphrase, MAX_PASSPHRASE))
-    {
-      ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Passphrase not supplied");
-      goto err;
-    }
-
-  if (grub_json_getvalue (&keyslots, json, "keyslots") ||
-      grub_json_getsize (&size, &keyslots))
+  if (grub_json_getvalue (&keyslots, ctx.json, "keyslots") ||
+      grub_json_getsize (&ctx.nkeyslots, &keyslots))
     {
       ret = grub_error (GRUB_ERR_BAD_ARGUMENT, "Could not get keyslots");
       goto err;
     }
 
-  /* Try all keyslot */
-  for (i = 0; i < size; i++)
-    {
-      ret = luks2_get_keyslot (&keyslot, &digest, &segment, json, i);
-      if (ret)
-	goto err;
-
-      if (keyslot.priority == 0)
-	{
-	  grub_dprintf ("luks2", "Ignoring keyslot %"PRIuGRUB_SIZE" due to priority\n", i);
-	  continue;
-        }
-
-      grub_dprintf ("luks2", "Trying keyslot %"PRIuGRUB_SIZE"\n", i);
-
-      /* Set up disk according to keyslot's segment. */
-      crypt->offset = grub_divmod64 (segment.offset, segment.sector_size, NULL);
-      crypt->log_sector_size = sizeof (unsigned int) * 8
-		- __builtin_clz ((unsigned int) segment.sector_size) - 1;
-      if (grub_strcmp (segment.size, "dynamic") == 0)
-	crypt->total_length = grub_disk_get_size (disk) - crypt->offset;
-      else
-	crypt->total_length = grub_strtoull (segment.size, NULL, 10);
-
-      ret = luks2_decrypt_key (candidate_key, disk, crypt, &keyslot,
-			       (const grub_uint8_t *) passphrase, grub_strlen (passphrase));
-      if (ret)
-	{
-	  grub_dprintf ("luks2", "Decryption with keyslot %"PRIuGRUB_SIZE" failed\n", i);
-	  continue;
-	}
-
-      ret = luks2_verify_key (&digest, candidate_key, keyslot.key_size);
-      if (ret)
-	{
-	  grub_dprintf ("luks2", "Could not open keyslot %"PRIuGRUB_SIZE"\n", i);
-	  continue;
-	}
-
-      /*
-       * TRANSLATORS: It's a cryptographic key slot: one element of an array
-       * where each element is either empty or holds a key.
-       */
-      grub_printf_ (N_("Slot %"PRIuGRUB_SIZE" opened\n"), i);
-
-      candidate_key_len = keyslot.key_size;
-      break;
-    }
-  if (candidate_key_len == 0)
-    {
-      ret = grub_error (GRUB_ERR_ACCESS_DENIED, "Invalid passphrase");
-      goto err;
-    }
-
-  /* Set up disk cipher. */
-  grub_strncpy (cipher, segment.encryption, sizeof (cipher));
-  ptr = grub_memchr (cipher, '-', grub_strlen (cipher));
-  if (!ptr)
-      return grub_error (GRUB_ERR_BAD_ARGUMENT, "Invalid encryption");
-  *ptr = '\0';
-
-  ret = grub_cryptodisk_setcipher (crypt, cipher, ptr + 1);
-  if (ret)
-      goto err;
-
-  /* Set the master key. */
-  gcry_ret = grub_cryptodisk_setkey (crypt, candidate_key, candidate_key_len);
-  if (gcry_ret)
-    {
-      ret = grub_crypto_gcry_error (gcry_ret);
-      goto err;
-    }
+  ret = grub_cryptodisk_recover_passphrase (disk, crypt, luks2_try_passphrase,
+					    &ctx);
 
  err:
-  grub_free (part);
   grub_free (json_header);
-  grub_json_free (json);
+  grub_json_free (ctx.json);
   return ret;
 }
 
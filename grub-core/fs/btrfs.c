@@ -56,8 +56,11 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BTRFS_LZO_BLOCK_MAX_CSIZE (GRUB_BTRFS_LZO_BLOCK_SIZE + \
 				     (GRUB_BTRFS_LZO_BLOCK_SIZE / 16) + 64 + 3)
 
-#define ZSTD_BTRFS_MAX_WINDOWLOG 17
-#define ZSTD_BTRFS_MAX_INPUT     (1 << ZSTD_BTRFS_MAX_WINDOWLOG)
+/* Largest amount of data held by a compressed extent.  */
+#define GRUB_BTRFS_MAX_COMPRESSED_EXTENT 0x20000
+
+/* Number of decompressed extents kept by a mount.  */
+#define GRUB_BTRFS_EXTENT_CACHE_SIZE 4
 
 typedef grub_uint8_t grub_btrfs_checksum_t[0x20];
 typedef grub_uint16_t grub_btrfs_uuid_t[8];
@@ -103,6 +106,18 @@ struct grub_btrfs_device_desc
   grub_uint64_t id;
 };
 
+/* A decompressed extent, keyed by the logical address of its compressed
+   data.  A LADDR of 0 marks an unused entry, whose buffer may still be
+   allocated.  */
+struct grub_btrfs_extent_cache
+{
+  grub_uint64_t laddr;
+  grub_uint8_t compression;
+  grub_size_t size;
+  char *buf;
+  unsigned long last_use;
+};
+
 struct grub_btrfs_data
 {
   struct grub_btrfs_superblock sblock;
@@ -120,6 +135,13 @@ struct grub_btrfs_data
   grub_uint64_t exttree;
   grub_size_t extsize;
   struct grub_btrfs_extent_data *extent;
+
+  /* Recently decompressed extents.  */
+  struct grub_btrfs_extent_cache ext_cache[GRUB_BTRFS_EXTENT_CACHE_SIZE];
+  unsigned long ext_cache_use;
+
+  /* Reused for every zstd extent, allocated on first use.  */
+  ZSTD_DCtx *zstd_dctx;
 };
 
 struct grub_btrfs_chunk_item
@@ -1208,6 +1230,9 @@ grub_btrfs_unmount (struct grub_btrfs_data *data)
         grub_device_close (data->devices_attached[i].dev);
   grub_free (data->devices_attached);
   grub_free (data->extent);
+  for (i = 0; i < GRUB_BTRFS_EXTENT_CACHE_SIZE; i++)
+    grub_free (data->ext_cache[i].buf);
+  ZSTD_freeDCtx (data->zstd_dctx);
   grub_free (data);
 }
 
@@ -1257,40 +1282,68 @@ static ZSTD_customMem grub_zstd_allocator (void)
   return allocator;
 }
 
+/* Return the cached extent with the compressed data at LADDR, or NULL.  */
+static struct grub_btrfs_extent_cache *
+grub_btrfs_extent_cache_lookup (struct grub_btrfs_data *data,
+				grub_uint64_t laddr, grub_uint8_t compression)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_BTRFS_EXTENT_CACHE_SIZE; i++)
+    if (data->ext_cache[i].laddr == laddr
+	&& data->ext_cache[i].compression == compression)
+      {
+	data->ext_cache[i].last_use = ++data->ext_cache_use;
+	return &data->ext_cache[i];
+      }
+
+  return NULL;
+}
+
+/* Return the least recently used entry, emptied, with a buffer of
+   GRUB_BTRFS_MAX_COMPRESSED_EXTENT bytes.  */
+static struct grub_btrfs_extent_cache *
+grub_btrfs_extent_cache_get (struct grub_btrfs_data *data)
+{
+  struct grub_btrfs_extent_cache *entry = &data->ext_cache[0];
+  unsigned i;
+
+  for (i = 1; i < GRUB_BTRFS_EXTENT_CACHE_SIZE; i++)
+    if (data->ext_cache[i].last_use < entry->last_use)
+      entry = &data->ext_cache[i];
+
+  entry->laddr = 0;
+  entry->last_use = ++data->ext_cache_use;
+  if (!entry->buf)
+    entry->buf = grub_malloc (GRUB_BTRFS_MAX_COMPRESSED_EXTENT);
+  if (!entry->buf)
+    return NULL;
+
+  return entry;
+}
+
+/*
+ * Decompress OSIZE bytes at OFF of the zstd extent in IBUF to OBUF.  A read
+ * of the whole extent is decompressed straight to OBUF, anything else needs
+ * a scratch buffer, taken from the extent cache.
+ */
 static grub_ssize_t
-grub_btrfs_zstd_decompress (char *ibuf, grub_size_t isize, grub_off_t off,
+grub_btrfs_zstd_decompress (struct grub_btrfs_data *data,
+			    char *ibuf, grub_size_t isize, grub_off_t off,
 			    char *obuf, grub_size_t osize)
 {
-  void *allocated = NULL;
-  char *otmpbuf = obuf;
-  grub_size_t otmpsize = osize;
-  ZSTD_DCtx *dctx = NULL;
+  struct grub_btrfs_extent_cache *entry;
   grub_size_t zstd_ret;
-  grub_ssize_t ret = -1;
 
-  /*
-   * Zstd will fail if it can't fit the entire output in the destination
-   * buffer, so if osize isn't large enough, allocate a temporary buffer.
-   */
-  if (otmpsize < ZSTD_BTRFS_MAX_INPUT)
+  if (!data->zstd_dctx)
     {
-      allocated = grub_malloc (ZSTD_BTRFS_MAX_INPUT);
-      if (!allocated)
+      data->zstd_dctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
+      if (!data->zstd_dctx)
 	{
-	  grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed allocate a zstd buffer");
-	  goto err;
+	  /* ZSTD_createDCtx_advanced() only fails if it is out of memory. */
+	  grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed to create a zstd context");
+	  return -1;
 	}
-      otmpbuf = (char *) allocated;
-      otmpsize = ZSTD_BTRFS_MAX_INPUT;
-    }
-
-  /* Create the ZSTD_DCtx. */
-  dctx = ZSTD_createDCtx_advanced (grub_zstd_allocator ());
-  if (!dctx)
-    {
-      /* ZSTD_createDCtx_advanced() only fails if it is out of memory. */
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed to create a zstd context");
-      goto err;
     }
 
   /*
@@ -1301,29 +1354,45 @@ grub_btrfs_zstd_decompress (char *ibuf, grub_size_t isize, grub_off_t off,
   if (ZSTD_isError (isize))
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
-      goto err;
+      return -1;
     }
 
-  /* Decompress and check for errors. */
-  zstd_ret = ZSTD_decompressDCtx (dctx, otmpbuf, otmpsize, ibuf, isize);
-  if (ZSTD_isError (zstd_ret))
+  if (off == 0 && ZSTD_getFrameContentSize (ibuf, isize) == osize)
     {
-      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
-      goto err;
+      zstd_ret = ZSTD_decompressDCtx (data->zstd_dctx, obuf, osize,
+				      ibuf, isize);
+      if (ZSTD_isError (zstd_ret))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+	  return -1;
+	}
+      return zstd_ret;
     }
 
   /*
-   * Move the requested data into the obuf. obuf may be equal
-   * to otmpbuf, which is why grub_memmove() is required.
+   * Zstd will fail if it can't fit the entire output in the destination
+   * buffer, so decompress the whole extent to a cache buffer.
    */
-  grub_memmove (obuf, otmpbuf + off, osize);
-  ret = osize;
+  entry = grub_btrfs_extent_cache_get (data);
+  if (!entry)
+    return -1;
+
+  zstd_ret = ZSTD_decompressDCtx (data->zstd_dctx, entry->buf,
+				  GRUB_BTRFS_MAX_COMPRESSED_EXTENT,
+				  ibuf, isize);
+  if (ZSTD_isError (zstd_ret))
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+      return -1;
+    }
 
-err:
-  grub_free (allocated);
-  ZSTD_freeDCtx (dctx);
+  if (off >= zstd_ret)
+    return 0;
+  if (osize > zstd_ret - off)
+    osize = zstd_ret - off;
+  grub_memcpy (obuf, entry->buf + off, osize);
 
-  return ret;
+  return osize;
 }
 
 static grub_ssize_t
@@ -1419,6 +1488,75 @@ grub_btrfs_lzo_decompress(char *ibuf, grub_size_t isize, grub_off_t off,
   return ret;
 }
 
+/* Look up the extent of file INO of TREE containing POS and load it into
+   DATA->extent.  */
+static grub_err_t
+grub_btrfs_extent_lookup (struct grub_btrfs_data *data,
+			  grub_uint64_t ino, grub_uint64_t tree, grub_off_t pos)
+{
+  struct grub_btrfs_key key_in, key_out;
+  grub_disk_addr_t elemaddr;
+  grub_size_t elemsize;
+  grub_err_t err;
+
+  grub_free (data->extent);
+  data->extent = NULL;
+  key_in.object_id = ino;
+  key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
+  key_in.offset = grub_cpu_to_le64 (pos);
+  err = lower_bound (data, &key_in, &key_out, tree,
+		     &elemaddr, &elemsize, NULL, 0);
+  if (err)
+    return grub_errno;
+  if (key_out.object_id != ino
+      || key_out.type != GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "extent not found");
+      return grub_errno;
+    }
+  if ((grub_ssize_t) elemsize < ((char *) &data->extent->inl
+				 - (char *) data->extent))
+    {
+      grub_error (GRUB_ERR_BAD_FS, "extent descriptor is too short");
+      return grub_errno;
+    }
+  data->extstart = grub_le_to_cpu64 (key_out.offset);
+  data->extsize = elemsize;
+  data->extent = grub_malloc (elemsize);
+  data->extino = ino;
+  data->exttree = tree;
+  if (!data->extent)
+    return grub_errno;
+
+  err = grub_btrfs_read_logical (data, elemaddr, data->extent,
+				 elemsize, 0);
+  if (err)
+    {
+      grub_free (data->extent);
+      data->extent = NULL;
+      return err;
+    }
+
+  data->extend = data->extstart + grub_le_to_cpu64 (data->extent->size);
+  if (data->extent->type == GRUB_BTRFS_EXTENT_REGULAR
+      && (char *) data->extent + elemsize
+      >= (char *) &data->extent->filled + sizeof (data->extent->filled))
+    data->extend =
+      data->extstart + grub_le_to_cpu64 (data->extent->filled);
+
+  grub_dprintf ("btrfs", "regular extent 0x%" PRIxGRUB_UINT64_T "+0x%"
+		PRIxGRUB_UINT64_T "\n",
+		grub_le_to_cpu64 (key_out.offset),
+		grub_le_to_cpu64 (data->extent->size));
+  if (data->extend <= pos)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "extent not found");
+      return grub_errno;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_ssize_t
 grub_btrfs_extent_read (struct grub_btrfs_data *data,
 			grub_uint64_t ino, grub_uint64_t tree,
@@ -1433,59 +1571,9 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
       if (!data->extent || data->extstart > pos || data->extino != ino
 	  || data->exttree != tree || data->extend <= pos)
 	{
-	  struct grub_btrfs_key key_in, key_out;
-	  grub_disk_addr_t elemaddr;
-	  grub_size_t elemsize;
-
-	  grub_free (data->extent);
-	  key_in.object_id = ino;
-	  key_in.type = GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM;
-	  key_in.offset = grub_cpu_to_le64 (pos);
-	  err = lower_bound (data, &key_in, &key_out, tree,
-			     &elemaddr, &elemsize, NULL, 0);
+	  err = grub_btrfs_extent_lookup (data, ino, tree, pos);
 	  if (err)
 	    return -1;
-	  if (key_out.object_id != ino
-	      || key_out.type != GRUB_BTRFS_ITEM_TYPE_EXTENT_ITEM)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "extent not found");
-	      return -1;
-	    }
-	  if ((grub_ssize_t) elemsize < ((char *) &data->extent->inl
-					 - (char *) data->extent))
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "extent descriptor is too short");
-	      return -1;
-	    }
-	  data->extstart = grub_le_to_cpu64 (key_out.offset);
-	  data->extsize = elemsize;
-	  data->extent = grub_malloc (elemsize);
-	  data->extino = ino;
-	  data->exttree = tree;
-	  if (!data->extent)
-	    return grub_errno;
-
-	  err = grub_btrfs_read_logical (data, elemaddr, data->extent,
-					 elemsize, 0);
-	  if (err)
-	    return err;
-
-	  data->extend = data->extstart + grub_le_to_cpu64 (data->extent->size);
-	  if (data->extent->type == GRUB_BTRFS_EXTENT_REGULAR
-	      && (char *) data->extent + elemsize
-	      >= (char *) &data->extent->filled + sizeof (data->extent->filled))
-	    data->extend =
-	      data->extstart + grub_le_to_cpu64 (data->extent->filled);
-
-	  grub_dprintf ("btrfs", "regular extent 0x%" PRIxGRUB_UINT64_T "+0x%"
-			PRIxGRUB_UINT64_T "\n",
-			grub_le_to_cpu64 (key_out.offset),
-			grub_le_to_cpu64 (data->extent->size));
-	  if (data->extend <= pos)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "extent not found");
-	      return -1;
-	    }
 	}
       csize = data->extend - pos;
       extoff = pos - data->extstart;
@@ -1544,7 +1632,8 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 	    }
 	  else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
 	    {
-	      if (grub_btrfs_zstd_decompress (data->extent->inl, data->extsize -
+	      if (grub_btrfs_zstd_decompress (data, data->extent->inl,
+					      data->extsize -
 					      ((grub_uint8_t *) data->extent->inl
 					       - (grub_uint8_t *) data->extent),
 					      extoff, buf, csize)
@@ -1563,41 +1652,74 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 
 	  if (data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
 	    {
-	      char *tmp;
+	      struct grub_btrfs_extent_cache *cached, *entry = NULL;
+	      grub_uint64_t laddr = grub_le_to_cpu64 (data->extent->laddr);
+	      grub_uint64_t ram = grub_le_to_cpu64 (data->extent->size);
+	      grub_off_t zoff = extoff
+				+ grub_le_to_cpu64 (data->extent->offset);
+	      char *tmp, *dst = buf;
 	      grub_uint64_t zsize;
+	      grub_off_t doff = zoff;
+	      grub_size_t dsize = csize;
 	      grub_ssize_t ret;
 
+	      cached = grub_btrfs_extent_cache_lookup
+			(data, laddr, data->extent->compression);
+	      if (cached)
+		{
+		  if (zoff > cached->size || csize > cached->size - zoff)
+		    {
+		      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+				  "premature end of compressed");
+		      return -1;
+		    }
+		  grub_memcpy (buf, cached->buf + zoff, csize);
+		  break;
+		}
+
 	      zsize = grub_le_to_cpu64 (data->extent->compressed_size);
 	      tmp = grub_malloc (zsize);
 	      if (!tmp)
 		return -1;
-	      err = grub_btrfs_read_logical (data,
-					     grub_le_to_cpu64 (data->extent->laddr),
-					     tmp, zsize, 0);
+	      err = grub_btrfs_read_logical (data, laddr, tmp, zsize, 0);
 	      if (err)
 		{
 		  grub_free (tmp);
 		  return -1;
 		}
 
+	      /*
+	       * Unless all of it is wanted, decompress the whole extent to the
+	       * cache, the following reads are likely to be from it too.
+	       */
+	      if ((zoff != 0 || csize != ram)
+		  && ram <= GRUB_BTRFS_MAX_COMPRESSED_EXTENT)
+		{
+		  entry = grub_btrfs_extent_cache_get (data);
+		  if (!entry)
+		    {
+		      grub_free (tmp);
+		      return -1;
+		    }
+		  dst = entry->buf;
+		  doff = 0;
+		  dsize = ram;
+		}
+
 	      if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZLIB)
-		ret = grub_zlib_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		ret = grub_zlib_decompress (tmp, zsize, doff, dst, dsize);
 	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_LZO)
-		ret = grub_btrfs_lzo_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		ret = grub_btrfs_lzo_decompress (tmp, zsize, doff, dst, dsize);
 	      else if (data->extent->compression == GRUB_BTRFS_COMPRESSION_ZSTD)
-		ret = grub_btrfs_zstd_decompress (tmp, zsize, extoff
-				    + grub_le_to_cpu64 (data->extent->offset),
-				    buf, csize);
+		ret = grub_btrfs_zstd_decompress (data, tmp, zsize, doff,
+						  dst, dsize);
 	      else
 		ret = -1;
 
 	      grub_free (tmp);
 
-	      if (ret != (grub_ssize_t) csize)
+	      if (ret != (grub_ssize_t) dsize
+		  || (entry && (zoff > ram || csize > ram - zoff)))
 		{
 		  if (!grub_errno)
 		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
@@ -1605,6 +1727,14 @@ grub_btrfs_extent_read (struct grub_btrfs_data *data,
 		  return -1;
 		}
 
+	      if (entry)
+		{
+		  entry->laddr = laddr;
+		  entry->compression = data->extent->compression;
+		  entry->size = ram;
+		  grub_memcpy (buf, entry->buf + zoff, csize);
+		}
+
 	      break;
 	    }
 	  err = grub_btrfs_read_logical (data,
@@ -2081,6 +2211,18 @@ grub_btrfs_open (struct grub_file *file, const char *name)
   file->data = data;
   file->size = grub_le_to_cpu64 (inode.size);
 
+  /* Compressed data is decompressed one whole extent at a time, so if the
+     file starts with a compressed extent, it's likely to be compressed
+     throughout.  */
+  if (file->size
+      && grub_btrfs_extent_lookup (data, data->inode, data->tree, 0)
+      == GRUB_ERR_NONE
+      && data->extent->type == GRUB_BTRFS_EXTENT_REGULAR
+      && data->extent->compression != GRUB_BTRFS_COMPRESSION_NONE)
+    file->preferred_block_size = GRUB_BTRFS_MAX_COMPRESSED_EXTENT;
+  /* The first read will report any problem with the extent.  */
+  grub_errno = GRUB_ERR_NONE;
+
   return err;
 }
 
@@ -142,6 +142,22 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define EXT4_ENCRYPT_FLAG              0x800
 #define EXT4_EXTENTS_FLAG		0x80000
+#define EXT2_INDEX_FLAG			0x1000
+#define EXT4_CASEFOLD_FLAG		0x40000000
+
+/* Superblock flags.  */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* Hash functions of indexed directories.  */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
+/* Hash marking the end of an indexed directory.  */
+#define EXT2_HTREE_EOF			0x7fffffff
 
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
@@ -196,6 +212,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_high;
+  grub_uint32_t reserved_blocks_high;
+  grub_uint32_t free_blocks_high;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -262,6 +284,26 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* The index of an indexed directory, following the `.' and `..' entries
+   in its first block.  */
+struct grub_ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* Entry of an index node.  In the first entry, HASH is replaced by the
+   maximum number of entries in the low and the number of entries in the
+   high 16 bits.  */
+struct grub_ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -293,6 +335,9 @@ struct grub_ext3_journal_sblock
 };
 
 #define EXT4_EXT_MAGIC		0xf30a
+/* Extents longer than this are uninitialized, and this much longer than
+   their actual length.  */
+#define EXT4_EXT_INIT_MAX_LEN	32768
 
 struct grub_ext4_extent_header
 {
@@ -472,6 +517,11 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       struct grub_ext4_extent *ext;
       int i;
       grub_disk_addr_t ret;
+      grub_uint16_t len;
+
+      if (grub_fshelp_extent_lookup (data->disk, node->ino, log2_blksz,
+				     fileblock, &ret, NULL))
+	return ret;
 
       leaf = grub_ext4_find_leaf (data, (struct grub_ext4_extent_header *) inode->blocks.dir_blocks, fileblock);
       if (! leaf)
@@ -490,7 +540,10 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       if (--i >= 0)
         {
           fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
+	  len = grub_le_to_cpu16 (ext[i].len);
+	  /* Uninitialized extents are allocated but not written yet, so they
+	     read as zeros like holes.  */
+          if (len > EXT4_EXT_INIT_MAX_LEN || fileblock >= len)
 	    ret = 0;
           else
             {
@@ -500,6 +553,10 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
               start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
 
               ret = fileblock + start;
+
+	      grub_fshelp_extent_add (data->disk, node->ino, log2_blksz,
+				      grub_le_to_cpu32 (ext[i].block),
+				      len, start);
             }
         }
       else
@@ -571,12 +628,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node, node->ino,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_ext2_read_block,
+					grub_cpu_to_le32 (node->inode.size)
+					| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+					LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -744,6 +801,61 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Return a new node for DIRENT of the directory DIRO and its type in
+   TYPE.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       const struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data, fdiro->ino, &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       grub_fshelp_iterate_dir_hook_t hook, void *hook_data)
@@ -781,69 +893,441 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[MAX_NAMELEN + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, fpos + sizeof (struct ext2_dirent),
 			       dirent.namelen, filename);
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+	  filename[dirent.namelen] = '\0';
+
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
 	  if (! fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
+	  if (hook (filename, type, fdiro, hook_data))
+	    return 1;
+	}
+
+      fpos += grub_le_to_cpu16 (dirent.direntlen);
+    }
 
-	  filename[dirent.namelen] = '\0';
+  return 0;
+}
+
+/* The hash functions of indexed directories, which must match the ones
+   of Linux bit for bit.  */
+
+static inline grub_uint32_t
+grub_ext2_rol32 (grub_uint32_t x, int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+static inline int
+grub_ext2_hash_char (const char *s, int i, int unsigned_chars)
+{
+  return unsigned_chars ? (int) (grub_uint8_t) s[i] : (int) (grub_int8_t) s[i];
+}
+
+static grub_uint32_t
+grub_ext2_dx_hack_hash (const char *name, int len, int unsigned_chars)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  int i;
+
+  for (i = 0; i < len; i++)
+    {
+      hash = hash1 + (hash0 ^ (grub_uint32_t)
+		      (grub_ext2_hash_char (name, i, unsigned_chars) * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+static void
+grub_ext2_str2hashbuf (const char *msg, int len, grub_uint32_t *buf, int num,
+		       int unsigned_chars)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      val = grub_ext2_hash_char (msg, i, unsigned_chars) + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+#define HALF_MD4_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define HALF_MD4_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define HALF_MD4_H(x, y, z) ((x) ^ (y) ^ (z))
+#define HALF_MD4_ROUND(f, a, b, c, d, x, s) \
+  (a += f (b, c, d) + (x), a = grub_ext2_rol32 (a, s))
+#define HALF_MD4_K2 0x5a827999
+#define HALF_MD4_K3 0x6ed9eba1
+
+static void
+grub_ext2_half_md4_transform (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  HALF_MD4_ROUND (HALF_MD4_F, a, b, c, d, in[0], 3);
+  HALF_MD4_ROUND (HALF_MD4_F, d, a, b, c, in[1], 7);
+  HALF_MD4_ROUND (HALF_MD4_F, c, d, a, b, in[2], 11);
+  HALF_MD4_ROUND (HALF_MD4_F, b, c, d, a, in[3], 19);
+  HALF_MD4_ROUND (HALF_MD4_F, a, b, c, d, in[4], 3);
+  HALF_MD4_ROUND (HALF_MD4_F, d, a, b, c, in[5], 7);
+  HALF_MD4_ROUND (HALF_MD4_F, c, d, a, b, in[6], 11);
+  HALF_MD4_ROUND (HALF_MD4_F, b, c, d, a, in[7], 19);
+
+  HALF_MD4_ROUND (HALF_MD4_G, a, b, c, d, in[1] + HALF_MD4_K2, 3);
+  HALF_MD4_ROUND (HALF_MD4_G, d, a, b, c, in[3] + HALF_MD4_K2, 5);
+  HALF_MD4_ROUND (HALF_MD4_G, c, d, a, b, in[5] + HALF_MD4_K2, 9);
+  HALF_MD4_ROUND (HALF_MD4_G, b, c, d, a, in[7] + HALF_MD4_K2, 13);
+  HALF_MD4_ROUND (HALF_MD4_G, a, b, c, d, in[0] + HALF_MD4_K2, 3);
+  HALF_MD4_ROUND (HALF_MD4_G, d, a, b, c, in[2] + HALF_MD4_K2, 5);
+  HALF_MD4_ROUND (HALF_MD4_G, c, d, a, b, in[4] + HALF_MD4_K2, 9);
+  HALF_MD4_ROUND (HALF_MD4_G, b, c, d, a, in[6] + HALF_MD4_K2, 13);
+
+  HALF_MD4_ROUND (HALF_MD4_H, a, b, c, d, in[3] + HALF_MD4_K3, 3);
+  HALF_MD4_ROUND (HALF_MD4_H, d, a, b, c, in[7] + HALF_MD4_K3, 9);
+  HALF_MD4_ROUND (HALF_MD4_H, c, d, a, b, in[2] + HALF_MD4_K3, 11);
+  HALF_MD4_ROUND (HALF_MD4_H, b, c, d, a, in[6] + HALF_MD4_K3, 15);
+  HALF_MD4_ROUND (HALF_MD4_H, a, b, c, d, in[1] + HALF_MD4_K3, 3);
+  HALF_MD4_ROUND (HALF_MD4_H, d, a, b, c, in[5] + HALF_MD4_K3, 9);
+  HALF_MD4_ROUND (HALF_MD4_H, c, d, a, b, in[0] + HALF_MD4_K3, 11);
+  HALF_MD4_ROUND (HALF_MD4_H, b, c, d, a, in[4] + HALF_MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_tea_transform (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  grub_uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  int n;
+
+  for (n = 0; n < 16; n++)
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Return the hash of NAME with the hash function VERSION.  */
+static grub_uint32_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8];
+  grub_uint32_t hash = 0;
+  int unsigned_chars = (version >= EXT2_HASH_LEGACY_UNSIGNED);
+  int i;
+
+  /* An all zero seed means the default one.  */
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      {
+	for (i = 0; i < 4; i++)
+	  buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+	break;
+      }
+
+  switch (version)
+    {
+    case EXT2_HASH_LEGACY:
+    case EXT2_HASH_LEGACY_UNSIGNED:
+      hash = grub_ext2_dx_hack_hash (name, len, unsigned_chars);
+      break;
+
+    case EXT2_HASH_HALF_MD4:
+    case EXT2_HASH_HALF_MD4_UNSIGNED:
+      for (; len > 0; len -= 32, name += 32)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 8, unsigned_chars);
+	  grub_ext2_half_md4_transform (buf, in);
+	}
+      hash = buf[1];
+      break;
+
+    case EXT2_HASH_TEA:
+    case EXT2_HASH_TEA_UNSIGNED:
+      for (; len > 0; len -= 16, name += 16)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 4, unsigned_chars);
+	  grub_ext2_tea_transform (buf, in);
+	}
+      hash = buf[0];
+      break;
+    }
+
+  hash &= ~1;
+  if (hash == (EXT2_HTREE_EOF << 1))
+    hash = (EXT2_HTREE_EOF - 1) << 1;
+  return hash;
+}
+
+/* Read block BLOCK of the directory DIR into BUF.  */
+static grub_err_t
+grub_ext2_read_dir_block (grub_fshelp_node_t dir, grub_uint32_t block,
+			  char *buf)
+{
+  grub_ssize_t blksz = EXT2_BLOCK_SIZE (dir->data);
+
+  if (grub_ext2_read_file (dir, 0, 0,
+			   (grub_off_t) block << LOG2_BLOCK_SIZE (dir->data),
+			   blksz, buf) != blksz && ! grub_errno)
+    grub_error (GRUB_ERR_BAD_FS, "invalid directory index");
+  return grub_errno;
+}
+
+/* A level of the directory index on the way to a leaf.  */
+struct grub_ext2_dx_frame
+{
+  struct grub_ext2_dx_entry *entries;
+  int count;
+  int at;
+};
+
+static grub_err_t
+grub_ext2_dx_frame_init (struct grub_ext2_dx_frame *frame,
+			 char *entries, char *end)
+{
+  frame->entries = (struct grub_ext2_dx_entry *) entries;
+  frame->count = grub_le_to_cpu32 (frame->entries[0].hash) >> 16;
+  frame->at = 0;
+  if (frame->count == 0
+      || frame->count > (end - entries) / (int) sizeof (struct grub_ext2_dx_entry))
+    return grub_error (GRUB_ERR_BAD_FS, "invalid directory index");
+  return GRUB_ERR_NONE;
+}
+
+static inline grub_uint32_t
+grub_ext2_dx_block (const struct grub_ext2_dx_frame *frame)
+{
+  return grub_le_to_cpu32 (frame->entries[frame->at].block) & 0x0fffffff;
+}
+
+/* Look NAME up in DIR using the directory index, reading only the index
+   blocks on the way to its hash and the leaf blocks with the hash.  Return
+   GRUB_ERR_NOT_IMPLEMENTED_YET for directories which have to be scanned
+   instead: unindexed and encrypted ones, casefolded ones, whose index
+   hashes folded names, and those whose index doesn't make sense.  */
+static grub_err_t
+grub_ext2_lookup_file (grub_fshelp_node_t dir, const char *name,
+		       grub_fshelp_node_t *foundnode,
+		       enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_ext2_data *data = dir->data;
+  int blksz = EXT2_BLOCK_SIZE (data);
+  struct grub_ext2_dx_frame frames[3], *p;
+  struct grub_ext2_dx_root_info *info;
+  struct ext2_dirent *dot, *dotdot;
+  int namelen = grub_strlen (name);
+  int version, nlevels, l, up;
+  grub_uint32_t hash;
+  char *buf, *leaf;
+
+  if (! dir->inode_read)
+    {
+      if (grub_ext2_read_inode (data, dir->ino, &dir->inode))
+	return grub_errno;
+      dir->inode_read = 1;
+    }
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
+  if (! (data->sblock.feature_compatibility
+	 & grub_cpu_to_le32_compile_time (EXT2_FEATURE_COMPAT_DIR_INDEX))
+      || ! (dir->inode.flags & grub_cpu_to_le32_compile_time (EXT2_INDEX_FLAG))
+      || (dir->inode.flags & grub_cpu_to_le32_compile_time (EXT4_ENCRYPT_FLAG
+							    | EXT4_CASEFOLD_FLAG)))
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  buf = grub_malloc (blksz);
+  if (! buf)
+    return grub_errno;
+  if (grub_ext2_read_dir_block (dir, 0, buf))
+    goto out;
+
+  /* The index follows the `.' and `..' entries.  Leave anything we don't
+     understand to the linear search.  */
+  info = (struct grub_ext2_dx_root_info *) (buf + 24);
+  dot = (struct ext2_dirent *) buf;
+  dotdot = (struct ext2_dirent *) (buf + 12);
+  version = info->hash_version;
+  if (version <= EXT2_HASH_TEA
+      && (data->sblock.flags
+	  & grub_cpu_to_le32_compile_time (EXT2_FLAGS_UNSIGNED_HASH)))
+    version += EXT2_HASH_LEGACY_UNSIGNED;
+  nlevels = info->indirect_levels + 1;
+  if (grub_le_to_cpu16 (dot->direntlen) != 12
+      || grub_le_to_cpu16 (dotdot->direntlen) != blksz - 12
+      || info->reserved_zero || version > EXT2_HASH_TEA_UNSIGNED
+      || (info->unused_flags & 1) || info->info_length < 8
+      || 24 + info->info_length + (int) sizeof (struct grub_ext2_dx_entry) > blksz
+      || nlevels > (int) ARRAY_SIZE (frames))
+    {
+      grub_free (buf);
+      return GRUB_ERR_NOT_IMPLEMENTED_YET;
+    }
+
+  /* One block per index level and one for the leaf.  */
+  leaf = grub_realloc (buf, (nlevels + 1) * blksz);
+  if (! leaf)
+    goto out;
+  buf = leaf;
+  info = (struct grub_ext2_dx_root_info *) (buf + 24);
+  leaf = buf + nlevels * blksz;
+
+  hash = grub_ext2_dx_hash (data, version, name, namelen);
+
+  for (l = 0; l < nlevels; l++)
+    {
+      char *node = buf + l * blksz;
+      char *entries = (char *) info + info->info_length;
+      int lo, hi;
+
+      if (l > 0)
+	{
+	  if (grub_ext2_read_dir_block (dir,
+					grub_ext2_dx_block (&frames[l - 1]),
+					node))
+	    goto out;
+	  /* Skip the empty directory entry covering the node.  */
+	  entries = node + 8;
+	}
+      if (grub_ext2_dx_frame_init (&frames[l], entries, node + blksz))
+	goto out;
+
+      /* The last entry whose hash isn't above ours.  */
+      lo = 1;
+      hi = frames[l].count;
+      while (lo < hi)
+	{
+	  int mid = (lo + hi) / 2;
+
+	  if (grub_le_to_cpu32 (frames[l].entries[mid].hash) > hash)
+	    hi = mid;
+	  else
+	    lo = mid + 1;
+	}
+      frames[l].at = lo - 1;
+    }
+
+  while (1)
+    {
+      int pos, direntlen;
+
+      p = &frames[nlevels - 1];
+      if (grub_ext2_read_dir_block (dir, grub_ext2_dx_block (p), leaf))
+	goto out;
+
+      for (pos = 0; pos + (int) sizeof (struct ext2_dirent) <= blksz;
+	   pos += direntlen)
+	{
+	  struct ext2_dirent *dirent = (struct ext2_dirent *) (leaf + pos);
+
+	  direntlen = grub_le_to_cpu16 (dirent->direntlen);
+	  if (direntlen < (int) sizeof (*dirent) || pos + direntlen > blksz)
 	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
+	      grub_error (GRUB_ERR_BAD_FS, "invalid directory entry");
+	      goto out;
 	    }
-	  else
+
+	  if (dirent->inode != 0 && dirent->namelen == namelen
+	      && (int) sizeof (*dirent) + namelen <= direntlen
+	      && grub_memcmp (dirent + 1, name, namelen) == 0)
 	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
+	      *foundnode = grub_ext2_dirent_node (dir, dirent, foundtype);
+	      goto out;
 	    }
+	}
 
-	  if (hook (filename, type, fdiro, hook_data))
-	    return 1;
+      /* Names with the same hash can continue in the next leaf, whose
+	 index entry then has the hash with the lowest bit set.  */
+      for (up = 0; ++p->at == p->count; p--, up++)
+	if (p == frames)
+	  goto out;
+      if ((grub_le_to_cpu32 (p->entries[p->at].hash) & ~1) != hash)
+	goto out;
+      for (; up > 0; up--, p++)
+	{
+	  char *node = buf + (p - frames + 1) * blksz;
+
+	  if (grub_ext2_read_dir_block (dir, grub_ext2_dx_block (p), node)
+	      || grub_ext2_dx_frame_init (p + 1, node + 8, node + blksz))
+	    goto out;
 	}
+    }
 
-      fpos += grub_le_to_cpu16 (dirent.direntlen);
+ out:
+  grub_free (buf);
+  if (grub_errno == GRUB_ERR_BAD_FS)
+    {
+      grub_dprintf ("ext2", "unusable directory index: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NOT_IMPLEMENTED_YET;
     }
+  return grub_errno;
+}
 
-  return 0;
+static grub_uint64_t
+grub_ext2_node_ino (grub_fshelp_node_t node)
+{
+  return node->ino;
 }
 
+static grub_fshelp_node_t
+grub_ext2_make_node (grub_fshelp_node_t dir, grub_uint64_t ino)
+{
+  struct grub_fshelp_node *node;
+
+  node = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! node)
+    return NULL;
+
+  node->data = dir->data;
+  node->ino = ino;
+  node->inode_read = 0;
+
+  return node;
+}
+
+static const struct grub_fshelp_node_ops grub_ext2_node_ops =
+  {
+    .get_ino = grub_ext2_node_ino,
+    .make_node = grub_ext2_make_node
+  };
+
 /* Open a file named NAME and initialize FILE.  */
 static grub_err_t
 grub_ext2_open (struct grub_file *file, const char *name)
@@ -861,9 +1345,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      grub_ext2_iterate_dir, grub_ext2_lookup_file,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      data->disk, &grub_ext2_node_ops);
   if (err)
     goto fail;
 
@@ -881,12 +1366,14 @@ grub_ext2_open (struct grub_file *file, const char *name)
     }
 
   grub_memcpy (data->inode, &fdiro->inode, sizeof (struct grub_ext2_inode));
+  data->diropen.ino = fdiro->ino;
   grub_free (fdiro);
 
   file->size = grub_le_to_cpu32 (data->inode->size);
   file->size |= ((grub_off_t) grub_le_to_cpu32 (data->inode->size_high)) << 32;
   file->data = data;
   file->offset = 0;
+  file->preferred_block_size = EXT2_BLOCK_SIZE (data);
 
   return 0;
 
@@ -973,9 +1460,10 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				grub_ext2_iterate_dir, grub_ext2_lookup_file,
+				grub_ext2_read_symlink, GRUB_FSHELP_DIR,
+				ctx.data->disk, &grub_ext2_node_ops);
   if (grub_errno)
     goto fail;
 
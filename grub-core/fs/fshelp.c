@@ -24,6 +24,7 @@
 #include <grub/fshelp.h>
 #include <grub/dl.h>
 #include <grub/i18n.h>
+#include <grub/partition.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -52,6 +53,10 @@ struct grub_fshelp_find_file_ctx
   /* Global options. */
   int symlinknest;
 
+  /* Directory entry cache, if the filesystem supports it.  */
+  grub_disk_t disk;
+  const struct grub_fshelp_node_ops *ops;
+
   /* Current file being traversed and its parents.  */
   struct stack_element *currnode;
 };
@@ -158,6 +163,146 @@ directory_find_file (grub_fshelp_node_t node, const char *name, grub_fshelp_node
   return GRUB_ERR_NONE;
 }
 
+/* Cache of directory lookups, shared by all filesystems providing
+   struct grub_fshelp_node_ops.  */
+#define DENTRY_CACHE_SIZE	256
+#define DENTRY_NAME_MAX		64
+
+struct dentry_cache_entry
+{
+  const struct grub_fshelp_node_ops *ops;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t parent;
+  /* Empty if the entry is unused.  */
+  char name[DENTRY_NAME_MAX];
+  /* GRUB_FSHELP_UNKNOWN if the name doesn't exist.  */
+  enum grub_fshelp_filetype type;
+  grub_uint64_t ino;
+  unsigned long last_use;
+};
+
+static struct dentry_cache_entry dentry_cache[DENTRY_CACHE_SIZE];
+static unsigned long dentry_cache_clock;
+static unsigned long dentry_cache_generation;
+static unsigned long dentry_cache_hits;
+static unsigned long dentry_cache_negative_hits;
+static unsigned long dentry_cache_misses;
+
+void
+grub_fshelp_dentry_cache_get_stats (unsigned long *hits,
+				    unsigned long *negative_hits,
+				    unsigned long *misses)
+{
+  *hits = dentry_cache_hits;
+  *negative_hits = dentry_cache_negative_hits;
+  *misses = dentry_cache_misses;
+}
+
+static struct dentry_cache_entry *
+dentry_cache_find (struct grub_fshelp_find_file_ctx *ctx,
+		   grub_uint64_t parent, const char *name, int alloc)
+{
+  struct dentry_cache_entry *e, *victim = dentry_cache;
+  grub_disk_addr_t part_start;
+  unsigned i;
+
+  /* The disk cache going away means the media may have changed.  */
+  if (dentry_cache_generation != grub_disk_cache_generation)
+    {
+      grub_memset (dentry_cache, 0, sizeof (dentry_cache));
+      dentry_cache_generation = grub_disk_cache_generation;
+    }
+
+  part_start = grub_partition_get_start (ctx->disk->partition);
+
+  for (i = 0, e = dentry_cache; i < DENTRY_CACHE_SIZE; i++, e++)
+    {
+      if (e->name[0] && e->parent == parent && e->ops == ctx->ops
+	  && e->dev_id == ctx->disk->dev->id && e->disk_id == ctx->disk->id
+	  && e->part_start == part_start && grub_strcmp (e->name, name) == 0)
+	{
+	  e->last_use = ++dentry_cache_clock;
+	  return e;
+	}
+      if (victim->name[0] && (! e->name[0] || e->last_use < victim->last_use))
+	victim = e;
+    }
+
+  if (! alloc)
+    return NULL;
+
+  victim->ops = ctx->ops;
+  victim->dev_id = ctx->disk->dev->id;
+  victim->disk_id = ctx->disk->id;
+  victim->part_start = part_start;
+  victim->parent = parent;
+  grub_strcpy (victim->name, name);
+  victim->last_use = ++dentry_cache_clock;
+  return victim;
+}
+
+/* Look NAME up in the directory NODE, going through the directory entry
+   cache if possible.  */
+static grub_err_t
+lookup_name (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node,
+	     const char *name, grub_fshelp_node_t *foundnode,
+	     enum grub_fshelp_filetype *foundtype,
+	     iterate_dir_func iterate_dir, lookup_file_func lookup_file)
+{
+  struct dentry_cache_entry *e = NULL;
+  grub_uint64_t parent = 0;
+  grub_err_t err;
+  int use_cache;
+
+  use_cache = ctx->ops && grub_strlen (name) < DENTRY_NAME_MAX;
+
+  if (use_cache)
+    {
+      parent = ctx->ops->get_ino (node);
+      e = dentry_cache_find (ctx, parent, name, 0);
+      if (e && e->type == GRUB_FSHELP_UNKNOWN)
+	{
+	  dentry_cache_negative_hits++;
+	  return GRUB_ERR_NONE;
+	}
+      if (e)
+	{
+	  dentry_cache_hits++;
+	  *foundnode = ctx->ops->make_node (node, e->ino);
+	  if (! *foundnode)
+	    return grub_errno;
+	  *foundtype = e->type;
+	  return GRUB_ERR_NONE;
+	}
+      dentry_cache_misses++;
+    }
+
+  err = GRUB_ERR_NOT_IMPLEMENTED_YET;
+  if (lookup_file)
+    err = lookup_file (node, name, foundnode, foundtype);
+  /* LOOKUP_FILE can't handle this directory, search it linearly.  */
+  if (err == GRUB_ERR_NOT_IMPLEMENTED_YET && iterate_dir)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      err = directory_find_file (node, name, foundnode, foundtype, iterate_dir);
+    }
+  if (err || ! use_cache)
+    return err;
+
+  e = dentry_cache_find (ctx, parent, name, 1);
+  if (*foundnode)
+    {
+      e->type = *foundtype & ~GRUB_FSHELP_CASE_INSENSITIVE;
+      e->ino = ctx->ops->get_ino (*foundnode);
+    }
+  else
+    e->type = GRUB_FSHELP_UNKNOWN;
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 find_file (char *currpath,
 	   iterate_dir_func iterate_dir, lookup_file_func lookup_file,
@@ -202,10 +347,8 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
-      else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+      err = lookup_name (ctx, ctx->currnode->node, name, &foundnode,
+			 &foundtype, iterate_dir, lookup_file);
       *next = c;
 
       if (err)
@@ -264,12 +407,16 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    grub_disk_t disk,
+			    const struct grub_fshelp_node_ops *ops)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
     .symlinknest = 0,
+    .disk = disk,
+    .ops = ops,
     .currnode = 0
   };
   grub_err_t err;
@@ -327,7 +474,7 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
@@ -340,27 +487,151 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL, NULL);
 
 }
 
-/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
-   beginning with the block POS.  READ_HOOK should be set before
-   reading a block from the file.  READ_HOOK_DATA is passed through as
-   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
-   file blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
-grub_ssize_t
-grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
-		       grub_disk_read_hook_t read_hook, void *read_hook_data,
-		       grub_off_t pos, grub_size_t len, char *buf,
-		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
-                                                      grub_disk_addr_t block),
-		       grub_off_t filesize, int log2blocksize,
-		       grub_disk_addr_t blocks_start)
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      lookup_file_func lookup_file,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk,
+			      const struct grub_fshelp_node_ops *ops)
 {
-  grub_disk_addr_t i, blockcnt;
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, lookup_file,
+				     read_symlink, expecttype, disk, ops);
+}
+
+/* Upper bound of a single read of contiguous blocks, so that progress
+   keeps being reported for large reads.  */
+#define MAX_RUN_SIZE		(8 << 20)
+
+/* Cache of file extents, shared by all opens of all files.  */
+#define EXTENT_CACHE_SIZE	256
+
+struct extent_cache_entry
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint64_t ino;
+  int log2blocksize;
+  /* First file block of the extent.  */
+  grub_disk_addr_t start;
+  /* Number of blocks, 0 if the entry is unused.  */
+  grub_disk_addr_t len;
+  /* Disk block holding file block START.  */
+  grub_disk_addr_t blknr;
+  unsigned long last_use;
+};
+
+static struct extent_cache_entry extent_cache[EXTENT_CACHE_SIZE];
+static unsigned long extent_cache_clock;
+static unsigned long extent_cache_generation;
+
+/* Entries are kept when the disk is closed, as every file open opens and
+   closes it and they are meant to carry over to the next open.  Instead
+   they go away with the disk cache, which is dropped when a disk is opened
+   more than GRUB_CACHE_TIMEOUT seconds after the last close, as the media
+   may have changed since.  */
+static void
+extent_cache_check_generation (void)
+{
+  if (extent_cache_generation == grub_disk_cache_generation)
+    return;
+  grub_memset (extent_cache, 0, sizeof (extent_cache));
+  extent_cache_generation = grub_disk_cache_generation;
+}
+
+static inline int
+extent_cache_match (const struct extent_cache_entry *e, grub_disk_t disk,
+		    grub_disk_addr_t part_start, grub_uint64_t ino,
+		    int log2blocksize)
+{
+  return (e->len && e->ino == ino && e->dev_id == disk->dev->id
+	  && e->disk_id == disk->id && e->part_start == part_start
+	  && e->log2blocksize == log2blocksize);
+}
+
+void
+grub_fshelp_extent_add (grub_disk_t disk, grub_uint64_t ino,
+			int log2blocksize, grub_disk_addr_t start,
+			grub_disk_addr_t len, grub_disk_addr_t blknr)
+{
+  struct extent_cache_entry *e, *victim = extent_cache;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  if (! len || ! blknr)
+    return;
+
+  extent_cache_check_generation ();
+
+  for (i = 0, e = extent_cache; i < EXTENT_CACHE_SIZE; i++, e++)
+    {
+      if (extent_cache_match (e, disk, part_start, ino, log2blocksize)
+	  && e->start == start)
+	{
+	  victim = e;
+	  break;
+	}
+      if (victim->len && (! e->len || e->last_use < victim->last_use))
+	victim = e;
+    }
+
+  victim->dev_id = disk->dev->id;
+  victim->disk_id = disk->id;
+  victim->part_start = part_start;
+  victim->ino = ino;
+  victim->log2blocksize = log2blocksize;
+  victim->start = start;
+  victim->len = len;
+  victim->blknr = blknr;
+  victim->last_use = ++extent_cache_clock;
+}
+
+int
+grub_fshelp_extent_lookup (grub_disk_t disk, grub_uint64_t ino,
+			   int log2blocksize, grub_disk_addr_t block,
+			   grub_disk_addr_t *blknr, grub_disk_addr_t *count)
+{
+  struct extent_cache_entry *e;
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  extent_cache_check_generation ();
+
+  for (i = 0, e = extent_cache; i < EXTENT_CACHE_SIZE; i++, e++)
+    if (extent_cache_match (e, disk, part_start, ino, log2blocksize)
+	&& block >= e->start && block - e->start < e->len)
+      {
+	e->last_use = ++extent_cache_clock;
+	*blknr = e->blknr + (block - e->start);
+	if (count)
+	  *count = e->len - (block - e->start);
+	return 1;
+      }
+
+  return 0;
+}
+
+static grub_ssize_t
+read_file_real (grub_disk_t disk, grub_fshelp_node_t node,
+		grub_disk_read_hook_t read_hook, void *read_hook_data,
+		grub_off_t pos, grub_size_t len, char *buf,
+		grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+					       grub_disk_addr_t block),
+		grub_off_t filesize, int log2blocksize,
+		grub_disk_addr_t blocks_start, int have_ino, grub_uint64_t ino)
+{
+  grub_disk_addr_t i, blockcnt, firstblock, run, nextblk = 0;
+  grub_disk_addr_t maxrun;
   int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  int have_next = 0;
 
   if (pos > filesize)
     {
@@ -374,36 +645,73 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
     len = filesize - pos;
 
   blockcnt = ((len + pos) + blocksize - 1) >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  firstblock = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  maxrun = MAX_RUN_SIZE >> (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  if (! maxrun)
+    maxrun = 1;
 
-  for (i = pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS); i < blockcnt; i++)
+  for (i = firstblock; i < blockcnt; i += run)
     {
-      grub_disk_addr_t blknr;
-      int blockoff = pos & (blocksize - 1);
-      int blockend = blocksize;
-
-      int skipfirst = 0;
+      grub_disk_addr_t blknr, extblk, extlen;
+      grub_size_t skipfirst = 0;
+      grub_size_t readlen;
 
-      blknr = get_block (node, i);
-      if (grub_errno)
-	return -1;
+      if (have_next)
+	blknr = nextblk;
+      else
+	{
+	  blknr = get_block (node, i);
+	  if (grub_errno)
+	    return -1;
+	}
+      have_next = 0;
+
+      /* Read the rest of a known extent in one go.  */
+      run = 1;
+      if (have_ino && blknr
+	  && grub_fshelp_extent_lookup (disk, ino, log2blocksize, i,
+					&extblk, &extlen)
+	  && extblk == blknr)
+	{
+	  run = (extlen < blockcnt - i) ? extlen : blockcnt - i;
+	  if (run > maxrun)
+	    run = maxrun;
+	}
+      else
+	/* Otherwise find out how many of the following blocks are
+	   physically contiguous, or holes as well.  */
+	while (i + run < blockcnt && run < maxrun)
+	  {
+	    nextblk = get_block (node, i + run);
+	    if (grub_errno)
+	      return -1;
+	    if (nextblk != (blknr ? blknr + run : 0))
+	      {
+		have_next = 1;
+		break;
+	      }
+	    run++;
+	  }
 
       blknr = blknr << log2blocksize;
 
+      readlen = run << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+
       /* Last block.  */
-      if (i == blockcnt - 1)
+      if (i + run == blockcnt)
 	{
-	  blockend = (len + pos) & (blocksize - 1);
+	  grub_size_t blockend = (len + pos) & (blocksize - 1);
 
 	  /* The last portion is exactly blocksize.  */
-	  if (! blockend)
-	    blockend = blocksize;
+	  if (blockend)
+	    readlen -= blocksize - blockend;
 	}
 
       /* First block.  */
-      if (i == (pos >> (log2blocksize + GRUB_DISK_SECTOR_BITS)))
+      if (i == firstblock)
 	{
-	  skipfirst = blockoff;
-	  blockend -= skipfirst;
+	  skipfirst = pos & (blocksize - 1);
+	  readlen -= skipfirst;
 	}
 
       /* If the block number is 0 this block is not stored on disk but
@@ -414,16 +722,56 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 	  disk->read_hook_data = read_hook_data;
 
 	  grub_disk_read (disk, blknr + blocks_start, skipfirst,
-			  blockend, buf);
+			  readlen, buf);
 	  disk->read_hook = 0;
 	  if (grub_errno)
 	    return -1;
 	}
       else
-	grub_memset (buf, 0, blockend);
+	grub_memset (buf, 0, readlen);
 
-      buf += blocksize - skipfirst;
+      buf += readlen;
     }
 
   return len;
 }
+
+/* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
+   beginning with the block POS.  READ_HOOK should be set before
+   reading a block from the file.  READ_HOOK_DATA is passed through as
+   the DATA argument to READ_HOOK.  GET_BLOCK is used to translate
+   file blocks to disk blocks.  The file is FILESIZE bytes big and the
+   blocks have a size of LOG2BLOCKSIZE (in log2).  Runs of physically
+   contiguous blocks are read with a single disk read, READ_HOOK is
+   called for the same sectors as with one read per block.  */
+grub_ssize_t
+grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_disk_read_hook_t read_hook, void *read_hook_data,
+		       grub_off_t pos, grub_size_t len, char *buf,
+		       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+                                                      grub_disk_addr_t block),
+		       grub_off_t filesize, int log2blocksize,
+		       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, get_block, filesize, log2blocksize,
+			 blocks_start, 0, 0);
+}
+
+/* Like grub_fshelp_read_file, but the rest of an extent of inode INO found
+   in the extent cache is read with a single disk read.  */
+grub_ssize_t
+grub_fshelp_read_file_extents (grub_disk_t disk, grub_fshelp_node_t node,
+			       grub_uint64_t ino,
+			       grub_disk_read_hook_t read_hook,
+			       void *read_hook_data,
+			       grub_off_t pos, grub_size_t len, char *buf,
+			       grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+							      grub_disk_addr_t block),
+			       grub_off_t filesize, int log2blocksize,
+			       grub_disk_addr_t blocks_start)
+{
+  return read_file_real (disk, node, read_hook, read_hook_data, pos, len,
+			 buf, get_block, filesize, log2blocksize,
+			 blocks_start, 1, ino);
+}
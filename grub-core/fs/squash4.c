@@ -26,6 +26,7 @@
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <minilzo.h>
 
 #include "xz.h"
@@ -183,6 +184,7 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
   };
 
 
@@ -319,6 +321,33 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return len;
 }
 
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize = data->blksz;
+  grub_uint8_t *udata;
+  grub_ssize_t ret;
+
+  if (usize < 8192)
+    usize = 8192;
+
+  udata = grub_malloc (usize);
+  if (!udata)
+    return -1;
+
+  ret = grub_lz4_decompress (inbuf, insize, udata, usize);
+  if (ret < 0 || off + len > (grub_size_t) ret)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      grub_free (udata);
+      return -1;
+    }
+  grub_memcpy (outbuf, udata + off, len);
+  grub_free (udata);
+  return len;
+}
+
 static grub_ssize_t
 xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
 	       char *outbuf, grub_size_t len, struct grub_squash_data *data)
@@ -423,6 +452,9 @@ squash_mount (grub_disk_t disk)
     case grub_cpu_to_le16_compile_time (COMPRESSION_LZO):
       data->decompress = lzo_decompress;
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+      data->decompress = lz4_decompress;
+      break;
     case grub_cpu_to_le16_compile_time (COMPRESSION_XZ):
       data->decompress = xz_decompress;
       data->xzbuf = grub_malloc (XZBUFSIZ);
@@ -738,6 +770,8 @@ grub_squash_open (struct grub_file *file, const char *name)
 
   grub_free (fdiro);
 
+  file->preferred_block_size = data->blksz;
+
   return GRUB_ERR_NONE;
 }
 
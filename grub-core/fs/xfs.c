@@ -45,6 +45,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define	XFS_SB_VERSION_SECTORBIT	0x0800
 #define	XFS_SB_VERSION_EXTFLGBIT	0x1000
 #define	XFS_SB_VERSION_DIRV2BIT		0x2000
+#define	XFS_SB_VERSION_BORGBIT		0x4000	/* ASCII only case-insens. */
 #define XFS_SB_VERSION_MOREBITSBIT	0x8000
 #define XFS_SB_VERSION_BITS_SUPPORTED \
 	(XFS_SB_VERSION_NUMBITS | \
@@ -210,6 +211,41 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } GRUB_PACKED;
 
+/* Hash index entry of a directory, sorted by HASHVAL.  */
+struct grub_xfs_dir2_leaf_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t address;
+} GRUB_PACKED;
+
+/* Hash btree entry of a node directory.  */
+struct grub_xfs_da_node_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t before;
+} GRUB_PACKED;
+
+/* Common header of directory leaf and node blocks.  In V5 crc, uuid,
+   etc. follow.  */
+struct grub_xfs_da_blkinfo
+{
+  grub_uint32_t forw;
+  grub_uint32_t back;
+  grub_uint16_t magic;
+  grub_uint16_t pad;
+} GRUB_PACKED;
+
+#define XFS_DIR2_LEAF1_MAGIC	0xd2f1
+#define XFS_DIR2_LEAFN_MAGIC	0xd2ff
+#define XFS_DA_NODE_MAGIC	0xfebe
+#define XFS_DIR3_LEAF1_MAGIC	0x3df1
+#define XFS_DIR3_LEAFN_MAGIC	0x3dff
+#define XFS_DA3_NODE_MAGIC	0x3ebe
+
+/* Byte offset of the hash index in leaf and node directories.  */
+#define XFS_DIR2_LEAF_OFFSET	(1ULL << 35)
+#define XFS_DA_NODE_MAXDEPTH	5
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -227,6 +263,7 @@ struct grub_xfs_data
   grub_uint32_t agsize;
   unsigned int hasftype:1;
   unsigned int hascrc:1;
+  unsigned int ascii_ci:1;
   struct grub_fshelp_node diropen;
 };
 
@@ -516,6 +553,13 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   int ex, nrec;
   struct grub_xfs_extent *exts;
   grub_uint64_t ret = 0;
+  grub_disk_addr_t cached;
+
+  if (grub_fshelp_extent_lookup (node->data->disk, node->ino,
+				 node->data->sblock.log2_bsize
+				 - GRUB_DISK_SECTOR_BITS, fileblock,
+				 &cached, NULL))
+    return cached;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
@@ -604,6 +648,10 @@ grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       else if (fileblock < offset + size)
         {
           ret = (fileblock - offset + start);
+	  grub_fshelp_extent_add (node->data->disk, node->ino,
+				  node->data->sblock.log2_bsize
+				  - GRUB_DISK_SECTOR_BITS, offset, size,
+				  GRUB_XFS_FSB_TO_BLOCK (node->data, start));
           break;
         }
     }
@@ -621,12 +669,12 @@ grub_xfs_read_file (grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
 		    grub_off_t pos, grub_size_t len, char *buf, grub_uint32_t header_size)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_xfs_read_block,
-				grub_be_to_cpu64 (node->inode.size) + header_size,
-				node->data->sblock.log2_bsize
-				- GRUB_DISK_SECTOR_BITS, 0);
+  return grub_fshelp_read_file_extents (node->data->disk, node, node->ino,
+					read_hook, read_hook_data,
+					pos, len, buf, grub_xfs_read_block,
+					grub_be_to_cpu64 (node->inode.size) + header_size,
+					node->data->sblock.log2_bsize
+					- GRUB_DISK_SECTOR_BITS, 0);
 }
 
 
@@ -704,6 +752,7 @@ static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
 				  struct grub_xfs_iterate_dir_ctx *ctx)
 {
   struct grub_fshelp_node *fdiro;
+  enum grub_fshelp_filetype type;
   grub_err_t err;
 
   fdiro = grub_malloc (grub_xfs_fshelp_size(ctx->diro->data) + 1);
@@ -725,8 +774,11 @@ static int iterate_dir_call_hook (grub_uint64_t ino, const char *filename,
       return 0;
     }
 
-  return ctx->hook (filename, grub_xfs_mode_to_filetype (fdiro->inode.mode),
-		    fdiro, ctx->hook_data);
+  type = grub_xfs_mode_to_filetype (fdiro->inode.mode);
+  if (ctx->diro->data->ascii_ci)
+    type |= GRUB_FSHELP_CASE_INSENSITIVE;
+
+  return ctx->hook (filename, type, fdiro, ctx->hook_data);
 }
 
 static int
@@ -928,6 +980,8 @@ grub_xfs_mount (grub_disk_t disk)
   data->agsize = grub_be_to_cpu32 (data->sblock.agsize);
   data->hasftype = grub_xfs_sb_hasftype(data);
   data->hascrc = grub_xfs_sb_hascrc(data);
+  data->ascii_ci = !!(data->sblock.version
+		      & grub_cpu_to_be16_compile_time (XFS_SB_VERSION_BORGBIT));
 
   data->disk = disk;
   data->pos = 0;
@@ -970,10 +1024,345 @@ grub_xfs_dir_iter (const char *filename, enum grub_fshelp_filetype filetype,
       info.mtime = grub_be_to_cpu32 (node->inode.mtime.sec);
     }
   info.dir = ((filetype & GRUB_FSHELP_TYPE_MASK) == GRUB_FSHELP_DIR);
+  info.case_insensitive = !!(filetype & GRUB_FSHELP_CASE_INSENSITIVE);
   grub_free (node);
   return ctx->hook (filename, &info, ctx->hook_data);
 }
 
+static grub_uint64_t
+grub_xfs_node_ino (grub_fshelp_node_t node)
+{
+  return node->ino;
+}
+
+static grub_fshelp_node_t
+grub_xfs_make_node (grub_fshelp_node_t dir, grub_uint64_t ino)
+{
+  struct grub_fshelp_node *node;
+
+  node = grub_malloc (grub_xfs_fshelp_size (dir->data) + 1);
+  if (! node)
+    return NULL;
+
+  node->data = dir->data;
+  node->ino = ino;
+  node->inode_read = 1;
+  if (grub_xfs_read_inode (dir->data, ino, &node->inode))
+    {
+      grub_free (node);
+      return NULL;
+    }
+
+  return node;
+}
+
+static const struct grub_fshelp_node_ops grub_xfs_node_ops =
+  {
+    .get_ino = grub_xfs_node_ino,
+    .make_node = grub_xfs_make_node
+  };
+
+static inline grub_uint32_t
+grub_xfs_rol32 (grub_uint32_t x, int n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+/* The hash of names used by the directory hash index.  */
+static grub_uint32_t
+grub_xfs_da_hashname (const grub_uint8_t *name, int namelen)
+{
+  grub_uint32_t hash = 0;
+
+  for (; namelen >= 4; namelen -= 4, name += 4)
+    hash = (name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7)
+      ^ (name[3] << 0) ^ grub_xfs_rol32 (hash, 7 * 4);
+
+  switch (namelen)
+    {
+    case 3:
+      return (name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0)
+	^ grub_xfs_rol32 (hash, 7 * 3);
+    case 2:
+      return (name[0] << 7) ^ (name[1] << 0) ^ grub_xfs_rol32 (hash, 7 * 2);
+    case 1:
+      return (name[0] << 0) ^ grub_xfs_rol32 (hash, 7 * 1);
+    default:
+      return hash;
+    }
+}
+
+/* Read the directory block at file system block FSB of DIR into BUF.
+   Unlike grub_xfs_read_file this can read the hash index, which lies
+   beyond the size of the directory.  */
+static grub_err_t
+grub_xfs_read_dir_block (grub_fshelp_node_t dir, grub_uint64_t fsb,
+			 char *buf)
+{
+  struct grub_xfs_data *data = dir->data;
+  int i;
+
+  for (i = 0; i < (1 << data->sblock.log2_dirblk); i++)
+    {
+      grub_disk_addr_t blk = grub_xfs_read_block (dir, fsb + i);
+
+      if (grub_errno)
+	return grub_errno;
+      if (!blk)
+	return grub_error (GRUB_ERR_BAD_FS, "sparse XFS directory block");
+
+      if (grub_disk_read (data->disk,
+			  blk << (data->sblock.log2_bsize
+				  - GRUB_DISK_SECTOR_BITS), 0, data->bsize,
+			  buf + ((grub_size_t) i << data->sblock.log2_bsize)))
+	return grub_errno;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Context for grub_xfs_lookup_file.  */
+struct grub_xfs_lookup_ctx
+{
+  grub_fshelp_node_t dir;
+  const char *name;
+  int namelen;
+  grub_uint32_t hash;
+  int dirblk_log2;
+  /* The data block last read, to resolve hash collisions cheaply.  */
+  char *datablock;
+  grub_uint64_t datablock_nr;
+  grub_uint64_t ino;
+};
+
+/* Look for the name in the COUNT hash index entries ENTS.  Return 1 if
+   it is found, 2 if entries with its hash may continue in the next leaf
+   and 0 otherwise.  */
+static int
+grub_xfs_leaf_lookup (struct grub_xfs_lookup_ctx *ctx,
+		      const struct grub_xfs_dir2_leaf_entry *ents, int count)
+{
+  grub_size_t dirblk_size = (grub_size_t) 1 << ctx->dirblk_log2;
+  int lo = 0, hi = count;
+
+  /* Find the first entry with the hash.  */
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+
+      if (grub_be_to_cpu32 (ents[mid].hashval) < ctx->hash)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  for (; lo < count && grub_be_to_cpu32 (ents[lo].hashval) == ctx->hash;
+       lo++)
+    {
+      grub_uint64_t off = ((grub_uint64_t) grub_be_to_cpu32 (ents[lo].address)
+			   << 3);
+      grub_uint64_t blk = off >> ctx->dirblk_log2;
+      grub_size_t boff = off & (dirblk_size - 1);
+      struct grub_xfs_dir2_entry *de;
+
+      /* Stale entry.  */
+      if (!ents[lo].address)
+	continue;
+
+      if (blk != ctx->datablock_nr)
+	{
+	  ctx->datablock_nr = ~(grub_uint64_t) 0;
+	  if (grub_xfs_read_dir_block (ctx->dir,
+				       blk << ctx->dir->data->sblock.log2_dirblk,
+				       ctx->datablock))
+	    return 0;
+	  ctx->datablock_nr = blk;
+	}
+
+      if (boff + sizeof (*de) > dirblk_size)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+	  return 0;
+	}
+      de = (struct grub_xfs_dir2_entry *) (ctx->datablock + boff);
+      if (boff + sizeof (*de) + de->len > dirblk_size)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory entry");
+	  return 0;
+	}
+
+      if (de->len == ctx->namelen
+	  && grub_memcmp (de + 1, ctx->name, ctx->namelen) == 0)
+	{
+	  ctx->ino = grub_be_to_cpu64 (de->inode);
+	  return 1;
+	}
+    }
+
+  return lo == count ? 2 : 0;
+}
+
+/* Look NAME up in DIR using the directory hash index, reading only the
+   index blocks on the path to its hash and the data blocks it points
+   to.  Return GRUB_ERR_NOT_IMPLEMENTED_YET for directories which have to
+   be scanned instead: short form ones, those of case-insensitive
+   filesystems, whose index hashes folded names, and those whose index
+   doesn't make sense.  */
+static grub_err_t
+grub_xfs_lookup_file (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_xfs_data *data = dir->data;
+  struct grub_xfs_lookup_ctx ctx = {
+    .dir = dir,
+    .name = name,
+    .namelen = grub_strlen (name),
+    .dirblk_log2 = data->sblock.log2_bsize + data->sblock.log2_dirblk,
+    .datablock_nr = ~(grub_uint64_t) 0
+  };
+  grub_size_t dirblk_size = (grub_size_t) 1 << ctx.dirblk_log2;
+  grub_size_t hdr_size = data->hascrc ? 64 : 16;
+  grub_size_t count_off = data->hascrc ? 56 : 12;
+  struct grub_xfs_da_blkinfo *info;
+  char *leaf = NULL;
+  grub_uint64_t fsb;
+  int depth, count, ret = 0;
+
+  /* Short form directories are inside the inode, scanning them is
+     cheap.  */
+  if (dir->inode.format != XFS_INODE_FORMAT_EXT
+      && dir->inode.format != XFS_INODE_FORMAT_BTREE)
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  if (data->ascii_ci)
+    return GRUB_ERR_NOT_IMPLEMENTED_YET;
+
+  ctx.hash = grub_xfs_da_hashname ((const grub_uint8_t *) name, ctx.namelen);
+
+  ctx.datablock = grub_malloc (dirblk_size);
+  if (!ctx.datablock)
+    return grub_errno;
+  leaf = grub_malloc (dirblk_size);
+  if (!leaf)
+    goto out;
+
+  if (grub_xfs_read_dir_block (dir, 0, leaf))
+    goto out;
+
+  /* Block directories have the hash index at the end of their only
+     block.  */
+  if (grub_memcmp (leaf, data->hascrc ? "XDB3" : "XD2B", 4) == 0)
+    {
+      struct grub_xfs_dirblock_tail *tail = grub_xfs_dir_tail (data, leaf);
+
+      count = grub_be_to_cpu32 (tail->leaf_count);
+      if ((grub_size_t) count * sizeof (struct grub_xfs_dir2_leaf_entry)
+	  > dirblk_size - hdr_size - sizeof (*tail))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory block");
+	  goto out;
+	}
+
+      grub_memcpy (ctx.datablock, leaf, dirblk_size);
+      ctx.datablock_nr = 0;
+      ret = grub_xfs_leaf_lookup (&ctx,
+				  (struct grub_xfs_dir2_leaf_entry *) tail
+				  - count, count);
+      goto out;
+    }
+
+  /* Otherwise walk down the hash btree, if any, to the leaf which
+     would hold the hash.  */
+  info = (struct grub_xfs_da_blkinfo *) leaf;
+  fsb = XFS_DIR2_LEAF_OFFSET >> data->sblock.log2_bsize;
+  for (depth = 0; ; depth++)
+    {
+      if (depth == XFS_DA_NODE_MAXDEPTH)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "XFS directory btree too deep");
+	  goto out;
+	}
+
+      if (grub_xfs_read_dir_block (dir, fsb, leaf))
+	goto out;
+
+      count = grub_be_to_cpu16 (grub_get_unaligned16 (leaf + count_off));
+      if (hdr_size + (grub_size_t) count * 8 > dirblk_size)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory index");
+	  goto out;
+	}
+
+      if (info->magic == grub_cpu_to_be16_compile_time (XFS_DA_NODE_MAGIC)
+	  || info->magic == grub_cpu_to_be16_compile_time (XFS_DA3_NODE_MAGIC))
+	{
+	  struct grub_xfs_da_node_entry *ents;
+	  int lo = 0, hi;
+
+	  if (!count)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "invalid XFS directory index");
+	      goto out;
+	    }
+
+	  /* The first subtree whose largest hash isn't below ours.  */
+	  ents = (struct grub_xfs_da_node_entry *) (leaf + hdr_size);
+	  hi = count - 1;
+	  while (lo < hi)
+	    {
+	      int mid = (lo + hi) / 2;
+
+	      if (grub_be_to_cpu32 (ents[mid].hashval) < ctx.hash)
+		lo = mid + 1;
+	      else
+		hi = mid;
+	    }
+	  fsb = grub_be_to_cpu32 (ents[lo].before);
+	  continue;
+	}
+
+      if (info->magic != grub_cpu_to_be16_compile_time (XFS_DIR2_LEAF1_MAGIC)
+	  && info->magic != grub_cpu_to_be16_compile_time (XFS_DIR2_LEAFN_MAGIC)
+	  && info->magic != grub_cpu_to_be16_compile_time (XFS_DIR3_LEAF1_MAGIC)
+	  && info->magic != grub_cpu_to_be16_compile_time (XFS_DIR3_LEAFN_MAGIC))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "not a correct XFS directory leaf");
+	  goto out;
+	}
+
+      ret = grub_xfs_leaf_lookup (&ctx, (struct grub_xfs_dir2_leaf_entry *)
+				  (leaf + hdr_size), count);
+      /* Entries with the same hash can continue in the next leaf.  */
+      if (ret != 2 || !info->forw)
+	break;
+      fsb = grub_be_to_cpu32 (info->forw);
+      depth = -1;
+    }
+
+ out:
+  grub_free (leaf);
+  grub_free (ctx.datablock);
+  if (grub_errno == GRUB_ERR_BAD_FS)
+    {
+      grub_dprintf ("xfs", "unusable directory index: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NOT_IMPLEMENTED_YET;
+    }
+  if (grub_errno)
+    return grub_errno;
+
+  if (ret == 1)
+    {
+      *foundnode = grub_xfs_make_node (dir, ctx.ino);
+      if (!*foundnode)
+	return grub_errno;
+      *foundtype = grub_xfs_mode_to_filetype ((*foundnode)->inode.mode);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_xfs_dir (grub_device_t device, const char *path,
 	      grub_fs_dir_hook_t hook, void *hook_data)
@@ -988,8 +1377,10 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				grub_xfs_iterate_dir, grub_xfs_lookup_file,
+				grub_xfs_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, &grub_xfs_node_ops);
   if (grub_errno)
     goto fail;
 
@@ -1021,8 +1412,10 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				grub_xfs_iterate_dir, grub_xfs_lookup_file,
+				grub_xfs_read_symlink, GRUB_FSHELP_REG,
+				data->disk, &grub_xfs_node_ops);
   if (grub_errno)
     goto fail;
 
@@ -53,8 +53,10 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <grub/crypto.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
@@ -157,13 +159,11 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 
 /*
- * Decompression Entry - lzjb & lz4
+ * Decompression Entry - lzjb
  */
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
-extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
-
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
 typedef struct decomp_entry
@@ -230,20 +230,67 @@ struct subvolume
   } *keyring;
 };
 
+/* Number of decoded indirect blocks kept by a mount.  */
+#define ZFS_INDIRECT_CACHE_SIZE 16
+
+/* Block pointers resolved at once by a multi-block read.  */
+#define ZFS_READ_BATCH 64
+
+/* Largest device read issued for adjacent blocks.  */
+#define ZFS_MAX_BULK_READ (1024 * 1024)
+
+/* Amount of a file read ahead into the file buffer by a partial read.  */
+#define ZFS_READAHEAD_SIZE (256 * 1024)
+
+/* Number of decoded ZAP and dnode blocks kept by a mount.  */
+#define ZFS_BLOCK_CACHE_SIZE 32
+
+/* Number of directory entries remembered by a mount.  */
+#define ZFS_NAME_CACHE_SIZE 64
+
+/* A decompressed indirect block, keyed by its first DVA and birth txg.  BUF
+   is NULL for an unused entry.  */
+struct zfs_indirect_cache
+{
+  dva_t dva;
+  grub_uint64_t birth;
+  void *buf;
+  unsigned long last_use;
+};
+
+/* A decoded data block of SIZE bytes, keyed by the whole block pointer it
+   was read through and the byte order of that pointer, as holes and
+   embedded blocks have no DVA.  BUF is NULL for an unused entry.  */
+struct zfs_block_cache
+{
+  blkptr_t bp;
+  grub_zfs_endian_t bp_endian;
+  grub_size_t size;
+  void *buf;
+  grub_zfs_endian_t endian;
+  unsigned long last_use;
+};
+
+/* NAME in directory DIR of dataset OBJSET has directory entry VALUE.  HASH
+   is a hash of NAME, lowercased if the dataset is case-insensitive.  NAME
+   is NULL for an unused entry.  */
+struct zfs_name_cache
+{
+  grub_uint64_t objset;
+  grub_uint64_t dir;
+  grub_uint32_t hash;
+  char *name;
+  grub_uint64_t value;
+  unsigned long last_use;
+};
+
 struct grub_zfs_data
 {
-  /* cache for a file block of the currently zfs_open()-ed file */
+  /* cache for file blocks of the currently zfs_open()-ed file */
   char *file_buf;
   grub_uint64_t file_start;
   grub_uint64_t file_end;
 
-  /* cache for a dnode block */
-  dnode_phys_t *dnode_buf;
-  dnode_phys_t *dnode_mdn;
-  grub_uint64_t dnode_start;
-  grub_uint64_t dnode_end;
-  grub_zfs_endian_t dnode_endian;
-
   dnode_end_t mos;
   dnode_end_t dnode;
   struct subvolume subvol;
@@ -256,6 +303,22 @@ struct grub_zfs_data
   uberblock_t current_uberblock;
 
   grub_uint64_t guid;
+
+  /* Whether to verify the checksums of file data blocks, see
+     zfs_verify_checksums.  Metadata is always verified.  */
+  int verify_data;
+
+  /* Indirect blocks recently walked through by dmu_read.  */
+  struct zfs_indirect_cache indirect_cache[ZFS_INDIRECT_CACHE_SIZE];
+  unsigned long indirect_cache_use;
+
+  /* ZAP and dnode blocks recently looked at.  */
+  struct zfs_block_cache block_cache[ZFS_BLOCK_CACHE_SIZE];
+  unsigned long block_cache_use;
+
+  /* Path components recently resolved by dnode_get_path.  */
+  struct zfs_name_cache name_cache[ZFS_NAME_CACHE_SIZE];
+  unsigned long name_cache_use;
 };
 
 /* Context for grub_zfs_dir.  */
@@ -342,6 +405,24 @@ zle_decompress (void *s, void *d,
   return GRUB_ERR_NONE;
 }
 
+/* ZFS prefixes LZ4 blocks with their big-endian compressed size.  */
+static grub_err_t
+lz4_decompress (void *s, void *d,
+		grub_size_t slen, grub_size_t dlen)
+{
+  grub_uint32_t bufsiz;
+
+  if (slen < 4)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed");
+  bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (s));
+  if (bufsiz > slen - 4)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed");
+
+  if (grub_lz4_decompress ((grub_uint8_t *) s + 4, bufsiz, d, dlen) < 0)
+    return grub_errno;
+  return GRUB_ERR_NONE;
+}
+
 static decomp_entry_t decomp_table[ZIO_COMPRESS_FUNCTIONS] = {
   {"inherit", NULL},		/* ZIO_COMPRESS_INHERIT */
   {"on", lzjb_decompress},	/* ZIO_COMPRESS_ON */
@@ -1841,6 +1922,85 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Verify the checksum of the PSIZE bytes of raw data of BP in COMPBUF
+ * unless VERIFY is 0, decrypt them if needed, and decompress them to the
+ * LSIZE bytes at BUF.  COMPBUF may be BUF if the block isn't compressed.
+ */
+static grub_err_t
+zio_decode (blkptr_t *bp, grub_zfs_endian_t endian, char *compbuf,
+	    grub_size_t psize, void *buf, grub_size_t lsize, int verify,
+	    struct grub_zfs_data *data)
+{
+  unsigned int comp, encrypted;
+  grub_err_t err = GRUB_ERR_NONE;
+  zio_cksum_t zc = bp->blk_cksum;
+  grub_uint32_t checksum;
+
+  checksum = (grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 40) & 0xff;
+  comp = (grub_zfs_to_cpu64((bp)->blk_prop, endian)>>32) & 0x7f;
+  encrypted = ((grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 60) & 3);
+
+  if (verify && !BP_IS_EMBEDDED(bp))
+    {
+      err = zio_checksum_verify (zc, checksum, endian,
+			         compbuf, psize);
+      if (err)
+        {
+          grub_dprintf ("zfs", "incorrect checksum\n");
+          return err;
+        }
+    }
+
+  if (encrypted)
+    {
+      if (!grub_zfs_decrypt)
+	err = grub_error (GRUB_ERR_BAD_FS, 
+			  N_("module `%s' isn't loaded"),
+			  "zfscrypt");
+      else
+	{
+	  unsigned i, besti = 0;
+	  grub_uint64_t bestval = 0;
+	  for (i = 0; i < data->subvol.nkeys; i++)
+	    if (data->subvol.keyring[i].txg <= grub_zfs_to_cpu64 (bp->blk_birth,
+								  endian)
+		&& data->subvol.keyring[i].txg > bestval)
+	      {
+		besti = i;
+		bestval = data->subvol.keyring[i].txg;
+	      }
+	  if (bestval == 0)
+	    {
+	      grub_dprintf ("zfs", "no key for txg %" PRIxGRUB_UINT64_T "\n",
+			    grub_zfs_to_cpu64 (bp->blk_birth,
+					       endian));
+	      return grub_error (GRUB_ERR_BAD_FS, "no key found in keychain");
+	    }
+	  grub_dprintf ("zfs", "using key %u (%" PRIxGRUB_UINT64_T 
+			", %p) for txg %" PRIxGRUB_UINT64_T "\n",
+			besti, data->subvol.keyring[besti].txg,
+			data->subvol.keyring[besti].cipher,
+			grub_zfs_to_cpu64 (bp->blk_birth,
+					   endian));
+	  err = grub_zfs_decrypt (data->subvol.keyring[besti].cipher,
+				  data->subvol.keyring[besti].algo,
+				  &(bp)->blk_dva[encrypted],
+				  compbuf, psize, zc.zc_mac,
+				  endian);
+	}
+      if (err)
+	return err;
+    }
+
+  if (comp != ZIO_COMPRESS_OFF)
+    return decomp_table[comp].decomp_func (compbuf, buf, psize, lsize);
+
+  if (compbuf != buf)
+    grub_memcpy (buf, compbuf, lsize);
+  return GRUB_ERR_NONE;
+}
+
 /*
  * Read in a block of data, verify its checksum, decompress if needed,
  * and put the uncompressed data in buf.
@@ -1850,17 +2010,13 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
 	  grub_size_t *size, struct grub_zfs_data *data)
 {
   grub_size_t lsize, psize;
-  unsigned int comp, encrypted;
+  unsigned int comp;
   char *compbuf = NULL;
   grub_err_t err;
-  zio_cksum_t zc = bp->blk_cksum;
-  grub_uint32_t checksum;
 
   *buf = NULL;
 
-  checksum = (grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 40) & 0xff;
   comp = (grub_zfs_to_cpu64((bp)->blk_prop, endian)>>32) & 0x7f;
-  encrypted = ((grub_zfs_to_cpu64((bp)->blk_prop, endian) >> 60) & 3);
   if (BP_IS_EMBEDDED(bp))
     {
       if (BPE_GET_ETYPE(bp) != BP_EMBEDDED_TYPE_DATA)
@@ -1916,88 +2072,159 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
       return err;
     }
 
-  if (!BP_IS_EMBEDDED(bp))
-    {
-      err = zio_checksum_verify (zc, checksum, endian,
-			         compbuf, psize);
-      if (err)
-        {
-          grub_dprintf ("zfs", "incorrect checksum\n");
-          grub_free (compbuf);
-          *buf = NULL;
-          return err;
-        }
-    }
-
-  if (encrypted)
+  if (comp != ZIO_COMPRESS_OFF)
     {
-      if (!grub_zfs_decrypt)
-	err = grub_error (GRUB_ERR_BAD_FS, 
-			  N_("module `%s' isn't loaded"),
-			  "zfscrypt");
-      else
-	{
-	  unsigned i, besti = 0;
-	  grub_uint64_t bestval = 0;
-	  for (i = 0; i < data->subvol.nkeys; i++)
-	    if (data->subvol.keyring[i].txg <= grub_zfs_to_cpu64 (bp->blk_birth,
-								  endian)
-		&& data->subvol.keyring[i].txg > bestval)
-	      {
-		besti = i;
-		bestval = data->subvol.keyring[i].txg;
-	      }
-	  if (bestval == 0)
-	    {
-	      grub_free (compbuf);
-	      *buf = NULL;
-	      grub_dprintf ("zfs", "no key for txg %" PRIxGRUB_UINT64_T "\n",
-			    grub_zfs_to_cpu64 (bp->blk_birth,
-					       endian));
-	      return grub_error (GRUB_ERR_BAD_FS, "no key found in keychain");
-	    }
-	  grub_dprintf ("zfs", "using key %u (%" PRIxGRUB_UINT64_T 
-			", %p) for txg %" PRIxGRUB_UINT64_T "\n",
-			besti, data->subvol.keyring[besti].txg,
-			data->subvol.keyring[besti].cipher,
-			grub_zfs_to_cpu64 (bp->blk_birth,
-					   endian));
-	  err = grub_zfs_decrypt (data->subvol.keyring[besti].cipher,
-				  data->subvol.keyring[besti].algo,
-				  &(bp)->blk_dva[encrypted],
-				  compbuf, psize, zc.zc_mac,
-				  endian);
-	}
-      if (err)
+      *buf = grub_malloc (lsize);
+      if (!*buf)
 	{
 	  grub_free (compbuf);
-	  *buf = NULL;
-	  return err;
+	  return grub_errno;
 	}
     }
 
+  err = zio_decode (bp, endian, compbuf, psize, *buf, lsize, 1, data);
   if (comp != ZIO_COMPRESS_OFF)
+    grub_free (compbuf);
+  if (err)
     {
-      *buf = grub_malloc (lsize);
-      if (!*buf)
+      grub_free (*buf);
+      *buf = NULL;
+      return err;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Return the decoded indirect block BP points to, or NULL.  */
+static void *
+indirect_cache_lookup (struct grub_zfs_data *data, const blkptr_t *bp)
+{
+  unsigned i;
+
+  for (i = 0; i < ZFS_INDIRECT_CACHE_SIZE; i++)
+    if (data->indirect_cache[i].buf
+	&& data->indirect_cache[i].birth == bp->blk_birth
+	&& data->indirect_cache[i].dva.dva_word[0] == bp->blk_dva[0].dva_word[0]
+	&& data->indirect_cache[i].dva.dva_word[1] == bp->blk_dva[0].dva_word[1])
+      {
+	data->indirect_cache[i].last_use = ++data->indirect_cache_use;
+	return data->indirect_cache[i].buf;
+      }
+
+  return NULL;
+}
+
+/* Keep BUF, the decoded indirect block BP points to, in place of the least
+   recently used one.  */
+static void
+indirect_cache_insert (struct grub_zfs_data *data, const blkptr_t *bp,
+		       void *buf)
+{
+  struct zfs_indirect_cache *entry = &data->indirect_cache[0];
+  unsigned i;
+
+  for (i = 1; i < ZFS_INDIRECT_CACHE_SIZE; i++)
+    if (data->indirect_cache[i].last_use < entry->last_use)
+      entry = &data->indirect_cache[i];
+
+  grub_free (entry->buf);
+  entry->dva = bp->blk_dva[0];
+  entry->birth = bp->blk_birth;
+  entry->buf = buf;
+  entry->last_use = ++data->indirect_cache_use;
+}
+
+/*
+ * Copy the level 0 block pointers of up to *COUNT blocks of DN, starting at
+ * BLKID, to BPS.  Stops at the end of the indirect block holding them, and
+ * sets *COUNT to the number copied and *ENDIAN_OUT to their byte order.
+ * Blocks below a hole come out as holes.
+ *
+ * Indirect blocks on the way are kept in the mount's indirect block cache,
+ * so reading neighbouring blocks doesn't read and verify them again.
+ */
+static grub_err_t
+dmu_get_blkptrs (dnode_end_t * dn, grub_uint64_t blkid, blkptr_t *bps,
+		 grub_size_t *count, grub_zfs_endian_t *endian_out,
+		 struct grub_zfs_data *data)
+{
+  int level;
+  grub_off_t idx;
+  blkptr_t *bp_array = dn->dn.dn_blkptr;
+  int epbs = dn->dn.dn_indblkshift - SPA_BLKPTRSHIFT;
+  blkptr_t bp;
+  void *tmpbuf;
+  grub_zfs_endian_t endian;
+  grub_size_t n;
+  grub_err_t err;
+
+  endian = dn->endian;
+  idx = blkid & ((1 << epbs) - 1);
+  n = (1 << epbs) - idx;
+  if (n > *count)
+    n = *count;
+  *count = n;
+  *endian_out = endian;
+
+  for (level = dn->dn.dn_nlevels - 1; level > 0; level--)
+    {
+      grub_dprintf ("zfs", "endian = %d\n", endian);
+      idx = (blkid >> (epbs * level)) & ((1 << epbs) - 1);
+      bp = bp_array[idx];
+
+      if (BP_IS_HOLE (&bp))
 	{
-	  grub_free (compbuf);
-	  return grub_errno;
+	  grub_memset (bps, 0, n * sizeof (bps[0]));
+	  return GRUB_ERR_NONE;
 	}
 
-      err = decomp_table[comp].decomp_func (compbuf, *buf, psize, lsize);
-      grub_free (compbuf);
-      if (err)
+      tmpbuf = indirect_cache_lookup (data, &bp);
+      if (!tmpbuf)
 	{
-	  grub_free (*buf);
-	  *buf = NULL;
-	  return err;
+	  err = zio_read (&bp, endian, &tmpbuf, 0, data);
+	  if (err)
+	    return err;
+	  indirect_cache_insert (data, &bp, tmpbuf);
 	}
+      endian = (grub_zfs_to_cpu64 (bp.blk_prop, endian) >> 63) & 1;
+      bp_array = tmpbuf;
     }
 
+  idx = blkid & ((1 << epbs) - 1);
+  if (bp_array == dn->dn.dn_blkptr && idx + n > dn->dn.dn_nblkptr)
+    {
+      /* Past the block pointers of the dnode.  */
+      grub_memset (bps, 0, n * sizeof (bps[0]));
+      if (idx >= dn->dn.dn_nblkptr)
+	return GRUB_ERR_NONE;
+      n = dn->dn.dn_nblkptr - idx;
+    }
+  grub_memcpy (bps, bp_array + idx, n * sizeof (bps[0]));
+  *endian_out = endian;
+
   return GRUB_ERR_NONE;
 }
 
+/* Read the data block of DN which BP, in byte order ENDIAN, points to.  */
+static grub_err_t
+dmu_read_blkptr (dnode_end_t *dn, blkptr_t *bp, grub_zfs_endian_t endian,
+		 void **buf, struct grub_zfs_data *data)
+{
+  if (BP_IS_HOLE (bp))
+    {
+      grub_size_t size = grub_zfs_to_cpu16 (dn->dn.dn_datablkszsec, 
+					    dn->endian) 
+	<< SPA_MINBLOCKSHIFT;
+      *buf = grub_zalloc (size);
+      if (!*buf)
+	return grub_errno;
+      return GRUB_ERR_NONE;
+    }
+
+  grub_dprintf ("zfs", "endian = %d\n", endian);
+  return zio_read (bp, endian, buf, 0, data);
+}
+
 /*
  * Get the block from a block id.
  * push the block onto the stack.
@@ -2007,66 +2234,275 @@ static grub_err_t
 dmu_read (dnode_end_t * dn, grub_uint64_t blkid, void **buf, 
 	  grub_zfs_endian_t *endian_out, struct grub_zfs_data *data)
 {
-  int level;
-  grub_off_t idx;
-  blkptr_t *bp_array = dn->dn.dn_blkptr;
-  int epbs = dn->dn.dn_indblkshift - SPA_BLKPTRSHIFT;
   blkptr_t *bp;
-  void *tmpbuf = 0;
+  grub_size_t count = 1;
   grub_zfs_endian_t endian;
-  grub_err_t err = GRUB_ERR_NONE;
+  grub_err_t err;
 
   bp = grub_malloc (sizeof (blkptr_t));
   if (!bp)
     return grub_errno;
 
-  endian = dn->endian;
-  for (level = dn->dn.dn_nlevels - 1; level >= 0; level--)
+  err = dmu_get_blkptrs (dn, blkid, bp, &count, &endian, data);
+  if (err)
     {
-      grub_dprintf ("zfs", "endian = %d\n", endian);
-      idx = (blkid >> (epbs * level)) & ((1 << epbs) - 1);
-      *bp = bp_array[idx];
-      if (bp_array != dn->dn.dn_blkptr)
+      grub_free (bp);
+      return err;
+    }
+
+  err = dmu_read_blkptr (dn, bp, endian, buf, data);
+  if (endian_out)
+    *endian_out = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
+
+  grub_free (bp);
+  return err;
+}
+
+/*
+ * Like dmu_read, but go through the mount's block cache.  The block is
+ * owned by the cache and must not be freed or modified.  It stays valid
+ * until ZFS_BLOCK_CACHE_SIZE - 1 other blocks have been read this way,
+ * so a caller can hold on to it while reading one more block.
+ */
+static grub_err_t
+dmu_read_cached (dnode_end_t *dn, grub_uint64_t blkid, void **buf,
+		 grub_zfs_endian_t *endian_out, struct grub_zfs_data *data)
+{
+  struct zfs_block_cache *entry = &data->block_cache[0];
+  blkptr_t bp;
+  grub_size_t count = 1, size;
+  grub_zfs_endian_t endian;
+  void *tmpbuf;
+  unsigned i;
+  grub_err_t err;
+
+  err = dmu_get_blkptrs (dn, blkid, &bp, &count, &endian, data);
+  if (err)
+    return err;
+  size = grub_zfs_to_cpu16 (dn->dn.dn_datablkszsec, dn->endian)
+    << SPA_MINBLOCKSHIFT;
+
+  for (i = 0; i < ZFS_BLOCK_CACHE_SIZE; i++)
+    {
+      struct zfs_block_cache *e = &data->block_cache[i];
+
+      if (e->buf && e->bp.blk_birth == bp.blk_birth
+	  && e->bp_endian == endian && e->size == size
+	  && grub_memcmp (&e->bp, &bp, sizeof (bp)) == 0)
+	{
+	  e->last_use = ++data->block_cache_use;
+	  *buf = e->buf;
+	  if (endian_out)
+	    *endian_out = e->endian;
+	  return GRUB_ERR_NONE;
+	}
+      if (e->last_use < entry->last_use)
+	entry = e;
+    }
+
+  err = dmu_read_blkptr (dn, &bp, endian, &tmpbuf, data);
+  if (err)
+    return err;
+
+  grub_free (entry->buf);
+  entry->bp = bp;
+  entry->bp_endian = endian;
+  entry->size = size;
+  entry->buf = tmpbuf;
+  entry->endian = (grub_zfs_to_cpu64 (bp.blk_prop, endian) >> 63) & 1;
+  entry->last_use = ++data->block_cache_use;
+
+  *buf = tmpbuf;
+  if (endian_out)
+    *endian_out = entry->endian;
+  return GRUB_ERR_NONE;
+}
+
+/* Read the data block BP points to, of BLKSZ bytes, to BUF.  */
+static grub_err_t
+zio_read_block (blkptr_t *bp, grub_zfs_endian_t endian, char *buf,
+		grub_size_t blksz, struct grub_zfs_data *data)
+{
+  void *t;
+  grub_size_t size;
+  grub_err_t err;
+
+  err = zio_read (bp, endian, &t, &size, data);
+  if (err)
+    return err;
+  if (size > blksz)
+    size = blksz;
+  grub_memcpy (buf, t, size);
+  grub_memset (buf + size, 0, blksz - size);
+  grub_free (t);
+  return GRUB_ERR_NONE;
+}
+
+/*
+ * Return the top-level vdev the data block BP points to can be read from
+ * together with its neighbours, or NULL if it has to be read on its own.
+ */
+static struct grub_zfs_device_desc *
+zio_bulk_device (blkptr_t *bp, grub_zfs_endian_t endian, grub_size_t blksz,
+		 struct grub_zfs_data *data)
+{
+  grub_uint64_t prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
+  unsigned int comp = (prop >> 32) & 0x7f;
+  unsigned i;
+
+  if (BP_IS_HOLE (bp) || BP_IS_EMBEDDED (bp)
+      || ((grub_zfs_to_cpu64 (bp->blk_dva[0].dva_word[1], endian) >> 63) & 1))
+    return NULL;
+  if (comp >= ZIO_COMPRESS_FUNCTIONS
+      || (comp != ZIO_COMPRESS_OFF && decomp_table[comp].decomp_func == NULL))
+    return NULL;
+  if ((((prop & 0xffff) + 1) << SPA_MINBLOCKSHIFT) != blksz)
+    return NULL;
+
+  /* RAID-Z stripes each block on its own.  */
+  for (i = 0; i < data->n_devices_attached; i++)
+    if (data->devices_attached[i].id == DVA_GET_VDEV (&bp->blk_dva[0]))
+      return (data->devices_attached[i].type == DEVICE_RAIDZ
+	      ? NULL : &data->devices_attached[i]);
+  return NULL;
+}
+
+/*
+ * Read the N data blocks BPS point to, each of BLKSZ bytes, to BUF.
+ * Blocks stored next to each other on a disk or mirror vdev are fetched
+ * with a single device read, straight to BUF unless they are compressed.
+ * Their checksums are only checked if DATA->verify_data is set.  Any
+ * failure falls back to reading blocks one by one, which tries the other
+ * copies and always verifies.
+ */
+static grub_err_t
+zio_read_blocks (blkptr_t *bps, grub_size_t n, grub_zfs_endian_t endian,
+		 char *buf, grub_size_t blksz, struct grub_zfs_data *data)
+{
+  char *span = NULL;
+  grub_size_t span_size = 0;
+  grub_size_t i, j, k;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  for (i = 0; i < n; i = j)
+    {
+      struct grub_zfs_device_desc *desc;
+      grub_uint64_t start, end, off;
+      char *target;
+      int direct;
+
+      j = i + 1;
+      if (BP_IS_HOLE (&bps[i]))
+	{
+	  grub_memset (buf + i * blksz, 0, blksz);
+	  continue;
+	}
+
+      desc = zio_bulk_device (&bps[i], endian, blksz, data);
+      if (!desc)
 	{
-	  grub_free (bp_array);
-	  bp_array = 0;
+	  err = zio_read_block (&bps[i], endian, buf + i * blksz, blksz, data);
+	  if (err)
+	    break;
+	  continue;
 	}
 
-      if (BP_IS_HOLE (bp))
+      /* Gather the blocks which follow on the same vdev.  */
+      start = dva_get_offset (&bps[i].blk_dva[0], endian);
+      end = start + get_psize (&bps[i], endian);
+      direct = (((grub_zfs_to_cpu64 (bps[i].blk_prop, endian) >> 32) & 0x7f)
+		== ZIO_COMPRESS_OFF);
+      for (; j < n; j++)
 	{
-	  grub_size_t size = grub_zfs_to_cpu16 (dn->dn.dn_datablkszsec, 
-						dn->endian) 
-	    << SPA_MINBLOCKSHIFT;
-	  *buf = grub_malloc (size);
-	  if (!*buf)
+	  if (zio_bulk_device (&bps[j], endian, blksz, data) != desc)
+	    break;
+	  off = dva_get_offset (&bps[j].blk_dva[0], endian);
+	  if (off != ALIGN_UP (end, (1ULL << desc->ashift))
+	      || off + get_psize (&bps[j], endian) - start > ZFS_MAX_BULK_READ)
+	    break;
+	  if (off != end
+	      || (((grub_zfs_to_cpu64 (bps[j].blk_prop, endian) >> 32) & 0x7f)
+		  != ZIO_COMPRESS_OFF))
+	    direct = 0;
+	  end = off + get_psize (&bps[j], endian);
+	}
+
+      if (direct)
+	target = buf + i * blksz;
+      else
+	{
+	  if (span_size < end - start)
 	    {
-	      err = grub_errno;
-	      break;
+	      grub_free (span);
+	      span_size = end - start;
+	      /* Leave room for decompressors peeking past the input.  */
+	      span = grub_malloc (span_size + 16);
+	      if (!span)
+		{
+		  err = grub_errno;
+		  break;
+		}
 	    }
-	  grub_memset (*buf, 0, size);
-	  endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
-	  break;
+	  target = span;
 	}
-      if (level == 0)
+
+      grub_dprintf ("zfs", "reading %" PRIuGRUB_SIZE " blocks at 0x%"
+		    PRIxGRUB_UINT64_T " in one go\n", j - i, start);
+      err = read_device (start, desc, end - start, target);
+      for (k = i; !err && k < j; k++)
+	err = zio_decode (&bps[k], endian,
+			  target + (dva_get_offset (&bps[k].blk_dva[0], endian)
+				    - start),
+			  get_psize (&bps[k], endian), buf + k * blksz, blksz,
+			  data->verify_data, data);
+      if (!err)
+	continue;
+
+      grub_dprintf ("zfs", "bulk read failed, reading blocks one by one\n");
+      grub_errno = GRUB_ERR_NONE;
+      for (k = i; k < j; k++)
 	{
-	  grub_dprintf ("zfs", "endian = %d\n", endian);
-	  err = zio_read (bp, endian, buf, 0, data);
-	  endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
-	  break;
+	  err = zio_read_block (&bps[k], endian, buf + k * blksz, blksz, data);
+	  if (err)
+	    break;
 	}
-      grub_dprintf ("zfs", "endian = %d\n", endian);
-      err = zio_read (bp, endian, &tmpbuf, 0, data);
-      endian = (grub_zfs_to_cpu64 (bp->blk_prop, endian) >> 63) & 1;
       if (err)
 	break;
-      bp_array = tmpbuf;
     }
-  if (bp_array != dn->dn.dn_blkptr)
-    grub_free (bp_array);
-  if (endian_out)
-    *endian_out = endian;
 
-  grub_free (bp);
+  grub_free (span);
+  return err;
+}
+
+/* Read N blocks of DN, each of BLKSZ bytes, starting at BLKID, to BUF.  */
+static grub_err_t
+dmu_read_blocks (dnode_end_t *dn, grub_uint64_t blkid, grub_size_t n,
+		 char *buf, grub_size_t blksz, struct grub_zfs_data *data)
+{
+  blkptr_t *bps;
+  grub_size_t count;
+  grub_zfs_endian_t endian;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  bps = grub_malloc (ZFS_READ_BATCH * sizeof (bps[0]));
+  if (!bps)
+    return grub_errno;
+
+  while (n)
+    {
+      count = n < ZFS_READ_BATCH ? n : ZFS_READ_BATCH;
+      err = dmu_get_blkptrs (dn, blkid, bps, &count, &endian, data);
+      if (err)
+	break;
+      err = zio_read_blocks (bps, count, endian, buf, blksz, data);
+      if (err)
+	break;
+      blkid += count;
+      buf += count * blksz;
+      n -= count;
+    }
+
+  grub_free (bps);
   return err;
 }
 
@@ -2351,14 +2787,12 @@ fzap_lookup (dnode_end_t * zap_dnode, zap_phys_t * zap,
   /* Get the leaf block */
   if ((1U << blksft) < sizeof (zap_leaf_phys_t))
     return grub_error (GRUB_ERR_BAD_FS, "ZAP leaf is too small");
-  err = dmu_read (zap_dnode, blkid, &l, &leafendian, data);
+  err = dmu_read_cached (zap_dnode, blkid, &l, &leafendian, data);
   if (err)
     return err;
 
-  err = zap_leaf_lookup (l, leafendian, blksft, hash, name, value,
-			 case_insensitive);
-  grub_free (l);
-  return err;
+  return zap_leaf_lookup (l, leafendian, blksft, hash, name, value,
+			  case_insensitive);
 }
 
 /* XXX */
@@ -2501,7 +2935,7 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
   /* Read in the first block of the zap object data. */
   size = (grub_uint32_t) grub_zfs_to_cpu16 (zap_dnode->dn.dn_datablkszsec,
 			    zap_dnode->endian) << SPA_MINBLOCKSHIFT;
-  err = dmu_read (zap_dnode, 0, &zapbuf, &endian, data);
+  err = dmu_read_cached (zap_dnode, 0, &zapbuf, &endian, data);
   if (err)
     return err;
   block_type = grub_zfs_to_cpu64 (*((grub_uint64_t *) zapbuf), endian);
@@ -2514,7 +2948,6 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
       err = mzap_lookup (zapbuf, endian, size, name, val,
 			 case_insensitive);
       grub_dprintf ("zfs", "returned %d\n", err);      
-      grub_free (zapbuf);
       return err;
     }
   else if (block_type == ZBT_HEADER)
@@ -2524,7 +2957,6 @@ zap_lookup (dnode_end_t * zap_dnode, const char *name, grub_uint64_t *val,
       err = fzap_lookup (zap_dnode, zapbuf, name, val, data,
 			 case_insensitive);
       grub_dprintf ("zfs", "returned %d\n", err);      
-      grub_free (zapbuf);
       return err;
     }
 
@@ -2669,41 +3101,13 @@ dnode_get (dnode_end_t * mdn, grub_uint64_t objnum, grub_uint8_t type,
   blkid = objnum >> epbs;
   idx = objnum & ((1 << epbs) - 1);
 
-  if (data->dnode_buf != NULL && grub_memcmp (data->dnode_mdn, mdn, 
-					      sizeof (*mdn)) == 0 
-      && objnum >= data->dnode_start && objnum < data->dnode_end)
-    {
-      grub_memmove (&(buf->dn), &(data->dnode_buf)[idx], DNODE_SIZE);
-      buf->endian = data->dnode_endian;
-      if (type && buf->dn.dn_type != type) 
-	return grub_error(GRUB_ERR_BAD_FS, "incorrect dnode type"); 
-      return GRUB_ERR_NONE;
-    }
-
   grub_dprintf ("zfs", "endian = %d, blkid=%llx\n", mdn->endian, 
 		(unsigned long long) blkid);
-  err = dmu_read (mdn, blkid, &dnbuf, &endian, data);
+  err = dmu_read_cached (mdn, blkid, &dnbuf, &endian, data);
   if (err)
     return err;
   grub_dprintf ("zfs", "alive\n");
 
-  grub_free (data->dnode_buf);
-  grub_free (data->dnode_mdn);
-  data->dnode_mdn = grub_malloc (sizeof (*mdn));
-  if (! data->dnode_mdn)
-    {
-      grub_errno = GRUB_ERR_NONE;
-      data->dnode_buf = 0;
-    }
-  else
-    {
-      grub_memcpy (data->dnode_mdn, mdn, sizeof (*mdn));
-      data->dnode_buf = dnbuf;
-      data->dnode_start = blkid << epbs;
-      data->dnode_end = (blkid + 1) << epbs;
-      data->dnode_endian = endian;
-    }
-
   grub_memmove (&(buf->dn), (dnode_phys_t *) dnbuf + idx, DNODE_SIZE);
   buf->endian = endian;
   if (type && buf->dn.dn_type != type) 
@@ -2712,6 +3116,70 @@ dnode_get (dnode_end_t * mdn, grub_uint64_t objnum, grub_uint8_t type,
   return GRUB_ERR_NONE;
 }
 
+/* Hash NAME for the name cache.  */
+static grub_uint32_t
+name_cache_hash (const char *name, int case_insensitive)
+{
+  grub_uint32_t hash = 2166136261U;
+
+  for (; *name; name++)
+    hash = (hash ^ (grub_uint8_t) (case_insensitive ? grub_tolower (*name)
+				   : *name)) * 16777619;
+  return hash;
+}
+
+/*
+ * Look NAME up in DIR, which is object DIROBJ of SUBVOL, going through the
+ * mount's name cache.
+ */
+static grub_err_t
+dir_lookup (struct subvolume *subvol, grub_uint64_t dirobj, dnode_end_t *dir,
+	    const char *name, grub_uint64_t *val, struct grub_zfs_data *data)
+{
+  struct zfs_name_cache *entry = &data->name_cache[0];
+  int case_insensitive = !!subvol->case_insensitive;
+  grub_uint32_t hash = name_cache_hash (name, case_insensitive);
+  char *copy;
+  unsigned i;
+  grub_err_t err;
+
+  for (i = 0; i < ZFS_NAME_CACHE_SIZE; i++)
+    {
+      struct zfs_name_cache *e = &data->name_cache[i];
+
+      if (e->name && e->hash == hash && e->dir == dirobj
+	  && e->objset == subvol->obj
+	  && (case_insensitive ? grub_strcasecmp (e->name, name)
+	      : grub_strcmp (e->name, name)) == 0)
+	{
+	  e->last_use = ++data->name_cache_use;
+	  *val = e->value;
+	  return GRUB_ERR_NONE;
+	}
+      if (e->last_use < entry->last_use)
+	entry = e;
+    }
+
+  err = zap_lookup (dir, name, val, data, case_insensitive);
+  if (err)
+    return err;
+
+  copy = grub_strdup (name);
+  if (!copy)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  grub_free (entry->name);
+  entry->objset = subvol->obj;
+  entry->dir = dirobj;
+  entry->hash = hash;
+  entry->name = copy;
+  entry->value = *val;
+  entry->last_use = ++data->name_cache_use;
+  return GRUB_ERR_NONE;
+}
+
 #pragma GCC diagnostic ignored "-Wstrict-aliasing"
 
 /*
@@ -2731,6 +3199,7 @@ dnode_get_path (struct subvolume *subvol, const char *path_in, dnode_end_t *dn,
   struct dnode_chain
   {
     struct dnode_chain *next;
+    grub_uint64_t objnum;
     dnode_end_t dn; 
   };
   struct dnode_chain *dnode_path = 0, *dn_new, *root;
@@ -2785,6 +3254,7 @@ dnode_get_path (struct subvolume *subvol, const char *path_in, dnode_end_t *dn,
       grub_free (dn_new);
       return err;
     }
+  dnode_path->objnum = objnum;
 
   path = path_buf = grub_strdup (path_in);
   if (!path_buf)
@@ -2833,8 +3303,8 @@ dnode_get_path (struct subvolume *subvol, const char *path_in, dnode_end_t *dn,
 	  grub_free (path_buf);
 	  return grub_error (GRUB_ERR_BAD_FILE_TYPE, N_("not a directory"));
 	}
-      err = zap_lookup (&(dnode_path->dn), cname, &objnum,
-			data, subvol->case_insensitive);
+      err = dir_lookup (subvol, dnode_path->objnum, &(dnode_path->dn), cname,
+			&objnum, data);
       if (err)
 	break;
 
@@ -2848,6 +3318,7 @@ dnode_get_path (struct subvolume *subvol, const char *path_in, dnode_end_t *dn,
       dnode_path = dn_new;
 
       objnum = ZFS_DIRENT_OBJ (objnum);
+      dnode_path->objnum = objnum;
       err = dnode_get (&subvol->mdn, objnum, 0, &(dnode_path->dn), data);
       if (err)
 	break;
@@ -3597,9 +4068,13 @@ zfs_unmount (struct grub_zfs_data *data)
   for (i = 0; i < data->n_devices_attached; i++)
     unmount_device (&data->devices_attached[i]);
   grub_free (data->devices_attached);
-  grub_free (data->dnode_buf);
-  grub_free (data->dnode_mdn);
   grub_free (data->file_buf);
+  for (i = 0; i < ZFS_INDIRECT_CACHE_SIZE; i++)
+    grub_free (data->indirect_cache[i].buf);
+  for (i = 0; i < ZFS_BLOCK_CACHE_SIZE; i++)
+    grub_free (data->block_cache[i].buf);
+  for (i = 0; i < ZFS_NAME_CACHE_SIZE; i++)
+    grub_free (data->name_cache[i].name);
   for (i = 0; i < data->subvol.nkeys; i++)
     grub_crypto_cipher_close (data->subvol.keyring[i].cipher);
   grub_free (data->subvol.keyring);
@@ -3776,6 +4251,7 @@ static grub_err_t
 grub_zfs_open (struct grub_file *file, const char *fsfilename)
 {
   struct grub_zfs_data *data;
+  const char *verify;
   grub_err_t err;
   int isfs;
 
@@ -3783,6 +4259,9 @@ grub_zfs_open (struct grub_file *file, const char *fsfilename)
   if (! data)
     return grub_errno;
 
+  verify = grub_env_get ("zfs_verify_checksums");
+  data->verify_data = !(verify && grub_strcmp (verify, "metadata") == 0);
+
   err = dnode_get_fullpath (fsfilename, &(data->subvol),
 			    &(data->dnode), &isfs, data);
   if (err)
@@ -3883,45 +4362,73 @@ grub_zfs_read (grub_file_t file, char *buf, grub_size_t len)
     }
 
   /*
-   * Entire Dnode is too big to fit into the space available.  We
-   * will need to read it in chunks.  This could be optimized to
-   * read in as large a chunk as there is space available, but for
-   * now, this only reads in one data block at a time.
+   * Whole blocks are read straight into the buffer provided, many at a
+   * time.  Partial blocks go through the file buffer, along with the
+   * blocks after them, so that small sequential reads hit memory.
    */
   length = len;
   read = 0;
   while (length)
     {
-      void *t;
+      grub_uint64_t offset = file->offset + read;
+      grub_uint64_t blkid, blkoff, nblocks;
+      grub_size_t n;
+
+      if (offset >= data->file_start && offset < data->file_end)
+	{
+	  movesize = data->file_end - offset;
+	  if (movesize > length)
+	    movesize = length;
+	  grub_memmove (buf, data->file_buf + offset - data->file_start,
+			movesize);
+	  buf += movesize;
+	  length -= movesize;
+	  read += movesize;
+	  continue;
+	}
+
       /*
        * Find requested blkid and the offset within that block.
        */
-      grub_uint64_t blkid = grub_divmod64 (file->offset + read, blksz, 0);
+      blkid = grub_divmod64 (offset, blksz, &blkoff);
+
+      if (blkoff == 0 && length >= blksz)
+	{
+	  n = length / blksz;
+	  err = dmu_read_blocks (&data->dnode, blkid, n, buf, blksz, data);
+	  if (err)
+	    return -1;
+	  movesize = n * blksz;
+	  buf += movesize;
+	  length -= movesize;
+	  read += movesize;
+	  continue;
+	}
+
+      n = ZFS_READAHEAD_SIZE / blksz;
+      if (n == 0)
+	n = 1;
+      nblocks = grub_divmod64 (file->size + blksz - 1, blksz, 0);
+      if (blkid + n > nblocks)
+	n = nblocks > blkid ? nblocks - blkid : 1;
+
       grub_free (data->file_buf);
-      data->file_buf = 0;
+      data->file_start = data->file_end = 0;
+      data->file_buf = grub_malloc (n * blksz);
+      if (!data->file_buf)
+	return -1;
 
-      err = dmu_read (&(data->dnode), blkid, &t,
-		      0, data);
-      data->file_buf = t;
+      err = dmu_read_blocks (&data->dnode, blkid, n, data->file_buf, blksz,
+			     data);
       if (err)
 	{
+	  grub_free (data->file_buf);
 	  data->file_buf = NULL;
-	  data->file_start = data->file_end = 0;
 	  return -1;
 	}
 
       data->file_start = blkid * blksz;
-      data->file_end = data->file_start + blksz;
-
-      movesize = data->file_end - file->offset - read;
-      if (movesize > length)
-	movesize = length;
-
-      grub_memmove (buf, data->file_buf + file->offset + read
-		    - data->file_start, movesize);
-      buf += movesize;
-      length -= movesize;
-      read += movesize;
+      data->file_end = data->file_start + n * blksz;
     }
 
   return len;
@@ -38,6 +38,11 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 
+#ifdef ZFS_CHECKSUM_SIMD
+#include <grub/i386/cpuid.h>
+#include <grub/x86_64/simd.h>
+#endif
+
 void
 fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	   zio_cksum_t *zcp)
@@ -60,6 +65,149 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+#ifdef ZFS_CHECKSUM_SIMD
+/*
+ * Fletcher-4 over four interleaved lanes, as OpenZFS does it: lane J sums
+ * words J, J + 4, J + 8 and so on, and the lane sums are then folded into
+ * the checksum of the whole buffer.
+ */
+
+int zfs_fletcher_4_impl = ZFS_CHECKSUM_UNKNOWN;
+
+static int
+fletcher_4_detect (void)
+{
+  grub_uint32_t eax, ebx, ecx, edx, xcr0, xcr0_high;
+
+  /* SSE2 is part of x86_64 and enabled by EFI firmware.  */
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 7)
+    return ZFS_CHECKSUM_SSE2;
+
+  /* AVX needs the firmware to have enabled the YMM state.  */
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(ecx & (1 << 27)) || !(ecx & (1 << 28)))
+    return ZFS_CHECKSUM_SSE2;
+  asm volatile ("xgetbv" : "=a" (xcr0), "=d" (xcr0_high) : "c" (0));
+  if ((xcr0 & 6) != 6)
+    return ZFS_CHECKSUM_SSE2;
+
+  grub_cpuid_count (7, 0, eax, ebx, ecx, edx);
+  if (!(ebx & (1 << 5)))
+    return ZFS_CHECKSUM_SSE2;
+
+  return ZFS_CHECKSUM_AVX2;
+}
+
+/* Lane sums, by sum then lane.  */
+typedef grub_uint64_t fletcher_4_lanes_t[4][4];
+
+static GRUB_SIMD_FUNCTION ("sse2") void
+fletcher_4_sse2 (const grub_uint32_t *ip, const grub_uint32_t *ipend,
+		 fletcher_4_lanes_t lanes)
+{
+  asm volatile ("pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		"pxor %%xmm6, %%xmm6\n\t"
+		"pxor %%xmm7, %%xmm7\n\t"
+		"pxor %%xmm8, %%xmm8\n\t"
+		"1:\n\t"
+		"movdqu (%[ip]), %%xmm9\n\t"
+		"movdqa %%xmm9, %%xmm10\n\t"
+		"punpckldq %%xmm8, %%xmm9\n\t"
+		"punpckhdq %%xmm8, %%xmm10\n\t"
+		"paddq %%xmm9, %%xmm0\n\t"
+		"paddq %%xmm10, %%xmm1\n\t"
+		"paddq %%xmm0, %%xmm2\n\t"
+		"paddq %%xmm1, %%xmm3\n\t"
+		"paddq %%xmm2, %%xmm4\n\t"
+		"paddq %%xmm3, %%xmm5\n\t"
+		"paddq %%xmm4, %%xmm6\n\t"
+		"paddq %%xmm5, %%xmm7\n\t"
+		"addq $16, %[ip]\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jb 1b\n\t"
+		"movdqu %%xmm0, 0(%[lanes])\n\t"
+		"movdqu %%xmm1, 16(%[lanes])\n\t"
+		"movdqu %%xmm2, 32(%[lanes])\n\t"
+		"movdqu %%xmm3, 48(%[lanes])\n\t"
+		"movdqu %%xmm4, 64(%[lanes])\n\t"
+		"movdqu %%xmm5, 80(%[lanes])\n\t"
+		"movdqu %%xmm6, 96(%[lanes])\n\t"
+		"movdqu %%xmm7, 112(%[lanes])"
+		: [ip] "+r" (ip)
+		: [ipend] "r" (ipend), [lanes] "r" (lanes)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		  "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+}
+
+static GRUB_SIMD_FUNCTION ("avx2") void
+fletcher_4_avx2 (const grub_uint32_t *ip, const grub_uint32_t *ipend,
+		 fletcher_4_lanes_t lanes)
+{
+  asm volatile ("vpxor %%ymm0, %%ymm0, %%ymm0\n\t"
+		"vpxor %%ymm1, %%ymm1, %%ymm1\n\t"
+		"vpxor %%ymm2, %%ymm2, %%ymm2\n\t"
+		"vpxor %%ymm3, %%ymm3, %%ymm3\n\t"
+		"1:\n\t"
+		"vpmovzxdq (%[ip]), %%ymm4\n\t"
+		"vpaddq %%ymm4, %%ymm0, %%ymm0\n\t"
+		"vpaddq %%ymm0, %%ymm1, %%ymm1\n\t"
+		"vpaddq %%ymm1, %%ymm2, %%ymm2\n\t"
+		"vpaddq %%ymm2, %%ymm3, %%ymm3\n\t"
+		"addq $16, %[ip]\n\t"
+		"cmpq %[ipend], %[ip]\n\t"
+		"jb 1b\n\t"
+		"vmovdqu %%ymm0, 0(%[lanes])\n\t"
+		"vmovdqu %%ymm1, 32(%[lanes])\n\t"
+		"vmovdqu %%ymm2, 64(%[lanes])\n\t"
+		"vmovdqu %%ymm3, 96(%[lanes])\n\t"
+		"vzeroupper"
+		: [ip] "+r" (ip)
+		: [ipend] "r" (ipend), [lanes] "r" (lanes)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+}
+
+/*
+ * Run the lanes over as much of IP..IPEND as they can take and set *A, *B,
+ * *C and *D to the checksum of that part.  Returns where the scalar loop
+ * has to carry on.
+ */
+static const grub_uint32_t *
+fletcher_4_simd (const grub_uint32_t *ip, const grub_uint32_t *ipend,
+		 grub_uint64_t *a, grub_uint64_t *b, grub_uint64_t *c,
+		 grub_uint64_t *d)
+{
+  fletcher_4_lanes_t l;
+  const grub_uint32_t *end = ip + ((ipend - ip) & ~3);
+
+  if (end == ip)
+    return ip;
+
+  if (zfs_fletcher_4_impl == ZFS_CHECKSUM_AVX2)
+    fletcher_4_avx2 (ip, end, l);
+  else
+    fletcher_4_sse2 (ip, end, l);
+
+  *a = l[0][0] + l[0][1] + l[0][2] + l[0][3];
+  *b = 4 * (l[1][0] + l[1][1] + l[1][2] + l[1][3])
+    - (l[0][1] + 2 * l[0][2] + 3 * l[0][3]);
+  *c = 16 * (l[2][0] + l[2][1] + l[2][2] + l[2][3])
+    - (6 * l[1][0] + 10 * l[1][1] + 14 * l[1][2] + 18 * l[1][3])
+    + (l[0][2] + 3 * l[0][3]);
+  *d = 64 * (l[3][0] + l[3][1] + l[3][2] + l[3][3])
+    - (48 * l[2][0] + 64 * l[2][1] + 80 * l[2][2] + 96 * l[2][3])
+    + (4 * l[1][0] + 10 * l[1][1] + 20 * l[1][2] + 34 * l[1][3])
+    - l[0][3];
+
+  return end;
+}
+#endif
+
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
@@ -67,8 +215,18 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
   grub_uint64_t a, b, c, d;
+
+  a = b = c = d = 0;
+#ifdef ZFS_CHECKSUM_SIMD
+  if (zfs_fletcher_4_impl == ZFS_CHECKSUM_UNKNOWN)
+    zfs_fletcher_4_impl = fletcher_4_detect ();
+  /* The lanes don't byte-swap, so big-endian pools take the scalar loop.  */
+  if (endian == GRUB_ZFS_LITTLE_ENDIAN
+      && zfs_fletcher_4_impl != ZFS_CHECKSUM_SCALAR)
+    ip = fletcher_4_simd (ip, ipend, &a, &b, &c, &d);
+#endif
   
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+  for (; ip < ipend; ip++) 
     {
       a += grub_zfs_to_cpu32 (ip[0], endian);;
       b += a;
@@ -81,4 +239,3 @@ fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
   zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
 }
-
@@ -38,6 +38,11 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 
+#ifdef ZFS_CHECKSUM_SIMD
+#include <grub/i386/cpuid.h>
+#include <grub/x86_64/simd.h>
+#endif
+
 /*
  * SHA-256 checksum, as specified in FIPS 180-2, available at:
  * http://csrc.nist.gov/cryptval
@@ -62,7 +67,8 @@
 #define	sigma0(x)	(Rot32(x, 7) ^ Rot32(x, 18) ^ ((x) >> 3))
 #define	sigma1(x)	(Rot32(x, 17) ^ Rot32(x, 19) ^ ((x) >> 10))
 
-static const grub_uint32_t SHA256_K[64] = {
+/* Aligned for the SHA extensions, which add them straight from memory.  */
+static const grub_uint32_t SHA256_K[64] __attribute__ ((aligned (16))) = {
 	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
 	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
@@ -107,6 +113,173 @@ SHA256Transform(grub_uint32_t *H, const grub_uint8_t *cp)
 	H[4] += e; H[5] += f; H[6] += g; H[7] += h;
 }
 
+#ifdef ZFS_CHECKSUM_SIMD
+/*
+ * SHA256Transform over NBLOCKS blocks with the SHA extensions, after the
+ * Intel reference code.  xmm0 is the message operand of sha256rnds2, xmm1
+ * and xmm2 hold the state as ABEF and CDGH, xmm3 to xmm6 the message
+ * schedule.
+ */
+
+#define SHA256_NI_M0 "%%xmm3"
+#define SHA256_NI_M1 "%%xmm4"
+#define SHA256_NI_M2 "%%xmm5"
+#define SHA256_NI_M3 "%%xmm6"
+
+#define SHA256_NI_LOAD(off, m)				\
+  "movdqu " #off "(%[data]), %%xmm0\n\t"		\
+  "pshufb %%xmm8, %%xmm0\n\t"				\
+  "movdqa %%xmm0, " m "\n\t"
+
+/* Two rounds each, the constants for the four at K offset KOFF.  */
+#define SHA256_NI_RNDS_LO(koff)				\
+  "paddd " #koff "(%[k]), %%xmm0\n\t"			\
+  "sha256rnds2 %%xmm1, %%xmm2\n\t"
+#define SHA256_NI_RNDS_HI				\
+  "pshufd $0x0e, %%xmm0, %%xmm0\n\t"			\
+  "sha256rnds2 %%xmm2, %%xmm1\n\t"
+
+#define SHA256_NI_MSG1(cur, prev)			\
+  "sha256msg1 " cur ", " prev "\n\t"
+#define SHA256_NI_MSG2(cur, prev, next)			\
+  "movdqa " cur ", %%xmm7\n\t"				\
+  "palignr $4, " prev ", %%xmm7\n\t"			\
+  "paddd %%xmm7, " next "\n\t"				\
+  "sha256msg2 " cur ", " next "\n\t"
+
+/* Four rounds from the schedule, computing more of it on the way.  */
+#define SHA256_NI_QUAD(koff, cur, prev, next)		\
+  "movdqa " cur ", %%xmm0\n\t"				\
+  SHA256_NI_RNDS_LO (koff)				\
+  SHA256_NI_MSG2 (cur, prev, next)			\
+  SHA256_NI_RNDS_HI					\
+  SHA256_NI_MSG1 (cur, prev)
+
+static const grub_uint8_t sha256_ni_bswap[16] = {
+  3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+};
+
+static GRUB_SIMD_FUNCTION ("sse4.1,sha") void
+sha256_ni_transform (grub_uint32_t *H, const grub_uint8_t *cp,
+		     grub_size_t nblocks)
+{
+  const grub_uint8_t *end = cp + nblocks * 64;
+
+  asm volatile ("movdqu 0(%[h]), %%xmm1\n\t"
+		"movdqu 16(%[h]), %%xmm2\n\t"
+		"pshufd $0xb1, %%xmm1, %%xmm1\n\t"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm7\n\t"
+		"palignr $8, %%xmm2, %%xmm1\n\t"
+		"pblendw $0xf0, %%xmm7, %%xmm2\n\t"
+		"movdqu (%[bswap]), %%xmm8\n\t"
+		"1:\n\t"
+		"movdqa %%xmm1, %%xmm9\n\t"
+		"movdqa %%xmm2, %%xmm10\n\t"
+
+		SHA256_NI_LOAD (0, SHA256_NI_M0)
+		SHA256_NI_RNDS_LO (0)
+		SHA256_NI_RNDS_HI
+
+		SHA256_NI_LOAD (16, SHA256_NI_M1)
+		SHA256_NI_RNDS_LO (16)
+		SHA256_NI_RNDS_HI
+		SHA256_NI_MSG1 (SHA256_NI_M1, SHA256_NI_M0)
+
+		SHA256_NI_LOAD (32, SHA256_NI_M2)
+		SHA256_NI_RNDS_LO (32)
+		SHA256_NI_RNDS_HI
+		SHA256_NI_MSG1 (SHA256_NI_M2, SHA256_NI_M1)
+
+		SHA256_NI_LOAD (48, SHA256_NI_M3)
+		SHA256_NI_RNDS_LO (48)
+		SHA256_NI_MSG2 (SHA256_NI_M3, SHA256_NI_M2, SHA256_NI_M0)
+		SHA256_NI_RNDS_HI
+		SHA256_NI_MSG1 (SHA256_NI_M3, SHA256_NI_M2)
+
+		SHA256_NI_QUAD (64, SHA256_NI_M0, SHA256_NI_M3, SHA256_NI_M1)
+		SHA256_NI_QUAD (80, SHA256_NI_M1, SHA256_NI_M0, SHA256_NI_M2)
+		SHA256_NI_QUAD (96, SHA256_NI_M2, SHA256_NI_M1, SHA256_NI_M3)
+		SHA256_NI_QUAD (112, SHA256_NI_M3, SHA256_NI_M2, SHA256_NI_M0)
+		SHA256_NI_QUAD (128, SHA256_NI_M0, SHA256_NI_M3, SHA256_NI_M1)
+		SHA256_NI_QUAD (144, SHA256_NI_M1, SHA256_NI_M0, SHA256_NI_M2)
+		SHA256_NI_QUAD (160, SHA256_NI_M2, SHA256_NI_M1, SHA256_NI_M3)
+		SHA256_NI_QUAD (176, SHA256_NI_M3, SHA256_NI_M2, SHA256_NI_M0)
+		SHA256_NI_QUAD (192, SHA256_NI_M0, SHA256_NI_M3, SHA256_NI_M1)
+
+		"movdqa " SHA256_NI_M1 ", %%xmm0\n\t"
+		SHA256_NI_RNDS_LO (208)
+		SHA256_NI_MSG2 (SHA256_NI_M1, SHA256_NI_M0, SHA256_NI_M2)
+		SHA256_NI_RNDS_HI
+
+		"movdqa " SHA256_NI_M2 ", %%xmm0\n\t"
+		SHA256_NI_RNDS_LO (224)
+		SHA256_NI_MSG2 (SHA256_NI_M2, SHA256_NI_M1, SHA256_NI_M3)
+		SHA256_NI_RNDS_HI
+
+		"movdqa " SHA256_NI_M3 ", %%xmm0\n\t"
+		SHA256_NI_RNDS_LO (240)
+		SHA256_NI_RNDS_HI
+
+		"paddd %%xmm9, %%xmm1\n\t"
+		"paddd %%xmm10, %%xmm2\n\t"
+		"addq $64, %[data]\n\t"
+		"cmpq %[end], %[data]\n\t"
+		"jb 1b\n\t"
+
+		"pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm7\n\t"
+		"pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+		"palignr $8, %%xmm7, %%xmm2\n\t"
+		"movdqu %%xmm1, 0(%[h])\n\t"
+		"movdqu %%xmm2, 16(%[h])"
+		: [data] "+r" (cp)
+		: [end] "r" (end), [h] "r" (H), [k] "r" (SHA256_K),
+		  [bswap] "r" (sha256_ni_bswap)
+		: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4",
+		  "xmm5", "xmm6", "xmm7", "xmm8", "xmm9", "xmm10");
+}
+
+int zfs_sha256_impl = ZFS_CHECKSUM_UNKNOWN;
+
+static int
+sha256_detect (void)
+{
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 7)
+    return ZFS_CHECKSUM_SCALAR;
+  /* SSSE3 and SSE4.1 for the shuffles and blends.  */
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(ecx & (1 << 9)) || !(ecx & (1 << 19)))
+    return ZFS_CHECKSUM_SCALAR;
+  grub_cpuid_count (7, 0, eax, ebx, ecx, edx);
+  if (!(ebx & (1 << 29)))
+    return ZFS_CHECKSUM_SCALAR;
+  return ZFS_CHECKSUM_SHA_NI;
+}
+#endif
+
+static void
+SHA256TransformBlocks(grub_uint32_t *H, const grub_uint8_t *cp,
+		      grub_size_t nblocks)
+{
+#ifdef ZFS_CHECKSUM_SIMD
+  if (zfs_sha256_impl == ZFS_CHECKSUM_UNKNOWN)
+    zfs_sha256_impl = sha256_detect ();
+  if (zfs_sha256_impl == ZFS_CHECKSUM_SHA_NI)
+    {
+      if (nblocks)
+	sha256_ni_transform (H, cp, nblocks);
+      return;
+    }
+#endif
+  for (; nblocks; nblocks--, cp += 64)
+    SHA256Transform(H, cp);
+}
+
 void
 zio_checksum_SHA256(const void *buf, grub_uint64_t size,
 		    grub_zfs_endian_t endian, zio_cksum_t *zcp)
@@ -117,11 +290,10 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   unsigned padsize = size & 63;
   unsigned i;
   
-  for (i = 0; i < size - padsize; i += 64)
-    SHA256Transform(H, (grub_uint8_t *)buf + i);
+  SHA256TransformBlocks(H, buf, (size - padsize) / 64);
   
   for (i = 0; i < padsize; i++)
-    pad[i] = ((grub_uint8_t *)buf)[i];
+    pad[i] = ((grub_uint8_t *)buf)[size - padsize + i];
   
   for (pad[padsize++] = 0x80; (padsize & 63) != 56; padsize++)
     pad[padsize] = 0;
@@ -129,8 +301,7 @@ zio_checksum_SHA256(const void *buf, grub_uint64_t size,
   for (i = 0; i < 8; i++)
     pad[padsize++] = (size << 3) >> (56 - 8 * i);
   
-  for (i = 0; i < padsize && i <= 64; i += 64)
-    SHA256Transform(H, pad + i);
+  SHA256TransformBlocks(H, pad, padsize / 64);
   
   zcp->zc_word[0] = grub_cpu_to_zfs64 ((grub_uint64_t)H[0] << 32 | H[1], 
 				       endian);
@@ -30,13 +30,26 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
 
+struct grub_bufio_buffer
+{
+  char *data;
+  grub_size_t alloc_len;
+  grub_size_t len;
+  grub_off_t at;
+};
+
 struct grub_bufio
 {
   grub_file_t file;
   grub_size_t block_size;
-  grub_size_t buffer_len;
-  grub_off_t buffer_at;
-  char buffer[0];
+  /* Refills start at multiples of the initial block size, so that one
+     following on from a buffer starts at its end also once the window
+     grew.  */
+  grub_size_t align;
+  /* Two buffers: the most recently filled one, buffers[current], and the
+     one before it, which keeps backward seeks over recent data cheap.  */
+  struct grub_bufio_buffer buffers[2];
+  int current;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
@@ -47,6 +60,7 @@ grub_bufio_open (grub_file_t io, grub_size_t size)
 {
   grub_file_t file;
   grub_bufio_t bufio = 0;
+  int i;
 
   file = (grub_file_t) grub_zalloc (sizeof (*file));
   if (! file)
@@ -54,7 +68,13 @@ grub_bufio_open (grub_file_t io, grub_size_t size)
 
   if (size == 0)
     size = GRUB_BUFIO_DEF_SIZE;
-  else if (size > GRUB_BUFIO_MAX_SIZE)
+
+  /* Reading less than the filesystem block at a time doesn't save any
+     disk access.  */
+  if (size < io->preferred_block_size)
+    size = io->preferred_block_size;
+
+  if (size > GRUB_BUFIO_MAX_SIZE)
     size = GRUB_BUFIO_MAX_SIZE;
 
   if (size > io->size)
@@ -68,21 +88,36 @@ grub_bufio_open (grub_file_t io, grub_size_t size)
   while (size & (size - 1))
     size = (size | (size - 1)) + 1;
 
-  bufio = grub_zalloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
       return 0;
     }
 
+  for (i = 0; i < 2; i++)
+    {
+      bufio->buffers[i].data = grub_malloc (size ? : 1);
+      if (! bufio->buffers[i].data)
+	{
+	  grub_free (bufio->buffers[0].data);
+	  grub_free (bufio);
+	  grub_free (file);
+	  return 0;
+	}
+      bufio->buffers[i].alloc_len = size;
+    }
+
   bufio->file = io;
   bufio->block_size = size;
+  bufio->align = size;
 
   file->device = io->device;
   file->size = io->size;
   file->data = bufio;
   file->fs = &grub_bufio_fs;
   file->not_easily_seekable = io->not_easily_seekable;
+  file->preferred_block_size = io->preferred_block_size;
 
   return file;
 }
@@ -106,41 +141,104 @@ grub_buffile_open (const char *name, enum grub_file_type type, grub_size_t size)
   return file;
 }
 
-static grub_ssize_t
-grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
+/* Copy as much as possible of LEN bytes at OFFSET from the buffers into
+   BUF and return the amount copied.  */
+static grub_size_t
+grub_bufio_copy (grub_bufio_t bufio, grub_off_t offset, char *buf,
+		 grub_size_t len)
 {
   grub_size_t res = 0;
-  grub_off_t next_buf;
-  grub_bufio_t bufio = file->data;
-  grub_ssize_t really_read;
+  int i;
 
-  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
-    file->size = bufio->file->size;
-
-  /* First part: use whatever we already have in the buffer.  */
-  if ((file->offset >= bufio->buffer_at) &&
-      (file->offset < bufio->buffer_at + bufio->buffer_len))
+  /* Data may continue from the older buffer into the current one.  */
+  for (i = 0; i < 2 && len; i++)
     {
+      struct grub_bufio_buffer *b = &bufio->buffers[bufio->current ^ 1 ^ i];
       grub_size_t n;
       grub_uint64_t pos;
 
-      pos = file->offset - bufio->buffer_at;
-      n = bufio->buffer_len - pos;
+      if (offset < b->at || offset >= b->at + b->len)
+	continue;
+
+      pos = offset - b->at;
+      n = b->len - pos;
       if (n > len)
-        n = len;
+	n = len;
 
-      grub_memcpy (buf, &bufio->buffer[pos], n);
+      grub_memcpy (buf, &b->data[pos], n);
       len -= n;
       res += n;
-
       buf += n;
+      offset += n;
     }
+
+  return res;
+}
+
+/* Make the older buffer the current one, growing it to the block size if
+   needed, and return it.  */
+static struct grub_bufio_buffer *
+grub_bufio_next_buffer (grub_bufio_t bufio)
+{
+  struct grub_bufio_buffer *b;
+
+  bufio->current ^= 1;
+  b = &bufio->buffers[bufio->current];
+  b->len = 0;
+
+  if (b->alloc_len < bufio->block_size)
+    {
+      char *data;
+
+      data = grub_realloc (b->data, bufio->block_size);
+      if (data)
+	{
+	  b->data = data;
+	  b->alloc_len = bufio->block_size;
+	}
+      else
+	{
+	  /* Keep going with the smaller window.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  bufio->block_size = b->alloc_len;
+	}
+    }
+
+  return b;
+}
+
+static grub_ssize_t
+grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_size_t res = 0;
+  grub_off_t next_buf;
+  grub_bufio_t bufio = file->data;
+  struct grub_bufio_buffer *cur = &bufio->buffers[bufio->current];
+  grub_ssize_t really_read;
+  grub_size_t pos;
+
+  if (file->size == GRUB_FILE_SIZE_UNKNOWN)
+    file->size = bufio->file->size;
+
+  /* First part: use whatever we already have in the buffers.  */
+  res = grub_bufio_copy (bufio, file->offset, buf, len);
+  len -= res;
+  buf += res;
   if (len == 0)
     return res;
 
+  /* Reading on from the end of the current buffer is sequential access,
+     so use a larger window from now on.  */
+  if (cur->len && file->offset + res == cur->at + cur->len
+      && bufio->block_size < GRUB_BUFIO_MAX_SIZE
+      && bufio->block_size < file->size)
+    bufio->block_size <<= 1;
+
+  cur = grub_bufio_next_buffer (bufio);
+
   /* Need to read some more.  */
-  next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->block_size - 1);
-  /* Now read between file->offset + res and bufio->buffer_at.  */
+  next_buf = (file->offset + res + len - 1) & ~((grub_off_t) bufio->align - 1);
+  /* Now read between file->offset + res and next_buf.  */
   if (file->offset + res < next_buf)
     {
       grub_size_t read_now;
@@ -159,31 +257,33 @@ grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
        */
       if (really_read != (grub_ssize_t) read_now)
 	{
-	  bufio->buffer_len = really_read;
-	  if (bufio->buffer_len > bufio->block_size)
-	    bufio->buffer_len = bufio->block_size;
-	  bufio->buffer_at = file->offset + res - bufio->buffer_len;
-	  grub_memcpy (&bufio->buffer[0], buf - bufio->buffer_len,
-		       bufio->buffer_len);
+	  cur->len = really_read;
+	  if (cur->len > cur->alloc_len)
+	    cur->len = cur->alloc_len;
+	  cur->at = file->offset + res - cur->len;
+	  grub_memcpy (cur->data, buf - cur->len, cur->len);
 	  return res;
 	}
     }
 
   /* Read into buffer.  */
   grub_file_seek (bufio->file, next_buf);
-  really_read = grub_file_read (bufio->file, bufio->buffer,
+  really_read = grub_file_read (bufio->file, cur->data,
 				bufio->block_size);
   if (really_read < 0)
     return -1;
-  bufio->buffer_at = next_buf;
-  bufio->buffer_len = really_read;
+  cur->at = next_buf;
+  cur->len = really_read;
 
   if (file->size == GRUB_FILE_SIZE_UNKNOWN)
     file->size = bufio->file->size;
 
-  if (len > bufio->buffer_len)
-    len = bufio->buffer_len;
-  grub_memcpy (buf, &bufio->buffer[file->offset + res - next_buf], len);
+  pos = file->offset + res - next_buf;
+  if (pos >= cur->len)
+    return res;
+  if (len > cur->len - pos)
+    len = cur->len - pos;
+  grub_memcpy (buf, &cur->data[pos], len);
   res += len;
 
   return res;
@@ -195,6 +295,8 @@ grub_bufio_close (grub_file_t file)
   grub_bufio_t bufio = file->data;
 
   grub_file_close (bufio->file);
+  grub_free (bufio->buffers[0].data);
+  grub_free (bufio->buffers[1].data);
   grub_free (bufio);
 
   file->device = 0;
@@ -58,13 +58,64 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 #define INBUFSIZ  0x2000
 
+/* Reads at least this large are decompressed straight into the caller's
+   buffer instead of going through the slide.  */
+#define DIRECT_SIZE	(WSIZE / 8)
+
+/* Lookup bits of the first level literal/length and distance tables.  */
+#define LBITS	11
+#define DBITS	8
+/* Lookup bits of the bit length code table, its longest code.  */
+#define CBITS	7
+
+/* Worst case sizes of the literal/length and distance tables, including
+   the second level tables, for the lookup bits above.  */
+#define LENOUGH	2342
+#define DENOUGH	402
+
+/* Checkpoints are taken at the first block boundary after every
+   CHECKPOINT_SPACING bytes of uncompressed data.  When MAX_CHECKPOINTS
+   are taken, every other one is dropped and the spacing doubles, which
+   bounds the memory used to about MAX_CHECKPOINTS * WSIZE.  */
+#define CHECKPOINT_SPACING	(1 << 20)
+#define MAX_CHECKPOINTS		32
+
+/* The state needed to resume decompression at a block boundary.  */
+struct grub_gzio_checkpoint
+{
+  /* The offset in the uncompressed data.  */
+  grub_off_t offset;
+  /* The position in the input, in bits.  */
+  grub_off_t in_bits;
+  /* The uncompressed data preceding OFFSET, the last WHAVE bytes of it.  */
+  unsigned whave;
+  grub_uint8_t window[WSIZE];
+  /* The checksum context at OFFSET.  */
+  grub_uint8_t hcontext[0];
+};
+
+/* Huffman code lookup table entry.  e == 16 means that v is a literal,
+   e == 15 is EOB (end of block), and e < 15 means that v is a length or
+   distance base with e extra bits.  16 < e < 32 links to the second level
+   table at offset v, indexed by the next e - 16 bits.  32 <= e < 48 is a
+   pair of literals, the first one in the low byte of v and e - 32 bits
+   long.  e == 99 indicates an unused code; looking it up implies an error
+   in the data.  */
+struct huft
+{
+  grub_uint8_t e;		/* number of extra bits or operation */
+  grub_uint8_t b;		/* number of bits in this code or subcode */
+  grub_uint16_t v;		/* literal(s), length or distance base, or
+				   offset of the next level table */
+};
+
 /* The state stored in filesystem-specific data.  */
 struct grub_gzio
 {
   /* The underlying file object.  */
   grub_file_t file;
   /* If input is in memory following fields are used instead of file.  */
-  grub_size_t mem_input_size, mem_input_off;
+  grub_size_t mem_input_size;
   grub_uint8_t *mem_input;
   /* The offset at which the data starts in the underlying file.  */
   grub_off_t data_offset;
@@ -74,27 +125,35 @@ struct grub_gzio
   int block_len;
   /* The flag of the last block.  */
   int last_block;
-  /* The flag of codes.  */
-  int code_state;
-  /* The length of a copy.  */
+  /* The length of a copy in progress.  */
   unsigned inflate_n;
-  /* The index of a copy.  */
+  /* The distance of a copy in progress.  */
   unsigned inflate_d;
   /* The input buffer.  */
   grub_uint8_t inbuf[INBUFSIZ];
-  int inbuf_d;
+  /* The offset of INBUF in the underlying file.  */
+  grub_off_t inbuf_offset;
+  /* The input not consumed yet, in INBUF or MEM_INPUT.  */
+  const grub_uint8_t *in_next;
+  const grub_uint8_t *in_end;
   /* The bit buffer.  */
-  unsigned long bb;
+  grub_uint64_t bb;
   /* The bits in the bit buffer.  */
   unsigned bk;
-  /* The sliding window in uncompressed data.  */
+  /* The bytes of padding past the end of the input in the bit buffer.  */
+  unsigned in_pad;
+  /* The last WSIZE bytes of uncompressed data, as a circular buffer.  */
   grub_uint8_t slide[WSIZE];
-  /* Current position in the slide.  */
+  /* Where the next byte goes in the slide.  */
   unsigned wp;
+  /* The number of valid bytes in the slide.  */
+  unsigned whave;
   /* The literal/length code table.  */
-  struct huft *tl;
+  struct huft tl[LENOUGH];
   /* The distance code table.  */
-  struct huft *td;
+  struct huft td[DENOUGH];
+  /* The tables hold the fixed codes.  */
+  int fixed_tables;
   /* The checksum algorithm */
   const gcry_md_spec_t *hdesc;
   /* The wanted checksum */
@@ -107,8 +166,15 @@ struct grub_gzio
   int bl;
   /* The lookup bits for the distance code table.  */
   int bd;
-  /* The original offset value.  */
+  /* The amount of uncompressed data so far.  */
   grub_off_t saved_offset;
+  /* Checkpoints to seek to, by increasing offset.  Only taken for files,
+     if CHECKPOINT_SPACING is set.  */
+  struct grub_gzio_checkpoint *checkpoints[MAX_CHECKPOINTS];
+  unsigned num_checkpoints;
+  grub_off_t checkpoint_spacing;
+  /* The offset from which the next checkpoint is due.  */
+  grub_off_t checkpoint_next;
 };
 typedef struct grub_gzio *grub_gzio_t;
 
@@ -175,7 +241,6 @@ eat_field (grub_file_t file, int len)
 
 typedef unsigned char uch;
 typedef unsigned short ush;
-typedef unsigned long ulg;
 
 static int
 test_gzip_header (grub_file_t file)
@@ -241,36 +306,6 @@ test_gzip_header (grub_file_t file)
 }
 
 
-/* Huffman code lookup table entry--this entry is four bytes for machines
-   that have 16-bit pointers (e.g. PC's in the small or medium model).
-   Valid extra bits are 0..13.  e == 15 is EOB (end of block), e == 16
-   means that v is a literal, 16 < e < 32 means that v is a pointer to
-   the next table, which codes e - 16 bits, and lastly e == 99 indicates
-   an unused code.  If a code with e == 99 is looked up, this implies an
-   error in the data. */
-struct huft
-{
-  uch e;			/* number of extra bits or operation */
-  uch b;			/* number of bits in this code or subcode */
-  union
-    {
-      ush n;			/* literal, length base, or distance base */
-      struct huft *t;		/* pointer to next level of table */
-    }
-  v;
-};
-
-
-/* The inflate algorithm uses a sliding 32K byte window on the uncompressed
-   stream to find repeated byte strings.  This is implemented here as a
-   circular buffer.  The index is updated simply by incrementing and then
-   and'ing with 0x7fff (32K-1). */
-/* It is left to other modules to supply the 32K area.  It is assumed
-   to be usable as if it were declared "uch slide[32768];" or as just
-   "uch *slide;" and then malloc'ed in the latter case.  The definition
-   must be in unzip.h, included above. */
-
-
 /* Tables for deflate from PKZIP's appnote.txt. */
 static unsigned bitorder[] =
 {				/* Order of the bit length code lengths */
@@ -297,76 +332,29 @@ static ush cpdext[] =
 
 
 /*
-   Huffman code decoding is performed using a multi-level table lookup.
-   The fastest way to decode is to simply build a lookup table whose
-   size is determined by the longest code.  However, the time it takes
-   to build this table can also be a factor if the data being decoded
-   is not very long.  The most common codes are necessarily the
-   shortest codes, so those codes dominate the decoding time, and hence
-   the speed.  The idea is you can have a shorter table that decodes the
-   shorter, more probable codes, and then point to subsidiary tables for
-   the longer codes.  The time it costs to decode the longer codes is
-   then traded against the time it takes to make longer tables.
-
-   This results of this trade are in the variables lbits and dbits
-   below.  lbits is the number of bits the first level table for literal/
-   length codes can decode in one step, and dbits is the same thing for
-   the distance codes.  Subsequent tables are also less than or equal to
-   those sizes.  These values may be adjusted either when all of the
-   codes are shorter than that, in which case the longest code length in
-   bits is used, or when the shortest code is *longer* than the requested
-   table size, in which case the length of the shortest code in bits is
-   used.
-
-   There are two different values for the two tables, since they code a
-   different number of possibilities each.  The literal/length table
-   codes 286 possible values, or in a flat code, a little over eight
-   bits.  The distance table codes 30 possible values, or a little less
-   than five bits, flat.  The optimum values for speed end up being
-   about one bit more than those, so lbits is 8+1 and dbits is 5+1.
-   The optimum values may differ though from machine to machine, and
-   possibly even between compilers.  Your mileage may vary.
+   Huffman codes are decoded with a table lookup of the next LBITS (or
+   DBITS) bits of input.  Codes of up to that many bits are decoded in one
+   step, because their entry is repeated for every value of the bits
+   following them.  Longer codes are rare and get a second level table,
+   sized for the longest code sharing the first LBITS bits, which is
+   linked to from the first one.  Both levels live in one array, so that
+   building the tables for a new block needs no allocation.
+
+   Two literals whose codes fit into LBITS bits together share a single
+   literal/length table entry, which is the common case for text, and
+   the 64-bit bit buffer is refilled eight bytes at a time, so that a
+   whole length/distance pair can be decoded after a single refill.
  */
 
 
-static int lbits = 9;		/* bits in base literal/length lookup table */
-static int dbits = 6;		/* bits in base distance lookup table */
-
-
-/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
-#define BMAX 16			/* maximum bit length of any code (16 for explode) */
+#define BMAX 15			/* maximum bit length of any code */
 #define N_MAX 288		/* maximum number of codes in any set */
 
-
-/* Macros for inflate() bit peeking and grabbing.
-   The usage is:
-
-        NEEDBITS(j)
-        x = b & mask_bits[j];
-        DUMPBITS(j)
-
-   where NEEDBITS makes sure that b has at least j bits in it, and
-   DUMPBITS removes the bits from b.  The macros use the variable k
-   for the number of bits in b.  Normally, b and k are register
-   variables for speed, and are initialized at the beginning of a
-   routine that uses these macros from a global bit buffer and count.
-
-   If we assume that EOB will be the longest code, then we will never
-   ask for bits with NEEDBITS that are beyond the end of the stream.
-   So, NEEDBITS should not read any more bytes than are needed to
-   meet the request.  Then no bytes need to be "returned" to the buffer
-   at the end of the last block.
-
-   However, this assumption is not true for fixed blocks--the EOB code
-   is 7 bits, but the other literal/length codes can be 8 or 9 bits.
-   (The EOB code is shorter than other codes because fixed blocks are
-   generally short.  So, while a block always has an EOB, many other
-   literal/length codes have a significantly lower probability of
-   showing up at all.)  However, by making the first table have a
-   lookup of seven bits, the EOB code will be found in that first
-   lookup, and so will not require that too many bits be pulled from
-   the stream.
- */
+/* Operations in struct huft.  */
+#define E_EOB	15
+#define E_LIT	16
+#define E_PAIR	32
+#define E_BAD	99
 
 static ush mask_bits[] =
 {
@@ -375,28 +363,32 @@ static ush mask_bits[] =
   0x01ff, 0x03ff, 0x07ff, 0x0fff, 0x1fff, 0x3fff, 0x7fff, 0xffff
 };
 
-#define NEEDBITS(n) do {while(k<(n)){b|=((ulg)get_byte(gzio))<<k;k+=8;}} while (0)
-#define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
+/* Refill the input buffer.  Return zero at the end of the input.  */
+static int
+fill_inbuf (grub_gzio_t gzio)
+{
+  grub_ssize_t len;
+
+  if (gzio->mem_input || ! gzio->file)
+    return 0;
 
+  gzio->inbuf_offset = grub_file_tell (gzio->file);
+  len = grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
+  if (len <= 0)
+    return 0;
+  gzio->in_next = gzio->inbuf;
+  gzio->in_end = gzio->inbuf + len;
+  return 1;
+}
+
+/* Past the end of the input the data reads as zeros.  */
 static int
 get_byte (grub_gzio_t gzio)
 {
-  if (gzio->mem_input)
-    {
-      if (gzio->mem_input_off < gzio->mem_input_size)
-	return gzio->mem_input[gzio->mem_input_off++];
-      return 0;
-    }
-
-  if (gzio->file && (grub_file_tell (gzio->file)
-		     == (grub_off_t) gzio->data_offset
-		     || gzio->inbuf_d == INBUFSIZ))
-    {
-      gzio->inbuf_d = 0;
-      grub_file_read (gzio->file, gzio->inbuf, INBUFSIZ);
-    }
+  if (gzio->in_next == gzio->in_end && ! fill_inbuf (gzio))
+    return 0;
 
-  return gzio->inbuf[gzio->inbuf_d++];
+  return *gzio->in_next++;
 }
 
 static void
@@ -408,373 +400,485 @@ gzio_seek (grub_gzio_t gzio, grub_off_t off)
 	grub_error (GRUB_ERR_OUT_OF_RANGE,
 		    N_("attempt to seek outside of the file"));
       else
-	gzio->mem_input_off = off;
+	{
+	  gzio->in_next = gzio->mem_input + off;
+	  gzio->in_end = gzio->mem_input + gzio->mem_input_size;
+	}
     }
   else
-    grub_file_seek (gzio->file, off);
+    {
+      grub_file_seek (gzio->file, off);
+      gzio->in_next = gzio->in_end = gzio->inbuf;
+      gzio->inbuf_offset = off;
+    }
 }
 
-/* more function prototypes */
-static int huft_build (unsigned *, unsigned, unsigned, ush *, ush *,
-		       struct huft **, int *);
-static int huft_free (struct huft *);
-static int inflate_codes_in_window (grub_gzio_t);
+/* Return the position in the input of the first bit not consumed yet.  */
+static grub_off_t
+gzio_tell_bits (grub_gzio_t gzio)
+{
+  grub_off_t pos;
 
+  if (gzio->mem_input)
+    pos = gzio->in_next - gzio->mem_input;
+  else
+    pos = gzio->inbuf_offset + (gzio->in_next - gzio->inbuf);
 
-/* Given a list of code lengths and a maximum table size, make a set of
-   tables to decode that set of codes.  Return zero on success, one if
-   the given code set is incomplete (the tables are still built in this
-   case), two if the input is invalid (all zero length codes or an
-   oversubscribed set of lengths), and three if not enough memory. */
+  return pos * 8 - (gzio->bk - gzio->in_pad * 8);
+}
 
-static int
-huft_build (unsigned *b,	/* code lengths in bits (all assumed <= BMAX) */
-	    unsigned n,		/* number of codes (assumed <= N_MAX) */
-	    unsigned s,		/* number of simple-valued codes (0..s-1) */
-	    ush * d,		/* list of base values for non-simple codes */
-	    ush * e,		/* list of extra bits for non-simple codes */
-	    struct huft **t,	/* result: starting table */
-	    int *m)		/* maximum lookup bits, returns actual */
+/* Fill the bit buffer with at least 56 bits, one byte at a time.  Past
+   the end of the input, pad it with zeros and count them.  */
+static void
+refill_slow (grub_gzio_t gzio)
 {
-  unsigned a;			/* counter for codes of length k */
-  unsigned c[BMAX + 1];		/* bit length count table */
-  unsigned f;			/* i repeats in table every f entries */
-  int g;			/* maximum code length */
-  int h;			/* table level */
-  register unsigned i;		/* counter, current code */
-  register unsigned j;		/* counter */
-  register int k;		/* number of bits in current code */
-  int l;			/* bits per table (returned in m) */
-  register unsigned *p;		/* pointer into c[], b[], or v[] */
-  register struct huft *q;	/* points to current table */
-  struct huft r;		/* table entry for structure assignment */
-  struct huft *u[BMAX];		/* table stack */
-  unsigned v[N_MAX];		/* values in order of bit length */
-  register int w;		/* bits before this table == (l * h) */
-  unsigned x[BMAX + 1];		/* bit offsets, then code stack */
-  unsigned *xp;			/* pointer into x */
-  int y;			/* number of dummy codes added */
-  unsigned z;			/* number of entries in current table */
-
-  /* Generate counts for each bit length */
-  grub_memset ((char *) c, 0, sizeof (c));
-  p = b;
-  i = n;
-  do
-    {
-      c[*p]++;			/* assume all entries <= BMAX */
-      p++;			/* Can't combine with above line (Solaris bug) */
-    }
-  while (--i);
-  if (c[0] == n)		/* null input--all zero length codes */
+  while (gzio->bk <= 56)
     {
-      *t = (struct huft *) NULL;
-      *m = 0;
-      return 0;
+      if (gzio->in_next == gzio->in_end && ! fill_inbuf (gzio))
+	gzio->in_pad++;
+      else
+	gzio->bb |= (grub_uint64_t) *gzio->in_next++ << gzio->bk;
+      gzio->bk += 8;
     }
+}
 
-  /* Find minimum and maximum length, bound *m by those */
-  l = *m;
-  for (j = 1; j <= BMAX; j++)
-    if (c[j])
-      break;
-  k = j;			/* minimum code length */
-  if ((unsigned) l < j)
-    l = j;
-  for (i = BMAX; i; i--)
-    if (c[i])
-      break;
-  g = i;			/* maximum code length */
-  if ((unsigned) l > i)
-    l = i;
-  *m = l;
-
-  /* Adjust last length count to fill out codes, if needed */
-  for (y = 1 << j; j < i; j++, y <<= 1)
-    if ((y -= c[j]) < 0)
-      return 2;			/* bad input: more codes than bits */
-  if ((y -= c[i]) < 0)
-    return 2;
-  c[i] += y;
-
-  /* Generate starting offsets into the value table for each length */
-  x[1] = j = 0;
-  p = c + 1;
-  xp = x + 2;
-  while (--i)
-    {				/* note that i == g from above */
-      *xp++ = (j += *p++);
-    }
+/* Macros for bit peeking and grabbing in the block headers.  The usage is:
 
-  /* Make a table of values in order of bit lengths */
-  p = b;
-  i = 0;
-  do
-    {
-      if ((j = *p++) != 0)
-	v[x[j]++] = i;
-    }
-  while (++i < n);
-
-  /* Generate the Huffman codes and for each, make the table entries */
-  x[0] = i = 0;			/* first Huffman code is zero */
-  p = v;			/* grab values in bit order */
-  h = -1;			/* no tables yet--level -1 */
-  w = -l;			/* bits decoded == (l * h) */
-  u[0] = (struct huft *) NULL;	/* just to keep compilers happy */
-  q = (struct huft *) NULL;	/* ditto */
-  z = 0;			/* ditto */
-
-  /* go through the bit lengths (k already is bits in shortest code) */
-  for (; k <= g; k++)
-    {
-      a = c[k];
-      while (a--)
-	{
-	  /* here i is the Huffman code of length k bits for value *p */
-	  /* make tables up to required level */
-	  while (k > w + l)
-	    {
-	      h++;
-	      w += l;		/* previous table always l bits */
-
-	      /* compute minimum size table less than or equal to l bits */
-	      z = (z = (unsigned) (g - w)) > (unsigned) l ? (unsigned) l : z;	/* upper limit on table size */
-	      if ((f = 1 << (j = k - w)) > a + 1)	/* try a k-w bit table */
-		{		/* too few codes for k-w bit table */
-		  f -= a + 1;	/* deduct codes from patterns left */
-		  xp = c + k;
-		  while (++j < z)	/* try smaller tables up to z bits */
-		    {
-		      if ((f <<= 1) <= *++xp)
-			break;	/* enough codes to use up j bits */
-		      f -= *xp;	/* else deduct codes from patterns */
-		    }
-		}
-	      z = 1 << j;	/* table entries for j-bit table */
-
-	      /* allocate and link in new table */
-	      q = (struct huft *) grub_zalloc ((z + 1) * sizeof (struct huft));
-	      if (! q)
-		{
-		  if (h)
-		    huft_free (u[0]);
-		  return 3;
-		}
-
-	      *t = q + 1;	/* link to list for huft_free() */
-	      *(t = &(q->v.t)) = (struct huft *) NULL;
-	      u[h] = ++q;	/* table starts after link */
-
-	      /* connect to last table, if there is one */
-	      if (h)
-		{
-		  x[h] = i;	/* save pattern for backing up */
-		  r.b = (uch) l;	/* bits to dump before this table */
-		  r.e = (uch) (16 + j);		/* bits in this table */
-		  r.v.t = q;	/* pointer to this table */
-		  j = i >> (w - l);	/* (get around Turbo C bug) */
-		  u[h - 1][j] = r;	/* connect to last table */
-		}
-	    }
+        NEEDBITS(j)
+        x = b & mask_bits[j];
+        DUMPBITS(j)
 
-	  /* set up table entry in r */
-	  r.b = (uch) (k - w);
-	  if (p >= v + n)
-	    r.e = 99;		/* out of values--invalid code */
-	  else if (*p < s)
-	    {
-	      r.e = (uch) (*p < 256 ? 16 : 15);		/* 256 is end-of-block code */
-	      r.v.n = (ush) (*p);	/* simple code is just the value */
-	      p++;		/* one compiler does not like *p++ */
-	    }
-	  else
-	    {
-	      r.e = (uch) e[*p - s];	/* non-simple--look up in lists */
-	      r.v.n = d[*p++ - s];
-	    }
+   where NEEDBITS makes sure that b has at least j bits in it, and
+   DUMPBITS removes the bits from b.  The macros use the variable k
+   for the number of bits in b.  */
 
-	  /* fill code-like entries with r */
-	  f = 1 << (k - w);
-	  for (j = i >> w; j < z; j += f)
-	    q[j] = r;
+#define NEEDBITS(n) do {while(k<(n)){b|=((grub_uint64_t)get_byte(gzio))<<k;k+=8;}} while (0)
+#define DUMPBITS(n) do {b>>=(n);k-=(n);} while (0)
 
-	  /* backwards increment the k-bit code i */
-	  for (j = 1 << (k - 1); i & j; j >>= 1)
-	    i ^= j;
-	  i ^= j;
+/* Make sure that the bit buffer has at least 56 bits, for the decoding
+   loops which keep the state in local variables.  With at least eight
+   bytes of input left, load them all at once; the bits loaded past the
+   new count are those of the next byte, which is loaded again later.  */
+#define REFILL()							\
+  do									\
+    {									\
+      if (in_end - in >= 8)						\
+	{								\
+	  b |= grub_le_to_cpu64 (grub_get_unaligned64 (in)) << k;	\
+	  in += (63 - k) >> 3;						\
+	  k |= 56;							\
+	}								\
+      else								\
+	{								\
+	  gzio->in_next = in;						\
+	  gzio->bb = b;							\
+	  gzio->bk = k;							\
+	  refill_slow (gzio);						\
+	  in = gzio->in_next;						\
+	  in_end = gzio->in_end;					\
+	  b = gzio->bb;							\
+	  k = gzio->bk;							\
+	}								\
+    }									\
+  while (0)
+
+
+/* Given a list of code lengths, make the table T to decode that set of
+   codes, with BITS bits for the first level lookup.  Codes below S are
+   literals (256 being end-of-block), the others are lengths or distances
+   with bases D and extra bits E.  SIZE is the room in T.  Return zero on
+   success, one if the given code set is incomplete (the table is still
+   built in this case, with unused entries), two if the input is invalid
+   (an oversubscribed set of lengths), and three if T is too small.  */
 
-	  /* backup over finished tables */
-	  while ((i & ((1 << w) - 1)) != x[h])
-	    {
-	      h--;		/* don't need to update q */
-	      w -= l;
-	    }
-	}
+static int
+huft_build (const uch *b,	/* code lengths in bits (all <= BMAX) */
+	    unsigned n,		/* number of codes (<= N_MAX) */
+	    unsigned s,		/* number of simple-valued codes (0..s-1) */
+	    const ush *d,	/* list of base values for non-simple codes */
+	    const ush *e,	/* list of extra bits for non-simple codes */
+	    struct huft *t,	/* result: the table */
+	    unsigned bits,	/* first level lookup bits */
+	    unsigned size)	/* number of entries in t */
+{
+  unsigned count[BMAX + 1];	/* codes of each length */
+  unsigned offs[BMAX + 1];	/* offsets of each length in v */
+  ush v[N_MAX];			/* values in order of bit length */
+  unsigned i, j, k, g, c, rev, sub, subbits, next, prefix;
+  int left;
+  struct huft r, unused = { E_BAD, 1, 0 };
+
+  grub_memset (count, 0, sizeof (count));
+  for (i = 0; i < n; i++)
+    count[b[i]]++;
+  count[0] = 0;
+
+  for (g = BMAX; g && ! count[g]; g--);
+
+  /* Check for an oversubscribed set of lengths.  */
+  left = 1;
+  for (k = 1; k <= BMAX; k++)
+    {
+      left <<= 1;
+      left -= count[k];
+      if (left < 0)
+	return 2;
     }
 
+  /* Sort the values by bit length, keeping their order otherwise.  */
+  offs[1] = 0;
+  for (k = 1; k < BMAX; k++)
+    offs[k + 1] = offs[k] + count[k];
+  for (i = 0; i < n; i++)
+    if (b[i])
+      v[offs[b[i]]++] = i;
+
+  for (j = 0; j < (1U << bits); j++)
+    t[j] = unused;
+
+  /* Assign the canonical codes in order.  Deflate sends them starting from
+     the most significant bit, so the lookup index is the reversed code.  */
+  next = 1 << bits;
+  prefix = ~0U;
+  sub = 0;
+  subbits = 0;
+  c = 0;
+  i = 0;
+  for (k = 1; k <= g; k++, c <<= 1)
+    for (j = count[k]; j; j--, c++, i++)
+      {
+	unsigned step, end, x;
+
+	for (rev = 0, x = 0; x < k; x++)
+	  rev |= ((c >> x) & 1) << (k - 1 - x);
+
+	if (v[i] < s)
+	  {
+	    r.e = v[i] == 256 ? E_EOB : E_LIT;
+	    r.v = v[i];
+	  }
+	else if (e[v[i] - s] == 99)
+	  {
+	    r.e = E_BAD;
+	    r.v = 0;
+	  }
+	else
+	  {
+	    r.e = e[v[i] - s];
+	    r.v = d[v[i] - s];
+	  }
+
+	if (k <= bits)
+	  {
+	    r.b = k;
+	    for (x = rev; x < (1U << bits); x += 1 << k)
+	      t[x] = r;
+	    continue;
+	  }
+
+	/* The codes sharing their first BITS bits are adjacent, so start a
+	   second level table when these change.  Make it large enough for
+	   the remaining codes with this prefix.  */
+	if ((rev & ((1 << bits) - 1)) != prefix)
+	  {
+	    int l = 1 << (k - bits);
+	    unsigned m;
+
+	    prefix = rev & ((1 << bits) - 1);
+	    subbits = k - bits;
+	    for (m = k; m < g; m++)
+	      {
+		l -= count[m] - (m == k ? count[k] - j : 0);
+		if (l <= 0)
+		  break;
+		subbits++;
+		l <<= 1;
+	      }
+
+	    sub = next;
+	    next += 1 << subbits;
+	    if (next > size)
+	      return 3;
+	    for (x = sub; x < next; x++)
+	      t[x] = unused;
+
+	    t[prefix].e = 16 + subbits;
+	    t[prefix].b = bits;
+	    t[prefix].v = sub;
+	  }
+
+	r.b = k - bits;
+	step = 1 << (k - bits);
+	end = 1 << subbits;
+	for (x = rev >> bits; x < end; x += step)
+	  t[sub + x] = r;
+      }
+
   /* Return true (1) if we were given an incomplete table */
-  return y != 0 && g != 1;
+  return left != 0 && g > 1;
 }
 
-
-/* Free the malloc'ed tables built by huft_build(), which makes a linked
-   list of the tables it made, with the links in a dummy first entry of
-   each table.  */
-static int
-huft_free (struct huft *t)
+/* Merge the first level entries of the literal/length table T which hold
+   a short literal with the entry for the literal following it, if its
+   code fits into the remaining bits.  Entries are only ever merged with
+   ones at a lower index, so going downwards reads unmerged ones.  */
+static void
+huft_pair_literals (struct huft *t, unsigned bits)
 {
-  register struct huft *p, *q;
-
+  unsigned i;
 
-  /* Go through linked list, freeing from the malloced (t[-1]) address. */
-  p = t;
-  while (p != (struct huft *) NULL)
+  for (i = 1 << bits; i--; )
     {
-      q = (--p)->v.t;
-      grub_free ((char *) p);
-      p = q;
+      struct huft *f = &t[i], *s;
+
+      if (f->e != E_LIT || f->b >= bits)
+	continue;
+      s = &t[i >> f->b];
+      if (s->e != E_LIT || f->b + s->b > bits)
+	continue;
+      f->v |= s->v << 8;
+      f->e = E_PAIR + f->b;
+      f->b += s->b;
     }
-  return 0;
 }
 
 
+/* Copy the match in progress, INFLATE_N bytes from INFLATE_D bytes back,
+   to OUT, not going past END.  The output starting at START precedes OUT,
+   anything before it is in the slide.  Return the new output position.  */
+static grub_uint8_t *
+copy_match (grub_gzio_t gzio, grub_uint8_t *out, grub_uint8_t *start,
+	    grub_uint8_t *end)
+{
+  unsigned n = gzio->inflate_n;
+  unsigned d = gzio->inflate_d;
+
+  while (n && out < end)
+    {
+      grub_size_t e = end - out;
+      grub_size_t have = out - start;
+
+      if (d <= have)
+	{
+	  grub_uint8_t *src = out - d;
+
+	  if (e > n)
+	    e = n;
+	  n -= e;
+	  if (d >= 8)
+	    for (; e >= 8; e -= 8, out += 8, src += 8)
+	      grub_set_unaligned64 (out, grub_get_unaligned64 (src));
+	  /* purposefully use the overlap for extra copies here!! */
+	  while (e--)
+	    *out++ = *src++;
+	}
+      else
+	{
+	  unsigned back = d - have;
+	  unsigned from;
+
+	  if (back > gzio->whave)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "invalid distance too far back");
+	      break;
+	    }
+	  from = (gzio->wp - back) & (WSIZE - 1);
+	  if (e > n)
+	    e = n;
+	  if (e > back)
+	    e = back;
+	  if (e > WSIZE - from)
+	    e = WSIZE - from;
+	  grub_memmove (out, gzio->slide + from, e);
+	  out += e;
+	  n -= e;
+	}
+    }
+
+  gzio->inflate_n = n;
+  return out;
+}
+
 /*
- *  inflate (decompress) the codes in a deflated (compressed) block.
- *  Return an error code or zero if it all goes ok.
+ *  inflate (decompress) the codes in a deflated (compressed) block into
+ *  OUT, until END is reached or the block ends.  Return the new output
+ *  position.
  */
 
-static int
-inflate_codes_in_window (grub_gzio_t gzio)
+static grub_uint8_t *
+inflate_codes (grub_gzio_t gzio, grub_uint8_t *out, grub_uint8_t *start,
+	       grub_uint8_t *end)
 {
   register unsigned e;		/* table entry flag/number of extra bits */
-  unsigned n, d;		/* length and index for copy */
-  unsigned w;			/* current window position */
-  struct huft *t;		/* pointer to table entry */
+  unsigned n, d;		/* length and distance for copy */
+  const struct huft *t;		/* pointer to table entry */
   unsigned ml, md;		/* masks for bl and bd bits */
-  register ulg b;		/* bit buffer */
+  register grub_uint64_t b;	/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
+  const grub_uint8_t *in, *in_end;
+
+  /* finish the copy interrupted by a full output buffer */
+  if (gzio->inflate_n)
+    {
+      out = copy_match (gzio, out, start, end);
+      if (gzio->inflate_n || grub_errno != GRUB_ERR_NONE)
+	return out;
+    }
 
   /* make local copies of globals */
-  d = gzio->inflate_d;
-  n = gzio->inflate_n;
-  b = gzio->bb;			/* initialize bit buffer */
+  b = gzio->bb;
   k = gzio->bk;
-  w = gzio->wp;			/* initialize window position */
+  in = gzio->in_next;
+  in_end = gzio->in_end;
 
-  /* inflate the coded data */
-  ml = mask_bits[gzio->bl];		/* precompute masks for speed */
+  ml = mask_bits[gzio->bl];
   md = mask_bits[gzio->bd];
-  for (;;)			/* do until end of block */
+  while (out < end)
     {
-      if (! gzio->code_state)
-	{
-	  NEEDBITS ((unsigned) gzio->bl);
-	  if ((e = (t = gzio->tl + ((unsigned) b & ml))->e) > 16)
-	    do
-	      {
-		if (e == 99)
-		  {
-		    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				"an unused code found");
-		    return 1;
-		  }
-		DUMPBITS (t->b);
-		e -= 16;
-		NEEDBITS (e);
-	      }
-	    while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e) > 16);
-	  DUMPBITS (t->b);
+      /* One refill is enough for the longest length/distance pair.  */
+      if (k < 48)
+	REFILL ();
 
-	  if (e == 16)		/* then it's a literal */
+      t = gzio->tl + ((unsigned) b & ml);
+      e = t->e;
+      if (e >= E_PAIR && e < E_PAIR + 16)
+	{
+	  if (end - out >= 2)
 	    {
-	      gzio->slide[w++] = (uch) t->v.n;
-	      if (w == WSIZE)
-		break;
+	      grub_set_unaligned16 (out, grub_cpu_to_le16 (t->v));
+	      out += 2;
+	      DUMPBITS (t->b);
 	    }
 	  else
-	    /* it's an EOB or a length */
 	    {
-	      /* exit if end of block */
-	      if (e == 15)
-		{
-		  gzio->block_len = 0;
-		  break;
-		}
-
-	      /* get length of block to copy */
-	      NEEDBITS (e);
-	      n = t->v.n + ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-
-	      /* decode distance of block to copy */
-	      NEEDBITS ((unsigned) gzio->bd);
-	      if ((e = (t = gzio->td + ((unsigned) b & md))->e) > 16)
-		do
-		  {
-		    if (e == 99)
-		      {
-			grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-				    "an unused code found");
-			return 1;
-		      }
-		    DUMPBITS (t->b);
-		    e -= 16;
-		    NEEDBITS (e);
-		  }
-		while ((e = (t = t->v.t + ((unsigned) b & mask_bits[e]))->e)
-		       > 16);
-	      DUMPBITS (t->b);
-	      NEEDBITS (e);
-	      d = w - t->v.n - ((unsigned) b & mask_bits[e]);
-	      DUMPBITS (e);
-	      gzio->code_state++;
+	      *out++ = (uch) t->v;
+	      DUMPBITS (e - E_PAIR);
 	    }
+	  continue;
+	}
+      if (e > E_LIT && e < E_PAIR)
+	{
+	  DUMPBITS (t->b);
+	  t = gzio->tl + t->v + ((unsigned) b & mask_bits[e - 16]);
+	  e = t->e;
 	}
+      DUMPBITS (t->b);
 
-      if (gzio->code_state)
+      if (e == E_LIT)
 	{
-	  /* do the copy */
-	  do
-	    {
-	      n -= (e = (e = WSIZE - ((d &= WSIZE - 1) > w ? d : w)) > n ? n
-		    : e);
-
-	      if (w - d >= e)
-		{
-		  grub_memmove (gzio->slide + w, gzio->slide + d, e);
-		  w += e;
-		  d += e;
-		}
-	      else
-		/* purposefully use the overlap for extra copies here!! */
-		{
-		  while (e--)
-		    gzio->slide[w++] = gzio->slide[d++];
-		}
-
-	      if (w == WSIZE)
-		break;
-	    }
-	  while (n);
+	  *out++ = (uch) t->v;
+	  continue;
+	}
+      if (e == E_EOB)
+	{
+	  gzio->block_len = 0;
+	  break;
+	}
+      if (e == E_BAD)
+	goto bad;
 
-	  if (! n)
-	    gzio->code_state--;
+      /* get length of block to copy */
+      n = t->v + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
 
-	  /* did we break from the loop too soon? */
-	  if (w == WSIZE)
-	    break;
+      /* decode distance of block to copy */
+      t = gzio->td + ((unsigned) b & md);
+      e = t->e;
+      if (e > E_LIT && e < E_PAIR)
+	{
+	  DUMPBITS (t->b);
+	  t = gzio->td + t->v + ((unsigned) b & mask_bits[e - 16]);
+	  e = t->e;
 	}
+      DUMPBITS (t->b);
+      if (e >= E_EOB)
+	goto bad;
+      d = t->v + ((unsigned) b & mask_bits[e]);
+      DUMPBITS (e);
+
+      /* most matches are within the output and fit, copy those here */
+      if (d <= (grub_size_t) (out - start) && n <= (grub_size_t) (end - out))
+	{
+	  grub_uint8_t *src = out - d;
+
+	  if (d == 1)
+	    {
+	      grub_memset (out, *src, n);
+	      out += n;
+	      continue;
+	    }
+	  if (d >= 8)
+	    for (; n >= 8; n -= 8, out += 8, src += 8)
+	      grub_set_unaligned64 (out, grub_get_unaligned64 (src));
+	  while (n--)
+	    *out++ = *src++;
+	  continue;
+	}
+
+      gzio->inflate_n = n;
+      gzio->inflate_d = d;
+      out = copy_match (gzio, out, start, end);
+      if (grub_errno != GRUB_ERR_NONE)
+	break;
     }
 
   /* restore the globals from the locals */
-  gzio->inflate_d = d;
-  gzio->inflate_n = n;
-  gzio->wp = w;			/* restore global window pointer */
-  gzio->bb = b;			/* restore global bit buffer */
+  gzio->in_next = in;
+  gzio->bb = b;
+  gzio->bk = k;
+
+  return out;
+
+ bad:
+  gzio->in_next = in;
+  gzio->bb = b;
   gzio->bk = k;
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+  return out;
+}
+
+
+/* Copy the stored block data to OUT, until END is reached or the block
+   ends.  Return the new output position.  */
+
+static grub_uint8_t *
+inflate_stored (grub_gzio_t gzio, grub_uint8_t *out, grub_uint8_t *end)
+{
+  /* The bit buffer is at a byte boundary, empty it first.  */
+  while (gzio->block_len && out < end && gzio->bk >= 8)
+    {
+      *out++ = (uch) gzio->bb;
+      gzio->bb >>= 8;
+      gzio->bk -= 8;
+      gzio->block_len--;
+    }
+  if (! gzio->bk)
+    gzio->bb = 0;
+
+  while (gzio->block_len && out < end)
+    {
+      grub_size_t len;
+
+      if (gzio->in_next == gzio->in_end && ! fill_inbuf (gzio))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		      "premature end of compressed");
+	  break;
+	}
+
+      len = gzio->in_end - gzio->in_next;
+      if (len > (grub_size_t) gzio->block_len)
+	len = gzio->block_len;
+      if (len > (grub_size_t) (end - out))
+	len = end - out;
+      grub_memcpy (out, gzio->in_next, len);
+      gzio->in_next += len;
+      out += len;
+      gzio->block_len -= len;
+    }
 
-  return ! gzio->block_len;
+  return out;
 }
 
 
@@ -783,7 +887,7 @@ inflate_codes_in_window (grub_gzio_t gzio)
 static void
 init_stored_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
+  register grub_uint64_t b;	/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
   /* make local copies of globals */
@@ -809,15 +913,20 @@ init_stored_block (grub_gzio_t gzio)
 }
 
 
-/* get header for an inflated type 1 (fixed Huffman codes) block.  We should
-   either replace this with a custom decoder, or at least precompute the
-   Huffman tables. */
+/* get header for an inflated type 1 (fixed Huffman codes) block.  The
+   tables stay around, so consecutive fixed blocks only build them once. */
 
 static void
 init_fixed_block (grub_gzio_t gzio)
 {
   int i;			/* temporary variable */
-  unsigned l[288];		/* length list for huft_build */
+  uch l[288];			/* length list for huft_build */
+
+  if (gzio->fixed_tables)
+    {
+      gzio->block_len++;
+      return;
+    }
 
   /* set up literal table */
   for (i = 0; i < 144; i++)
@@ -828,31 +937,29 @@ init_fixed_block (grub_gzio_t gzio)
     l[i] = 7;
   for (; i < 288; i++)		/* make a complete, but wrong code set */
     l[i] = 8;
-  gzio->bl = 7;
-  if (huft_build (l, 288, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  gzio->bl = LBITS;
+  if (huft_build (l, 288, 257, cplens, cplext, gzio->tl, LBITS,
+		  LENOUGH) != 0)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
       return;
     }
+  huft_pair_literals (gzio->tl, LBITS);
 
   /* set up distance table */
   for (i = 0; i < 30; i++)	/* make an incomplete code set */
     l[i] = 5;
-  gzio->bd = 5;
-  if (huft_build (l, 30, 0, cpdist, cpdext, &gzio->td, &gzio->bd) > 1)
+  gzio->bd = DBITS;
+  if (huft_build (l, 30, 0, cpdist, cpdext, gzio->td, DBITS, DENOUGH) > 1)
     {
-      if (grub_errno == GRUB_ERR_NONE)
-	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-		    "failed in building a Huffman code table");
-      huft_free (gzio->tl);
-      gzio->tl = 0;
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		  "failed in building a Huffman code table");
       return;
     }
 
   /* indicate we're now working on a block */
-  gzio->code_state = 0;
+  gzio->fixed_tables = 1;
   gzio->block_len++;
 }
 
@@ -865,15 +972,18 @@ init_dynamic_block (grub_gzio_t gzio)
   int i;			/* temporary variables */
   unsigned j;
   unsigned l;			/* last length */
-  unsigned m;			/* mask for bit lengths table */
   unsigned n;			/* number of lengths to get */
   unsigned nb;			/* number of bit length codes */
   unsigned nl;			/* number of literal/length codes */
   unsigned nd;			/* number of distance codes */
-  unsigned ll[286 + 30];	/* literal/length and distance code lengths */
-  register ulg b;		/* bit buffer */
+  uch ll[286 + 30];		/* literal/length and distance code lengths */
+  struct huft *t;		/* bit length code table entry */
+  register grub_uint64_t b;	/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
+  /* The tables get overwritten.  */
+  gzio->fixed_tables = 0;
+
   /* make local bit buffer */
   b = gzio->bb;
   k = gzio->bk;
@@ -905,8 +1015,7 @@ init_dynamic_block (grub_gzio_t gzio)
     ll[bitorder[j]] = 0;
 
   /* build decoding table for trees--single level, 7 bit lookup */
-  gzio->bl = 7;
-  if (huft_build (ll, 19, 19, NULL, NULL, &gzio->tl, &gzio->bl) != 0)
+  if (huft_build (ll, 19, 19, NULL, NULL, gzio->tl, CBITS, LENOUGH) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
@@ -915,14 +1024,18 @@ init_dynamic_block (grub_gzio_t gzio)
 
   /* read in literal and distance code lengths */
   n = nl + nd;
-  m = mask_bits[gzio->bl];
   i = l = 0;
   while ((unsigned) i < n)
     {
-      NEEDBITS ((unsigned) gzio->bl);
-      j = (gzio->td = gzio->tl + ((unsigned) b & m))->b;
-      DUMPBITS (j);
-      j = gzio->td->v.n;
+      NEEDBITS (CBITS);
+      t = gzio->tl + ((unsigned) b & mask_bits[CBITS]);
+      if (t->e == E_BAD)
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "an unused code found");
+	  return;
+	}
+      DUMPBITS (t->b);
+      j = t->v;
       if (j < 16)		/* length of code in bits (0..15) */
 	ll[i++] = l = j;	/* save last length in l */
       else if (j == 16)		/* repeat last length 3 to 6 times */
@@ -969,35 +1082,30 @@ init_dynamic_block (grub_gzio_t gzio)
 	}
     }
 
-  /* free decoding table for trees */
-  huft_free (gzio->tl);
-  gzio->td = 0;
-  gzio->tl = 0;
-
   /* restore the global bit buffer */
   gzio->bb = b;
   gzio->bk = k;
 
   /* build the decoding tables for literal/length and distance codes */
-  gzio->bl = lbits;
-  if (huft_build (ll, nl, 257, cplens, cplext, &gzio->tl, &gzio->bl) != 0)
+  gzio->bl = LBITS;
+  if (huft_build (ll, nl, 257, cplens, cplext, gzio->tl, LBITS,
+		  LENOUGH) != 0)
     {
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
-  gzio->bd = dbits;
-  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, &gzio->td, &gzio->bd) != 0)
+  huft_pair_literals (gzio->tl, LBITS);
+  gzio->bd = DBITS;
+  if (huft_build (ll + nl, nd, 0, cpdist, cpdext, gzio->td, DBITS,
+		  DENOUGH) != 0)
     {
-      huft_free (gzio->tl);
-      gzio->tl = 0;
       grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
 		  "failed in building a Huffman code table");
       return;
     }
 
   /* indicate we're now working on a block */
-  gzio->code_state = 0;
   gzio->block_len++;
 }
 
@@ -1005,7 +1113,7 @@ init_dynamic_block (grub_gzio_t gzio)
 static void
 get_new_block (grub_gzio_t gzio)
 {
-  register ulg b;		/* bit buffer */
+  register grub_uint64_t b;	/* bit buffer */
   register unsigned k;		/* number of bits in bit buffer */
 
   /* make local bit buffer */
@@ -1043,23 +1151,166 @@ get_new_block (grub_gzio_t gzio)
 }
 
 
+/* Remember the LEN bytes of uncompressed data just written to OUT in the
+   slide, unless they were written there in the first place.  */
 static void
-inflate_window (grub_gzio_t gzio)
+update_window (grub_gzio_t gzio, const grub_uint8_t *out, grub_size_t len)
 {
-  /* initialize window */
-  gzio->wp = 0;
+  if (out != gzio->slide + gzio->wp)
+    {
+      grub_size_t part;
+
+      if (len >= WSIZE)
+	{
+	  out += len - WSIZE;
+	  len = WSIZE;
+	  gzio->wp = 0;
+	}
+      part = WSIZE - gzio->wp;
+      if (part > len)
+	part = len;
+      grub_memcpy (gzio->slide + gzio->wp, out, part);
+      grub_memcpy (gzio->slide, out + part, len - part);
+    }
+
+  gzio->wp = (gzio->wp + len) & (WSIZE - 1);
+  if (gzio->whave + len >= WSIZE)
+    gzio->whave = WSIZE;
+  else
+    gzio->whave += len;
+}
+
+
+/* Account for the LEN bytes of uncompressed data just written to OUT.  */
+static void
+flush_output (grub_gzio_t gzio, const grub_uint8_t *out, grub_size_t len)
+{
+  update_window (gzio, out, len);
+  gzio->saved_offset += len;
+
+  if (gzio->hcontext)
+    {
+      gzio->hdesc->write (gzio->hcontext, out, len);
+
+      if (len && gzio->saved_offset == gzio->orig_len)
+	{
+	  grub_uint32_t csum;
+
+	  gzio->hdesc->final (gzio->hcontext);
+	  csum = grub_get_unaligned32 (gzio->hdesc->read (gzio->hcontext));
+	  csum = grub_be_to_cpu32 (csum);
+	  if (csum != gzio->orig_checksum)
+	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			"checksum mismatch %08x/%08x",
+			gzio->orig_checksum, csum);
+	}
+    }
+}
+
+/* Record a checkpoint at the current position, which must be a block
+   boundary with the output flushed.  Checkpoints are only an
+   optimization, so failing to allocate one is not an error.  */
+static void
+add_checkpoint (grub_gzio_t gzio)
+{
+  struct grub_gzio_checkpoint *cp;
+  grub_size_t csize = gzio->hcontext ? gzio->hdesc->contextsize : 0;
+  unsigned i, pos;
+
+  if (gzio->num_checkpoints == MAX_CHECKPOINTS)
+    {
+      for (i = 0; i < MAX_CHECKPOINTS / 2; i++)
+	{
+	  grub_free (gzio->checkpoints[2 * i]);
+	  gzio->checkpoints[i] = gzio->checkpoints[2 * i + 1];
+	}
+      gzio->num_checkpoints = MAX_CHECKPOINTS / 2;
+      gzio->checkpoint_spacing *= 2;
+    }
+
+  gzio->checkpoint_next = gzio->saved_offset + gzio->checkpoint_spacing;
+
+  cp = grub_malloc (sizeof (*cp) + csize);
+  if (! cp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  cp->offset = gzio->saved_offset;
+  cp->in_bits = gzio_tell_bits (gzio);
+  cp->whave = gzio->whave;
+  pos = (gzio->wp - gzio->whave) & (WSIZE - 1);
+  i = WSIZE - pos;
+  if (i > cp->whave)
+    i = cp->whave;
+  grub_memcpy (cp->window, gzio->slide + pos, i);
+  grub_memcpy (cp->window + i, gzio->slide, cp->whave - i);
+  if (csize)
+    grub_memcpy (cp->hcontext, gzio->hcontext, csize);
+
+  gzio->checkpoints[gzio->num_checkpoints++] = cp;
+}
+
+/* Resume decompression from the checkpoint CP.  */
+static void
+restore_checkpoint (grub_gzio_t gzio, struct grub_gzio_checkpoint *cp)
+{
+  unsigned skip = cp->in_bits & 7;
+
+  gzio_seek (gzio, cp->in_bits >> 3);
+  gzio->bb = 0;
+  gzio->bk = 0;
+  gzio->in_pad = 0;
+  if (skip)
+    {
+      gzio->bb = get_byte (gzio) >> skip;
+      gzio->bk = 8 - skip;
+    }
+
+  gzio->last_block = 0;
+  gzio->block_len = 0;
+  gzio->inflate_n = 0;
+  gzio->fixed_tables = 0;
+
+  grub_memcpy (gzio->slide, cp->window, cp->whave);
+  gzio->whave = cp->whave;
+  gzio->wp = cp->whave & (WSIZE - 1);
+  gzio->saved_offset = cp->offset;
+
+  if (gzio->hcontext)
+    grub_memcpy (gzio->hcontext, cp->hcontext, gzio->hdesc->contextsize);
+}
+
+/* Decompress up to LEN bytes to OUT, which may be either the caller's
+   buffer or the free part of the slide.  Return the number of bytes
+   decompressed, less than LEN only at the end of data or on error.  */
+static grub_size_t
+inflate_data (grub_gzio_t gzio, grub_uint8_t *out, grub_size_t len)
+{
+  grub_uint8_t *start = out, *end = out + len;
+  /* The output not accounted for by flush_output yet.  */
+  grub_uint8_t *pending = out;
 
   /*
    *  Main decompression loop.
    */
 
-  while (gzio->wp < WSIZE && grub_errno == GRUB_ERR_NONE)
+  while (out < end && grub_errno == GRUB_ERR_NONE)
     {
       if (! gzio->block_len)
 	{
 	  if (gzio->last_block)
 	    break;
 
+	  if (gzio->checkpoint_spacing
+	      && gzio->saved_offset + (out - pending) >= gzio->checkpoint_next)
+	    {
+	      flush_output (gzio, pending, out - pending);
+	      pending = out;
+	      add_checkpoint (gzio);
+	    }
+
 	  get_new_block (gzio);
 	}
 
@@ -1068,62 +1319,22 @@ inflate_window (grub_gzio_t gzio)
 		    "unknown block type %d", gzio->block_type);
 
       if (grub_errno != GRUB_ERR_NONE)
-	return;
+	break;
 
-      /*
-       *  Expand stored block here.
-       */
       if (gzio->block_type == INFLATE_STORED)
-	{
-	  int w = gzio->wp;
-
-	  /*
-	   *  This is basically a glorified pass-through
-	   */
-
-	  while (gzio->block_len && w < WSIZE && grub_errno == GRUB_ERR_NONE)
-	    {
-	      gzio->slide[w++] = get_byte (gzio);
-	      gzio->block_len--;
-	    }
-
-	  gzio->wp = w;
-
-	  continue;
-	}
-
-      /*
-       *  Expand other kind of block.
-       */
+	out = inflate_stored (gzio, out, end);
+      else
+	out = inflate_codes (gzio, out, pending, end);
 
-      if (inflate_codes_in_window (gzio))
-	{
-	  huft_free (gzio->tl);
-	  huft_free (gzio->td);
-	  gzio->tl = 0;
-	  gzio->td = 0;
-	}
+      /* The padding was used, so the data is cut short.  */
+      if (gzio->bk < gzio->in_pad * 8)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    "premature end of compressed");
     }
 
-  gzio->saved_offset += gzio->wp;
+  flush_output (gzio, pending, out - pending);
 
-  if (gzio->hcontext)
-    {
-      gzio->hdesc->write (gzio->hcontext, gzio->slide, gzio->wp);
-
-      if (gzio->saved_offset == gzio->orig_len)
-	{
-	  grub_uint32_t csum;
-
-	  gzio->hdesc->final (gzio->hcontext);
-	  csum = grub_get_unaligned32 (gzio->hdesc->read (gzio->hcontext));
-	  csum = grub_be_to_cpu32 (csum);
-	  if (csum != gzio->orig_checksum)
-	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
-			"checksum mismatch %08x/%08x",
-			gzio->orig_checksum, csum);
-	}
-    }
+  return out - start;
 }
 
 
@@ -1136,16 +1347,17 @@ initialize_tables (grub_gzio_t gzio)
   /* Initialize the bit buffer.  */
   gzio->bk = 0;
   gzio->bb = 0;
+  gzio->in_pad = 0;
 
   /* Reset partial decompression code.  */
   gzio->last_block = 0;
   gzio->block_len = 0;
+  gzio->inflate_n = 0;
+  gzio->fixed_tables = 0;
 
-  /* Reset memory allocation stuff.  */
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
-  gzio->tl = NULL;
-  gzio->td = NULL;
+  /* Empty the window.  */
+  gzio->wp = 0;
+  gzio->whave = 0;
 
   if (gzio->hcontext)
     gzio->hdesc->init(gzio->hcontext);
@@ -1179,6 +1391,8 @@ grub_gzio_open (grub_file_t io, enum grub_file_type type)
 
   gzio->hdesc = GRUB_MD_CRC32;
   gzio->hcontext = grub_malloc(gzio->hdesc->contextsize);
+  gzio->checkpoint_spacing = CHECKPOINT_SPACING;
+  gzio->checkpoint_next = CHECKPOINT_SPACING;
 
   file->device = io->device;
   file->data = gzio;
@@ -1251,43 +1465,77 @@ test_zlib_header (grub_gzio_t gzio)
   return 1;
 }
 
+/* Prepare for reading at OFFSET, which is not in the slide: resume from
+   the last checkpoint before it, or from the beginning, unless going
+   on from the current position is quicker.  */
+static void
+gzio_resume (grub_gzio_t gzio, grub_off_t offset)
+{
+  struct grub_gzio_checkpoint *cp = NULL;
+  unsigned i;
+
+  for (i = 0; i < gzio->num_checkpoints
+	 && gzio->checkpoints[i]->offset <= offset; i++)
+    cp = gzio->checkpoints[i];
+
+  if (offset > gzio->saved_offset)
+    {
+      if (cp && cp->offset > gzio->saved_offset)
+	restore_checkpoint (gzio, cp);
+    }
+  else if (cp)
+    restore_checkpoint (gzio, cp);
+  else
+    initialize_tables (gzio);
+}
+
 static grub_ssize_t
 grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
 		     char *buf, grub_size_t len)
 {
   grub_ssize_t ret = 0;
 
-  /* Do we reset decompression to the beginning of the file?  */
-  if (gzio->saved_offset > offset + WSIZE)
-    initialize_tables (gzio);
+  /* Do we resume decompression elsewhere?  */
+  if (offset + gzio->whave < gzio->saved_offset
+      || offset > gzio->saved_offset)
+    gzio_resume (gzio, offset);
 
   /*
-   *  This loop operates upon uncompressed data only.  The only
-   *  special thing it does is to make sure the decompression
-   *  window is within the range of data it needs.
+   *  This loop operates upon uncompressed data only.  Data still in the
+   *  slide is copied from there, large reads at the current position are
+   *  decompressed straight into BUF, and anything else goes through the
+   *  slide.
    */
 
   while (len > 0 && grub_errno == GRUB_ERR_NONE)
     {
-      register grub_size_t size;
-      register char *srcaddr;
+      grub_size_t size;
 
-      while (offset >= gzio->saved_offset)
+      if (offset < gzio->saved_offset)
 	{
-	  inflate_window (gzio);
-	  if (gzio->wp == 0)
-	    goto out;
+	  grub_size_t back = gzio->saved_offset - offset;
+	  unsigned pos = (gzio->wp - back) & (WSIZE - 1);
+
+	  size = WSIZE - pos;
+	  if (size > back)
+	    size = back;
+	  if (size > len)
+	    size = len;
+	  grub_memcpy (buf, gzio->slide + pos, size);
+	}
+      else if (offset == gzio->saved_offset && len >= DIRECT_SIZE)
+	{
+	  size = inflate_data (gzio, (grub_uint8_t *) buf, len);
+	  if (size == 0)
+	    break;
+	}
+      else
+	{
+	  if (inflate_data (gzio, gzio->slide + gzio->wp,
+			    WSIZE - gzio->wp) == 0)
+	    break;
+	  continue;
 	}
-
-      if (gzio->wp == 0)
-	goto out;
-
-      srcaddr = (char *) ((offset & (WSIZE - 1)) + gzio->slide);
-      size = gzio->saved_offset - offset;
-      if (size > len)
-	size = len;
-
-      grub_memmove (buf, srcaddr, size);
 
       buf += size;
       len -= size;
@@ -1295,7 +1543,6 @@ grub_gzio_read_real (grub_gzio_t gzio, grub_off_t offset,
       offset += size;
     }
 
- out:
   if (grub_errno != GRUB_ERR_NONE)
     ret = -1;
 
@@ -1321,10 +1568,11 @@ static grub_err_t
 grub_gzio_close (grub_file_t file)
 {
   grub_gzio_t gzio = file->data;
+  unsigned i;
 
   grub_file_close (gzio->file);
-  huft_free (gzio->tl);
-  huft_free (gzio->td);
+  for (i = 0; i < gzio->num_checkpoints; i++)
+    grub_free (gzio->checkpoints[i]);
   grub_free (gzio->hcontext);
   grub_free (gzio);
 
@@ -1347,7 +1595,8 @@ grub_zlib_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
     return -1;
   gzio->mem_input = (grub_uint8_t *) inbuf;
   gzio->mem_input_size = insize;
-  gzio->mem_input_off = 0;
+  gzio->in_next = gzio->mem_input;
+  gzio->in_end = gzio->mem_input + insize;
 
   if (!test_zlib_header (gzio))
     {
@@ -1374,7 +1623,6 @@ grub_deflate_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
     return -1;
   gzio->mem_input = (grub_uint8_t *) inbuf;
   gzio->mem_input_size = insize;
-  gzio->mem_input_off = 0;
 
   initialize_tables (gzio);
 
@@ -33,6 +33,28 @@ GRUB_MOD_LICENSE ("GPLv3+");
 #define VLI_MAX_DIGITS 9
 #define XZ_STREAM_FOOTER_SIZE 12
 
+/* Blocks of up to XZIO_CACHE_BLOCK_SIZE bytes are decoded whole and the
+   last XZIO_CACHE_BLOCKS of them are kept.  */
+#define XZIO_CACHE_BLOCK_SIZE (1 << 20)
+#define XZIO_CACHE_BLOCKS 4
+
+/* A Block of the Stream, as described by the Index.  */
+struct grub_xzio_block
+{
+  /* Offset of the Block Header in the compressed file.  */
+  grub_off_t in_offset;
+  /* Offset and size of the Block data in the uncompressed file.  */
+  grub_off_t offset;
+  grub_uint64_t size;
+};
+
+struct grub_xzio_cache_entry
+{
+  grub_size_t block;
+  grub_uint8_t *data;
+  unsigned long last_use;
+};
+
 struct grub_xzio
 {
   grub_file_t file;
@@ -41,6 +63,14 @@ struct grub_xzio
   grub_uint8_t inbuf[XZBUFSIZ];
   grub_uint8_t outbuf[XZBUFSIZ];
   grub_off_t saved_offset;
+  /* The Blocks from the Index, or NULL if the decoder runs over the whole
+     Stream.  In that case seeking back starts over.  */
+  struct grub_xzio_block *blocks;
+  grub_size_t num_blocks;
+  /* The Block the decoder is in.  */
+  grub_size_t block;
+  struct grub_xzio_cache_entry cache[XZIO_CACHE_BLOCKS];
+  unsigned long cache_use;
 };
 
 typedef struct grub_xzio *grub_xzio_t;
@@ -70,22 +100,6 @@ decode_vli (const grub_uint8_t buf[], grub_size_t size_max,
   return i;
 }
 
-static grub_ssize_t
-read_vli (grub_file_t file, grub_uint64_t *num)
-{
-  grub_uint8_t buf[VLI_MAX_DIGITS];
-  grub_ssize_t read_bytes;
-  grub_size_t dec;
-
-  read_bytes = grub_file_read (file, buf, VLI_MAX_DIGITS);
-  if (read_bytes < 0)
-    return -1;
-
-  dec = decode_vli (buf, read_bytes, num);
-  grub_file_seek (file, file->offset - (read_bytes - dec));
-  return dec;
-}
-
 /* Function xz_dec_run() should consume header and ask for more (XZ_OK)
  * else file is corrupted (or options not supported) or not xz.  */
 static int
@@ -111,18 +125,93 @@ test_header (grub_file_t file)
   return 1;
 }
 
-/* Try to find out size of uncompressed data,
- * also do some footer sanity checks.  */
+/* Find the Blocks of the Stream from the Index in BUF, which holds SIZE
+   bytes from the Index Indicator on, and which ends at INDEX_OFFSET in the
+   compressed file.  Failing to do so is not an error as long as the file
+   size can be determined, the file can still be read sequentially.  */
+static int
+parse_index (grub_file_t file, const grub_uint8_t *buf, grub_size_t size,
+	     grub_off_t index_offset)
+{
+  grub_xzio_t xzio = file->data;
+  grub_uint64_t records, unpadded, uncompressed;
+  grub_uint64_t total = 0;
+  grub_off_t in_offset = STREAM_HEADER_SIZE;
+  struct grub_xzio_block *blocks = NULL;
+  grub_size_t pos = 1, dec, i;
+
+  dec = decode_vli (buf + pos, size - pos, &records);
+  if (dec == 0)
+    return 0;
+  pos += dec;
+
+  /* Every Record takes at least two bytes.  */
+  if (records <= (size - pos) / 2)
+    blocks = grub_malloc (records * sizeof (*blocks));
+
+  for (i = 0; i < records; i++)
+    {
+      dec = decode_vli (buf + pos, size - pos, &unpadded);
+      if (dec == 0)
+	goto ERROR;
+      pos += dec;
+      dec = decode_vli (buf + pos, size - pos, &uncompressed);
+      if (dec == 0)
+	goto ERROR;
+      pos += dec;
+
+      if (total + uncompressed < total)
+	goto ERROR;
+
+      if (blocks && (unpadded == 0 || unpadded > index_offset - in_offset))
+	{
+	  grub_free (blocks);
+	  blocks = NULL;
+	}
+
+      if (blocks)
+	{
+	  blocks[i].in_offset = in_offset;
+	  blocks[i].offset = total;
+	  blocks[i].size = uncompressed;
+	  in_offset += ALIGN_UP (unpadded, 4);
+	}
+
+      total += uncompressed;
+    }
+
+  file->size = total;
+
+  /* Only use the Blocks if they account for everything before the Index,
+     which is not the case with several concatenated Streams.  */
+  if (blocks && in_offset == index_offset)
+    {
+      xzio->blocks = blocks;
+      xzio->num_blocks = records;
+      xz_dec_reset_block (xzio->dec);
+    }
+  else
+    grub_free (blocks);
+
+  grub_errno = GRUB_ERR_NONE;
+  return 1;
+
+ERROR:
+  grub_free (blocks);
+  return 0;
+}
+
+/* Try to find out size of uncompressed data and the location of the
+ * Blocks, also do some footer sanity checks.  */
 static int
 test_footer (grub_file_t file)
 {
   grub_xzio_t xzio = file->data;
   grub_uint8_t footer[FOOTER_MAGIC_SIZE];
   grub_uint32_t backsize;
-  grub_uint8_t imarker;
-  grub_uint64_t uncompressed_size_total = 0;
-  grub_uint64_t uncompressed_size;
-  grub_uint64_t records;
+  grub_off_t index_offset;
+  grub_uint8_t *index;
+  int ret;
 
   grub_file_seek (xzio->file, xzio->file->size - FOOTER_MAGIC_SIZE);
   if (grub_file_read (xzio->file, footer, FOOTER_MAGIC_SIZE)
@@ -137,30 +226,29 @@ test_footer (grub_file_t file)
 
   /* Calculate real backward size.  */
   backsize = (grub_le_to_cpu32 (backsize) + 1) * 4;
-
-  /* Set file to the beginning of stream index.  */
-  grub_file_seek (xzio->file,
-		  xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize);
-
-  /* Test index marker.  */
-  if (grub_file_read (xzio->file, &imarker, sizeof (imarker))
-      != sizeof (imarker) && imarker != 0x00)
+  if (backsize < 8 || xzio->file->size < XZ_STREAM_FOOTER_SIZE
+      + STREAM_HEADER_SIZE + backsize)
     goto ERROR;
 
-  if (read_vli (xzio->file, &records) <= 0)
+  /* Read the whole stream index, without the CRC32 at its end.  */
+  index_offset = xzio->file->size - XZ_STREAM_FOOTER_SIZE - backsize;
+  index = grub_malloc (backsize - 4);
+  if (!index)
     goto ERROR;
 
-  for (; records != 0; records--)
+  grub_file_seek (xzio->file, index_offset);
+  if (grub_file_read (xzio->file, index, backsize - 4) != backsize - 4
+      || index[0] != 0x00)
     {
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Ignore unpadded.  */
-	goto ERROR;
-      if (read_vli (xzio->file, &uncompressed_size) <= 0)	/* Uncompressed.  */
-	goto ERROR;
-
-      uncompressed_size_total += uncompressed_size;
+      grub_free (index);
+      goto ERROR;
     }
 
-  file->size = uncompressed_size_total;
+  ret = parse_index (file, index, backsize - 4, index_offset);
+  grub_free (index);
+  if (!ret)
+    goto ERROR;
+
   grub_file_seek (xzio->file, STREAM_HEADER_SIZE);
   return 1;
 
@@ -228,34 +316,32 @@ grub_xzio_open (grub_file_t io, enum grub_file_type type)
   return file;
 }
 
+/* Decode up to LEN bytes to OUT.  When decoding Blocks, stop at the end
+   of the current one, and at its end also consume its Check field and move
+   on to the next Block.  Return the number of bytes decoded, or -1 on
+   error.  */
 static grub_ssize_t
-grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+xzio_decode (grub_xzio_t xzio, grub_uint8_t *out, grub_size_t len)
 {
-  grub_ssize_t ret = 0;
+  grub_off_t block_end = 0;
   grub_ssize_t readret;
   enum xz_ret xzret;
-  grub_xzio_t xzio = file->data;
-  grub_off_t current_offset;
 
-  /* If seek backward need to reset decoder and start from beginning of file.
-     TODO Possible improvement by jumping blocks.  */
-  if (file->offset < xzio->saved_offset)
+  if (xzio->blocks)
     {
-      xz_dec_reset (xzio->dec);
-      xzio->saved_offset = 0;
-      xzio->buf.out_pos = 0;
-      xzio->buf.in_pos = 0;
-      xzio->buf.in_size = 0;
-      grub_file_seek (xzio->file, 0);
+      block_end = (xzio->blocks[xzio->block].offset
+		   + xzio->blocks[xzio->block].size);
+      if (len > block_end - xzio->saved_offset)
+	len = block_end - xzio->saved_offset;
     }
 
-  current_offset = xzio->saved_offset;
+  xzio->buf.out = out;
+  xzio->buf.out_pos = 0;
+  xzio->buf.out_size = len;
 
-  while (len > 0)
+  while (xzio->buf.out_pos < len
+	 || (xzio->blocks && xzio->saved_offset + len == block_end))
     {
-      xzio->buf.out_size = file->offset + ret + len - current_offset;
-      if (xzio->buf.out_size > XZBUFSIZ)
-	xzio->buf.out_size = XZBUFSIZ;
       /* Feed input.  */
       if (xzio->buf.in_pos == xzio->buf.in_size)
 	{
@@ -281,29 +367,174 @@ grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
 	  break;
 	}
 
-      {
-	grub_off_t new_offset = current_offset + xzio->buf.out_pos;
-	
-	if (file->offset <= new_offset)
-	  /* Store first chunk of data in buffer.  */
-	  {
-	    grub_size_t delta = new_offset - (file->offset + ret);
-	    grub_memmove (buf, xzio->buf.out + (xzio->buf.out_pos - delta),
-			  delta);
-	    len -= delta;
-	    buf += delta;
-	    ret += delta;
-	  }
-	current_offset = new_offset;
-      }
-      xzio->buf.out_pos = 0;
-
-      if (xzret == XZ_STREAM_END)	/* Stream end, EOF.  */
-	break;
+      if (xzret == XZ_STREAM_END)	/* Block or stream end.  */
+	{
+	  if (xzio->blocks)
+	    {
+	      /* The Block must match its Index record.  */
+	      if (xzio->saved_offset + xzio->buf.out_pos != block_end)
+		{
+		  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			      N_("xz file corrupted or unsupported block options"));
+		  return -1;
+		}
+	      xzio->block++;
+	      xz_dec_reset_block (xzio->dec);
+	    }
+	  break;
+	}
     }
 
-  if (ret >= 0)
-    xzio->saved_offset = file->offset + ret;
+  xzio->saved_offset += xzio->buf.out_pos;
+  return xzio->buf.out_pos;
+}
+
+/* Position the decoder at the start of the Block I.  */
+static void
+jump_block (grub_xzio_t xzio, grub_size_t i)
+{
+  xz_dec_reset_block (xzio->dec);
+  xzio->block = i;
+  xzio->saved_offset = xzio->blocks[i].offset;
+  xzio->buf.in_pos = 0;
+  xzio->buf.in_size = 0;
+  grub_file_seek (xzio->file, xzio->blocks[i].in_offset);
+}
+
+/* Return the Block containing OFFSET, which must be in the file.  */
+static grub_size_t
+find_block (grub_xzio_t xzio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = xzio->num_blocks;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (xzio->blocks[mid].offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Return the data of the Block I, from the cache if possible.  */
+static grub_uint8_t *
+get_cached_block (grub_xzio_t xzio, grub_size_t i)
+{
+  struct grub_xzio_cache_entry *entry = &xzio->cache[0];
+  grub_size_t size = xzio->blocks[i].size;
+  unsigned j;
+
+  for (j = 0; j < XZIO_CACHE_BLOCKS; j++)
+    {
+      if (xzio->cache[j].data && xzio->cache[j].block == i)
+	{
+	  xzio->cache[j].last_use = ++xzio->cache_use;
+	  return xzio->cache[j].data;
+	}
+      if (xzio->cache[j].last_use < entry->last_use)
+	entry = &xzio->cache[j];
+    }
+
+  /* Reuse the least recently used entry.  */
+  grub_free (entry->data);
+  entry->data = grub_malloc (size);
+  entry->last_use = 0;
+  if (!entry->data)
+    return NULL;
+
+  if (xzio->block != i || xzio->saved_offset != xzio->blocks[i].offset)
+    jump_block (xzio, i);
+
+  if (xzio_decode (xzio, entry->data, size) != (grub_ssize_t) size)
+    {
+      if (grub_errno == GRUB_ERR_NONE)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		    N_("xz file corrupted or unsupported block options"));
+      grub_free (entry->data);
+      entry->data = NULL;
+      return NULL;
+    }
+
+  entry->block = i;
+  entry->last_use = ++xzio->cache_use;
+  return entry->data;
+}
+
+static grub_ssize_t
+grub_xzio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_ssize_t ret = 0;
+  grub_ssize_t n;
+  grub_xzio_t xzio = file->data;
+
+  while (len > 0)
+    {
+      grub_off_t offset = file->offset + ret;
+
+      if (xzio->blocks)
+	{
+	  grub_size_t i = find_block (xzio, offset);
+	  struct grub_xzio_block *block = &xzio->blocks[i];
+
+	  /* Small Blocks are decoded whole and cached.  */
+	  if (block->size <= XZIO_CACHE_BLOCK_SIZE)
+	    {
+	      grub_uint8_t *data = get_cached_block (xzio, i);
+
+	      if (!data)
+		return -1;
+
+	      n = block->offset + block->size - offset;
+	      if ((grub_size_t) n > len)
+		n = len;
+	      grub_memcpy (buf, data + (offset - block->offset), n);
+	      len -= n;
+	      buf += n;
+	      ret += n;
+	      continue;
+	    }
+
+	  /* Otherwise start over from the beginning of the Block if it
+	     isn't the one being decoded or if seeking backward.  */
+	  if (xzio->block != i || offset < xzio->saved_offset)
+	    jump_block (xzio, i);
+	}
+      else if (offset < xzio->saved_offset)
+	{
+	  /* Without the Index, start over from the beginning of the file.  */
+	  xz_dec_reset (xzio->dec);
+	  xzio->saved_offset = 0;
+	  xzio->buf.in_pos = 0;
+	  xzio->buf.in_size = 0;
+	  grub_file_seek (xzio->file, 0);
+	}
+
+      /* Skip the data before OFFSET.  */
+      while (xzio->saved_offset < offset)
+	{
+	  n = offset - xzio->saved_offset;
+	  if (n > XZBUFSIZ)
+	    n = XZBUFSIZ;
+	  n = xzio_decode (xzio, xzio->outbuf, n);
+	  if (n < 0)
+	    return -1;
+	  if (n == 0)
+	    return ret;
+	}
+
+      n = xzio_decode (xzio, (grub_uint8_t *) buf, len);
+      if (n < 0)
+	return -1;
+      if (n == 0 && !xzio->blocks)
+	break;
+      len -= n;
+      buf += n;
+      ret += n;
+    }
 
   return ret;
 }
@@ -313,10 +544,14 @@ static grub_err_t
 grub_xzio_close (grub_file_t file)
 {
   grub_xzio_t xzio = file->data;
+  unsigned i;
 
   xz_dec_end (xzio->dec);
 
   grub_file_close (xzio->file);
+  for (i = 0; i < XZIO_CACHE_BLOCKS; i++)
+    grub_free (xzio->cache[i].data);
+  grub_free (xzio->blocks);
   grub_free (xzio);
 
   /* Device must not be closed twice.  */
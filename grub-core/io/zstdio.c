@@ -0,0 +1,664 @@
+/* zstdio.c - decompression support for zstd */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/err.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
+#include <grub/i18n.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* We need the unstable API to provide our own allocator.  */
+#define ZSTD_STATIC_LINKING_ONLY
+
+#include <zstd.h>
+
+#define ZSTDIO_BUFSIZ 0x8000
+
+/* Seek table of the zstd seekable format, stored in a skippable frame at
+   the end of the file.  */
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+#define ZSTD_SEEKABLE_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_FOOTER_SIZE 9
+#define ZSTD_SEEKABLE_CHECKSUM_FLAG 0x80
+#define ZSTD_SKIPPABLE_HEADER_SIZE 8
+#define ZSTD_BLOCK_HEADER_SIZE 3
+
+struct grub_zstdio_seek_footer
+{
+  grub_uint32_t num_frames;
+  grub_uint8_t descriptor;
+  grub_uint32_t magic;
+} GRUB_PACKED;
+
+/* A frame of the file.  */
+struct grub_zstdio_frame
+{
+  /* Offset of the frame in the compressed file.  */
+  grub_off_t in_offset;
+  /* Offset and size of the frame data in the uncompressed file.  The size
+     is ZSTD_CONTENTSIZE_UNKNOWN if the frame header doesn't record it and
+     the frame hasn't been decoded yet.  */
+  grub_off_t offset;
+  grub_uint64_t size;
+};
+
+struct grub_zstdio
+{
+  grub_file_t file;
+  ZSTD_DStream *dstream;
+  ZSTD_inBuffer in;
+  grub_uint8_t inbuf[ZSTDIO_BUFSIZ];
+  grub_uint8_t outbuf[ZSTDIO_BUFSIZ];
+  /* The uncompressed offset of the decoder.  */
+  grub_off_t saved_offset;
+  /* The frames found so far.  Frames after one of unknown size are only
+     looked for once the decoder gets to them.  */
+  struct grub_zstdio_frame *frames;
+  grub_size_t num_frames;
+  grub_size_t alloc_frames;
+  /* Set once FRAMES holds every frame of the file.  */
+  int all_frames;
+  /* The frame the decoder is in, NUM_FRAMES at the end of the file.  */
+  grub_size_t frame;
+};
+
+typedef struct grub_zstdio *grub_zstdio_t;
+static struct grub_fs grub_zstdio_fs;
+
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static ZSTD_customMem
+grub_zstd_allocator (void)
+{
+  ZSTD_customMem allocator;
+
+  allocator.customAlloc = &grub_zstd_malloc;
+  allocator.customFree = &grub_zstd_free;
+  allocator.opaque = NULL;
+
+  return allocator;
+}
+
+/* Append a frame of SIZE uncompressed bytes at IN_OFFSET to the list.
+   The size of the previous frame must be known.  */
+static int
+add_frame (grub_zstdio_t zstdio, grub_off_t in_offset, grub_uint64_t size)
+{
+  struct grub_zstdio_frame *frame;
+  grub_off_t offset = 0;
+
+  if (zstdio->num_frames)
+    {
+      frame = &zstdio->frames[zstdio->num_frames - 1];
+      if (frame->size == ZSTD_CONTENTSIZE_UNKNOWN)
+	return 0;
+      offset = frame->offset + frame->size;
+      if (offset < frame->offset
+	  || (size != ZSTD_CONTENTSIZE_UNKNOWN && offset + size < offset))
+	return 0;
+    }
+
+  if (zstdio->num_frames == zstdio->alloc_frames)
+    {
+      struct grub_zstdio_frame *frames;
+      grub_size_t alloc;
+
+      alloc = zstdio->alloc_frames ? zstdio->alloc_frames * 2 : 16;
+      frames = grub_realloc (zstdio->frames, alloc * sizeof (*frames));
+      if (!frames)
+	return 0;
+      zstdio->frames = frames;
+      zstdio->alloc_frames = alloc;
+    }
+
+  frame = &zstdio->frames[zstdio->num_frames++];
+  frame->in_offset = in_offset;
+  frame->offset = offset;
+  frame->size = size;
+  return 1;
+}
+
+/* Read the frame header at IN_OFFSET.  */
+static int
+read_frame_header (grub_zstdio_t zstdio, grub_off_t in_offset,
+		   ZSTD_frameHeader *header)
+{
+  grub_uint8_t buf[ZSTD_FRAMEHEADERSIZE_MAX];
+  grub_ssize_t len;
+
+  grub_file_seek (zstdio->file, in_offset);
+  len = grub_file_read (zstdio->file, buf, sizeof (buf));
+  if (len <= 0 || ZSTD_getFrameHeader (header, buf, len) != 0)
+    return 0;
+  return 1;
+}
+
+/* Add the first data frame from IN_OFFSET on, skipping skippable frames,
+   or note that there are no more frames.  */
+static int
+find_next_frame (grub_zstdio_t zstdio, grub_off_t in_offset)
+{
+  ZSTD_frameHeader header;
+
+  while (in_offset < zstdio->file->size)
+    {
+      if (!read_frame_header (zstdio, in_offset, &header))
+	return 0;
+      if (header.frameType != ZSTD_skippableFrame)
+	return add_frame (zstdio, in_offset, header.frameContentSize);
+      in_offset += ZSTD_SKIPPABLE_HEADER_SIZE + header.frameContentSize;
+    }
+
+  zstdio->all_frames = 1;
+  return 1;
+}
+
+/* Walk the block headers of frame I to find where it ends.  */
+static int
+frame_in_end (grub_zstdio_t zstdio, grub_size_t i, grub_off_t *end)
+{
+  ZSTD_frameHeader header;
+  grub_off_t in_offset = zstdio->frames[i].in_offset;
+
+  if (!read_frame_header (zstdio, in_offset, &header))
+    return 0;
+
+  in_offset += header.headerSize;
+  for (;;)
+    {
+      grub_uint8_t bh[ZSTD_BLOCK_HEADER_SIZE];
+      grub_uint32_t block;
+
+      grub_file_seek (zstdio->file, in_offset);
+      if (grub_file_read (zstdio->file, bh, sizeof (bh)) != sizeof (bh))
+	return 0;
+
+      block = bh[0] | (bh[1] << 8) | (bh[2] << 16);
+      in_offset += sizeof (bh);
+      switch ((block >> 1) & 3)
+	{
+	case 0:		/* Raw.  */
+	case 2:		/* Compressed.  */
+	  in_offset += block >> 3;
+	  break;
+	case 1:		/* RLE.  */
+	  in_offset += 1;
+	  break;
+	default:
+	  return 0;
+	}
+
+      if (block & 1)	/* Last block.  */
+	break;
+    }
+
+  if (header.checksumFlag)
+    in_offset += 4;
+
+  *end = in_offset;
+  return 1;
+}
+
+/* Find the frames from the start of the file by walking their headers
+   and block headers, as long as the frame headers record the frame sizes.
+   Frames after one that doesn't are found once the decoder gets to them.
+   Returns 0 if not even the first frame could be found.  */
+static int
+scan_frames (grub_zstdio_t zstdio)
+{
+  grub_off_t in_offset = 0;
+
+  while (find_next_frame (zstdio, in_offset) && !zstdio->all_frames)
+    {
+      if (zstdio->frames[zstdio->num_frames - 1].size
+	  == ZSTD_CONTENTSIZE_UNKNOWN)
+	return 1;
+      if (!frame_in_end (zstdio, zstdio->num_frames - 1, &in_offset)
+	  || in_offset > zstdio->file->size)
+	break;
+    }
+
+  /* A damaged frame is only reported once the decoder reaches it.  */
+  grub_errno = GRUB_ERR_NONE;
+  return zstdio->num_frames != 0;
+}
+
+/* Read the frame list from the seek table, if there is a valid one.  */
+static int
+read_seek_table (grub_zstdio_t zstdio)
+{
+  struct grub_zstdio_seek_footer footer;
+  grub_uint32_t header[2];
+  grub_uint32_t num_frames, i;
+  grub_size_t entry_size, table_size;
+  grub_uint8_t *table = NULL, *entry;
+  grub_off_t table_offset, in_offset = 0;
+
+  if (zstdio->file->size < ZSTD_SKIPPABLE_HEADER_SIZE
+      + ZSTD_SEEKABLE_FOOTER_SIZE)
+    return 0;
+
+  grub_file_seek (zstdio->file, zstdio->file->size - sizeof (footer));
+  if (grub_file_read (zstdio->file, &footer, sizeof (footer))
+      != sizeof (footer)
+      || grub_le_to_cpu32 (footer.magic) != ZSTD_SEEKABLE_MAGIC
+      || (footer.descriptor & ~ZSTD_SEEKABLE_CHECKSUM_FLAG) != 0)
+    return 0;
+
+  num_frames = grub_le_to_cpu32 (footer.num_frames);
+  entry_size = (footer.descriptor & ZSTD_SEEKABLE_CHECKSUM_FLAG) ? 12 : 8;
+  if (num_frames == 0
+      || num_frames > (zstdio->file->size - ZSTD_SKIPPABLE_HEADER_SIZE
+		       - ZSTD_SEEKABLE_FOOTER_SIZE) / entry_size)
+    return 0;
+
+  table_size = num_frames * entry_size;
+  table_offset = zstdio->file->size - ZSTD_SEEKABLE_FOOTER_SIZE - table_size;
+
+  grub_file_seek (zstdio->file, table_offset - sizeof (header));
+  if (grub_file_read (zstdio->file, header, sizeof (header))
+      != sizeof (header)
+      || grub_le_to_cpu32 (header[0]) != ZSTD_SEEKABLE_SKIPPABLE_MAGIC
+      || grub_le_to_cpu32 (header[1])
+	 != table_size + ZSTD_SEEKABLE_FOOTER_SIZE)
+    return 0;
+
+  table = grub_malloc (table_size);
+  if (!table)
+    goto fail;
+  if (grub_file_read (zstdio->file, table, table_size)
+      != (grub_ssize_t) table_size)
+    goto fail;
+
+  for (i = 0, entry = table; i < num_frames; i++, entry += entry_size)
+    {
+      grub_uint32_t csize = grub_get_unaligned32 (entry);
+      grub_uint32_t dsize = grub_get_unaligned32 (entry + 4);
+
+      if (!add_frame (zstdio, in_offset, grub_le_to_cpu32 (dsize)))
+	goto fail;
+      in_offset += grub_le_to_cpu32 (csize);
+    }
+
+  /* The frames must cover everything before the seek table.  */
+  if (in_offset != table_offset - sizeof (header))
+    goto fail;
+
+  grub_free (table);
+  zstdio->all_frames = 1;
+  return 1;
+
+ fail:
+  grub_free (table);
+  grub_free (zstdio->frames);
+  zstdio->frames = NULL;
+  zstdio->num_frames = 0;
+  zstdio->alloc_frames = 0;
+  grub_errno = GRUB_ERR_NONE;
+  return 0;
+}
+
+static int
+test_header (grub_zstdio_t zstdio)
+{
+  grub_uint32_t magic;
+
+  if (grub_file_read (zstdio->file, &magic, sizeof (magic)) != sizeof (magic)
+      || grub_le_to_cpu32 (magic) != ZSTD_MAGICNUMBER)
+    return 0;
+
+  return 1;
+}
+
+static grub_file_t
+grub_zstdio_open (grub_file_t io, enum grub_file_type type)
+{
+  grub_file_t file;
+  grub_zstdio_t zstdio;
+  struct grub_zstdio_frame *last;
+
+  if (type & GRUB_FILE_TYPE_NO_DECOMPRESS)
+    return io;
+
+  file = (grub_file_t) grub_zalloc (sizeof (*file));
+  if (!file)
+    return 0;
+
+  zstdio = grub_zalloc (sizeof (*zstdio));
+  if (!zstdio)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  zstdio->file = io;
+
+  file->device = io->device;
+  file->data = zstdio;
+  file->fs = &grub_zstdio_fs;
+  file->not_easily_seekable = 1;
+
+  if (grub_file_tell (zstdio->file) != 0)
+    grub_file_seek (zstdio->file, 0);
+
+  if (!test_header (zstdio)
+      || (!read_seek_table (zstdio) && !scan_frames (zstdio)))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_file_seek (io, 0);
+      grub_free (zstdio->frames);
+      grub_free (zstdio);
+      grub_free (file);
+
+      return io;
+    }
+
+  zstdio->dstream = ZSTD_createDStream_advanced (grub_zstd_allocator ());
+  if (!zstdio->dstream)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("failed to create a zstd context"));
+      grub_free (zstdio->frames);
+      grub_free (zstdio);
+      grub_free (file);
+      return 0;
+    }
+  ZSTD_initDStream (zstdio->dstream);
+
+  /* If a frame doesn't record its size, the size of the file is only set
+     once the decoder reaches the end of it.  */
+  last = &zstdio->frames[zstdio->num_frames - 1];
+  if (zstdio->all_frames)
+    file->size = last->offset + last->size;
+  else
+    file->size = GRUB_FILE_SIZE_UNKNOWN;
+
+  zstdio->in.src = zstdio->inbuf;
+  grub_file_seek (zstdio->file, 0);
+
+  return file;
+}
+
+/* Position the decoder at the start of the frame I.  */
+static void
+jump_frame (grub_zstdio_t zstdio, grub_size_t i)
+{
+  ZSTD_resetDStream (zstdio->dstream);
+  zstdio->frame = i;
+  zstdio->saved_offset = zstdio->frames[i].offset;
+  zstdio->in.pos = 0;
+  zstdio->in.size = 0;
+  grub_file_seek (zstdio->file, zstdio->frames[i].in_offset);
+}
+
+/* Move on to the frame after the one just decoded, which ended at
+   IN_OFFSET in the compressed file.  */
+static int
+next_frame (grub_zstdio_t zstdio, grub_off_t in_offset)
+{
+  grub_size_t next = zstdio->frame + 1;
+
+  if (next == zstdio->num_frames && !zstdio->all_frames)
+    {
+      if (!find_next_frame (zstdio, in_offset))
+	return 0;
+      /* That moved the underlying file.  */
+      if (next < zstdio->num_frames)
+	{
+	  jump_frame (zstdio, next);
+	  return 1;
+	}
+    }
+
+  /* Skip whatever is between the frames, like skippable frames.  */
+  if (next < zstdio->num_frames
+      && zstdio->frames[next].in_offset != in_offset)
+    jump_frame (zstdio, next);
+  else
+    zstdio->frame = next;
+  return 1;
+}
+
+/* Decode up to LEN bytes to OUT, not past the end of the current frame.
+   At the end of the frame also consume its checksum and move on to the
+   next one.  Return the number of bytes decoded, or -1 on error.  */
+static grub_ssize_t
+zstdio_decode (grub_zstdio_t zstdio, grub_uint8_t *out, grub_size_t len)
+{
+  struct grub_zstdio_frame *frame = &zstdio->frames[zstdio->frame];
+  int known = (frame->size != ZSTD_CONTENTSIZE_UNKNOWN);
+  grub_off_t frame_end = frame->offset + frame->size;
+  ZSTD_outBuffer output;
+  grub_ssize_t readret;
+  grub_size_t ret;
+  grub_off_t in_offset;
+
+  if (known && len > frame_end - zstdio->saved_offset)
+    len = frame_end - zstdio->saved_offset;
+
+  output.dst = out;
+  output.pos = 0;
+  output.size = len;
+
+  while (output.pos < len
+	 || (known && zstdio->saved_offset + len == frame_end))
+    {
+      /* Feed input.  */
+      if (zstdio->in.pos == zstdio->in.size)
+	{
+	  readret = grub_file_read (zstdio->file, zstdio->inbuf,
+				    ZSTDIO_BUFSIZ);
+	  if (readret < 0)
+	    return -1;
+	  if (readret == 0)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  N_("premature end of compressed"));
+	      return -1;
+	    }
+	  zstdio->in.size = readret;
+	  zstdio->in.pos = 0;
+	}
+
+      ret = ZSTD_decompressStream (zstdio->dstream, &output, &zstdio->in);
+      if (ZSTD_isError (ret))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "zstd data corrupted");
+	  return -1;
+	}
+
+      if (ret == 0)		/* Frame end.  */
+	{
+	  /* The frame must be as large as recorded.  */
+	  if (known && zstdio->saved_offset + output.pos != frame_end)
+	    {
+	      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			  "zstd data corrupted");
+	      return -1;
+	    }
+	  zstdio->saved_offset += output.pos;
+	  frame->size = zstdio->saved_offset - frame->offset;
+
+	  in_offset = (grub_file_tell (zstdio->file)
+		       - (zstdio->in.size - zstdio->in.pos));
+	  if (!next_frame (zstdio, in_offset))
+	    {
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			    "zstd data corrupted");
+	      return -1;
+	    }
+
+	  return output.pos;
+	}
+    }
+
+  zstdio->saved_offset += output.pos;
+  return output.pos;
+}
+
+/* Return the frame containing OFFSET, which must be before the decoder.  */
+static grub_size_t
+find_frame (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  grub_size_t lo = 0, hi = zstdio->num_frames;
+
+  while (hi - lo > 1)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+
+      if (zstdio->frames[mid].offset <= offset)
+	lo = mid;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Move the decoder to OFFSET, or to the end of the file if that is
+   before OFFSET.  */
+static int
+zstdio_seek (grub_zstdio_t zstdio, grub_off_t offset)
+{
+  struct grub_zstdio_frame *frame;
+  grub_off_t in_end;
+  grub_size_t n;
+
+  /* Start over from the beginning of the frame if seeking backward.  */
+  if (offset < zstdio->saved_offset)
+    jump_frame (zstdio, find_frame (zstdio, offset));
+
+  while (zstdio->frame < zstdio->num_frames
+	 && zstdio->saved_offset < offset)
+    {
+      frame = &zstdio->frames[zstdio->frame];
+
+      /* Jump over frames of known size.  */
+      if (frame->size != ZSTD_CONTENTSIZE_UNKNOWN
+	  && offset >= frame->offset + frame->size)
+	{
+	  if (zstdio->frame + 1 == zstdio->num_frames && !zstdio->all_frames
+	      && (!frame_in_end (zstdio, zstdio->frame, &in_end)
+		  || !find_next_frame (zstdio, in_end)))
+	    {
+	      if (!grub_errno)
+		grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+			    "zstd data corrupted");
+	      return 0;
+	    }
+	  if (zstdio->frame + 1 < zstdio->num_frames)
+	    {
+	      jump_frame (zstdio, zstdio->frame + 1);
+	      continue;
+	    }
+	}
+
+      /* Skip the data before OFFSET.  */
+      n = ZSTDIO_BUFSIZ;
+      if (n > offset - zstdio->saved_offset)
+	n = offset - zstdio->saved_offset;
+      if (zstdio_decode (zstdio, zstdio->outbuf, n) < 0)
+	return 0;
+    }
+
+  return 1;
+}
+
+static grub_ssize_t
+grub_zstdio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_zstdio_t zstdio = file->data;
+  struct grub_zstdio_frame *last;
+  grub_ssize_t ret = 0;
+  grub_ssize_t n;
+
+  if (!zstdio_seek (zstdio, file->offset))
+    return -1;
+
+  while (len > 0 && zstdio->frame < zstdio->num_frames)
+    {
+      n = zstdio_decode (zstdio, (grub_uint8_t *) buf, len);
+      if (n < 0)
+	return -1;
+      len -= n;
+      buf += n;
+      ret += n;
+    }
+
+  if (zstdio->all_frames && file->size == GRUB_FILE_SIZE_UNKNOWN)
+    {
+      last = &zstdio->frames[zstdio->num_frames - 1];
+      if (last->size != ZSTD_CONTENTSIZE_UNKNOWN)
+	file->size = last->offset + last->size;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_zstdio_close (grub_file_t file)
+{
+  grub_zstdio_t zstdio = file->data;
+
+  ZSTD_freeDStream (zstdio->dstream);
+
+  grub_file_close (zstdio->file);
+  grub_free (zstdio->frames);
+  grub_free (zstdio);
+
+  /* Device must not be closed twice.  */
+  file->device = 0;
+  file->name = 0;
+  return grub_errno;
+}
+
+static struct grub_fs grub_zstdio_fs = {
+  .name = "zstdio",
+  .fs_dir = 0,
+  .fs_open = 0,
+  .fs_read = grub_zstdio_read,
+  .fs_close = grub_zstdio_close,
+  .fs_label = 0,
+  .next = 0
+};
+
+GRUB_MOD_INIT (zstdio)
+{
+  grub_file_filter_register (GRUB_FILE_FILTER_ZSTDIO, grub_zstdio_open);
+}
+
+GRUB_MOD_FINI (zstdio)
+{
+  grub_file_filter_unregister (GRUB_FILE_FILTER_ZSTDIO);
+}
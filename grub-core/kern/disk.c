@@ -25,26 +25,58 @@
 #include <grub/time.h>
 #include <grub/file.h>
 #include <grub/i18n.h>
+#include <grub/env.h>
+#include <grub/safemath.h>
 
 #define	GRUB_CACHE_TIMEOUT	2
 
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+struct grub_disk_cache *grub_disk_cache_table;
+unsigned grub_disk_cache_num_sets;
+unsigned long grub_disk_cache_generation;
+
+/* The configured size of the disk cache in KiB.  */
+static grub_size_t grub_disk_cache_size = GRUB_DISK_CACHE_DEFAULT_SIZE;
+
+/* Incremented on every cache access, used for LRU replacement.  */
+static unsigned long grub_disk_cache_clock;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
 
 #if DISK_CACHE_STATS
-static unsigned long grub_disk_cache_hits;
-static unsigned long grub_disk_cache_misses;
+static unsigned long grub_disk_cache_hits[GRUB_DISK_DEVICE_MAX_ID];
+static unsigned long grub_disk_cache_misses[GRUB_DISK_DEVICE_MAX_ID];
 
 void
 grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
 {
-  *hits = grub_disk_cache_hits;
-  *misses = grub_disk_cache_misses;
+  unsigned i;
+
+  *hits = 0;
+  *misses = 0;
+  for (i = 0; i < GRUB_DISK_DEVICE_MAX_ID; i++)
+    {
+      *hits += grub_disk_cache_hits[i];
+      *misses += grub_disk_cache_misses[i];
+    }
+}
+
+void
+grub_disk_cache_get_dev_performance (enum grub_disk_dev_id dev_id,
+				     unsigned long *hits,
+				     unsigned long *misses)
+{
+  if (dev_id >= GRUB_DISK_DEVICE_MAX_ID)
+    {
+      *hits = 0;
+      *misses = 0;
+      return;
+    }
+  *hits = grub_disk_cache_hits[dev_id];
+  *misses = grub_disk_cache_misses[dev_id];
 }
 #endif
 
@@ -60,7 +92,9 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  grub_disk_cache_generation++;
+
+  for (i = 0; i < grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
@@ -72,28 +106,109 @@ grub_disk_cache_invalidate_all (void)
     }
 }
 
+/* Drop the current cache and allocate the table for a cache of SIZE KiB.
+   A size of 0 disables the cache.  */
+static grub_err_t
+grub_disk_cache_resize (grub_size_t size)
+{
+  grub_size_t num_sets, table_size;
+  unsigned i;
+
+  /* Entries are locked while a read copies from them, and the table can't
+     go away under it.  */
+  for (i = 0; i < grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS; i++)
+    if (grub_disk_cache_table[i].lock)
+      return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			 N_("the disk cache is in use"));
+
+  if (size > GRUB_DISK_CACHE_MAX_SIZE)
+    size = GRUB_DISK_CACHE_MAX_SIZE;
+
+  grub_disk_cache_invalidate_all ();
+  grub_free (grub_disk_cache_table);
+  grub_disk_cache_table = 0;
+  grub_disk_cache_num_sets = 0;
+
+  grub_disk_cache_size = size;
+  num_sets = (size >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - 10))
+    / GRUB_DISK_CACHE_WAYS;
+  if (size && ! num_sets)
+    num_sets = 1;
+  if (! num_sets)
+    return GRUB_ERR_NONE;
+
+  if (grub_mul (num_sets, GRUB_DISK_CACHE_WAYS, &table_size)
+      || grub_mul (table_size, sizeof (grub_disk_cache_table[0]), &table_size))
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, N_("overflow is detected"));
+
+  grub_disk_cache_table = grub_zalloc (table_size);
+  if (! grub_disk_cache_table)
+    {
+      /* Run without a cache rather than failing the caller.  */
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+  grub_disk_cache_num_sets = num_sets;
+  return GRUB_ERR_NONE;
+}
+
+static char *
+grub_disk_cache_env_write (struct grub_env_var *var __attribute__ ((unused)),
+			   const char *val)
+{
+  unsigned long size = GRUB_DISK_CACHE_DEFAULT_SIZE;
+  const char *end;
+
+  if (*val)
+    {
+      size = grub_strtoul (val, &end, 0);
+      if (grub_errno)
+	return NULL;
+      if (*end)
+	{
+	  grub_error (GRUB_ERR_BAD_NUMBER, N_("unrecognized number"));
+	  return NULL;
+	}
+    }
+
+  if (size > GRUB_DISK_CACHE_MAX_SIZE)
+    size = GRUB_DISK_CACHE_MAX_SIZE;
+
+  if ((size != grub_disk_cache_size || ! grub_disk_cache_table)
+      && grub_disk_cache_resize (size))
+    return NULL;
+
+  return grub_strdup (val);
+}
+
+void
+grub_disk_cache_init (void)
+{
+  grub_register_variable_hook ("disk_cache_size", 0,
+			       grub_disk_cache_env_write);
+}
+
 static char *
 grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->last_use = ++grub_disk_cache_clock;
 #if DISK_CACHE_STATS
-      grub_disk_cache_hits++;
+      if (dev_id < GRUB_DISK_DEVICE_MAX_ID)
+	grub_disk_cache_hits[dev_id]++;
 #endif
       return cache->data;
     }
 
 #if DISK_CACHE_STATS
-  grub_disk_cache_misses++;
+  if (dev_id < GRUB_DISK_DEVICE_MAX_ID)
+    grub_disk_cache_misses[dev_id]++;
 #endif
 
   return 0;
@@ -104,13 +219,9 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
@@ -118,31 +229,54 @@ static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
-  struct grub_disk_cache *cache;
+  struct grub_disk_cache *cache, *victim = NULL;
+  unsigned i;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  if (! grub_disk_cache_num_sets)
+    return GRUB_ERR_NONE;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  /* Prefer the entry already holding SECTOR, then a free entry, then the
+     least recently used unlocked one.  */
+  cache = grub_disk_cache_table
+    + grub_disk_cache_get_index (dev_id, disk_id, sector) * GRUB_DISK_CACHE_WAYS;
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++, cache++)
+    {
+      if (cache->lock)
+	continue;
+      if (cache->data && cache->dev_id == dev_id
+	  && cache->disk_id == disk_id && cache->sector == sector)
+	{
+	  victim = cache;
+	  break;
+	}
+      if (! victim
+	  || (victim->data && (! cache->data
+			       || cache->last_use < victim->last_use)))
+	victim = cache;
+    }
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! cache->data)
-    return grub_errno;
+  if (! victim)
+    return GRUB_ERR_NONE;
 
-  grub_memcpy (cache->data, data,
+  /* All entries have the same size, so reuse the buffer if there is one.  */
+  if (! victim->data)
+    {
+      victim->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+      if (! victim->data)
+	return grub_errno;
+    }
+
+  grub_memcpy (victim->data, data,
 	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  cache->dev_id = dev_id;
-  cache->disk_id = disk_id;
-  cache->sector = sector;
+  victim->dev_id = dev_id;
+  victim->disk_id = disk_id;
+  victim->sector = sector;
+  victim->last_use = ++grub_disk_cache_clock;
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -268,6 +402,10 @@ grub_disk_open (const char *name)
 		      + GRUB_CACHE_TIMEOUT * 1000))
     grub_disk_cache_invalidate_all ();
 
+  /* Allocate the cache table on first use.  */
+  if (! grub_disk_cache_table && grub_disk_cache_size)
+    grub_disk_cache_resize (grub_disk_cache_size);
+
   grub_last_time = current_time;
 
  fail:
@@ -288,12 +426,395 @@ grub_disk_open (const char *name)
   return disk;
 }
 
+/* Return non-zero if the background read REQ has finished.  */
+static int
+grub_disk_request_poll (grub_disk_t disk, struct grub_disk_request *req)
+{
+  if (! req->done)
+    req->done = (disk->dev->disk_read_poll) (disk, req);
+  return req->done;
+}
+
+static void
+grub_disk_request_unlink (grub_disk_t disk, struct grub_disk_request *req)
+{
+  struct grub_disk_request **p;
+
+  for (p = &disk->pending; *p; p = &(*p)->next)
+    if (*p == req)
+      {
+	*p = req->next;
+	break;
+      }
+}
+
+/* Wait for the read-ahead REQ, move its data to the cache and free it.  */
+static void
+grub_disk_prefetch_finish (grub_disk_t disk, struct grub_disk_request *req)
+{
+  unsigned i;
+
+  while (! grub_disk_request_poll (disk, req));
+  grub_disk_request_unlink (disk, req);
+
+  if (! req->err)
+    for (i = 0; i < req->num_units; i++)
+      grub_disk_cache_store (disk->dev->id, disk->id,
+			     req->cache_sector + (i << GRUB_DISK_CACHE_BITS),
+			     req->buf + (i << (GRUB_DISK_CACHE_BITS
+					       + GRUB_DISK_SECTOR_BITS)));
+  /* Read-ahead is only a hint, so its errors don't matter.  */
+  grub_errno = GRUB_ERR_NONE;
+
+  grub_free (req->buf);
+  grub_free (req);
+}
+
+/* Return non-zero if a read-ahead of DISK covers SECTOR.  */
+static int
+grub_disk_prefetch_pending (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  struct grub_disk_request *req;
+
+  for (req = disk->pending; req; req = req->next)
+    if (req->prefetch && sector >= req->cache_sector
+	&& sector < req->cache_sector + (req->num_units
+					 << GRUB_DISK_CACHE_BITS))
+      return 1;
+  return 0;
+}
+
+/* Move finished read-aheads of DISK to the cache, waiting for those
+   overlapping the sectors from SECTOR to END.  Read-aheads for direct reads
+   are only moved there when a cached read (not DIRECT) overlaps them.  */
+static void
+grub_disk_prefetch_reap (grub_disk_t disk, grub_disk_addr_t sector,
+			 grub_disk_addr_t end, int direct)
+{
+  struct grub_disk_request *req, *next;
+  int overlap;
+
+  for (req = disk->pending; req; req = next)
+    {
+      next = req->next;
+      if (! req->prefetch || (req->direct && direct))
+	continue;
+      overlap = (req->cache_sector < end
+		 && sector < req->cache_sector + (req->num_units
+						  << GRUB_DISK_CACHE_BITS));
+      if (overlap || (! req->direct && grub_disk_request_poll (disk, req)))
+	grub_disk_prefetch_finish (disk, req);
+    }
+}
+
+/* Start reading the read-ahead window following the last read of DISK
+   into the cache in the background, if the device can do that, so that
+   the next sequential reads find their data ready.  */
+static void
+grub_disk_prefetch (grub_disk_t disk)
+{
+  struct grub_disk_request *req;
+  grub_disk_addr_t start, end, total_sectors;
+  unsigned num = 0, n = 0;
+
+  if (! disk->dev->disk_read_start || ! disk->read_ahead_window
+      || ! grub_disk_cache_num_sets)
+    return;
+
+  for (req = disk->pending; req; req = req->next)
+    if (req->prefetch)
+      n++;
+  if (n >= GRUB_DISK_MAX_PREFETCH)
+    return;
+
+  total_sectors = disk->total_sectors << (disk->log_sector_size
+					  - GRUB_DISK_SECTOR_BITS);
+
+  /* Skip what is already there or on its way.  */
+  start = disk->read_ahead_next & ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
+  end = start + ((grub_disk_addr_t) disk->read_ahead_window
+		 << GRUB_DISK_CACHE_BITS);
+  while (start < end
+	 && (grub_disk_cache_find (disk->dev->id, disk->id, start)
+	     || grub_disk_prefetch_pending (disk, start)))
+    start += GRUB_DISK_CACHE_SIZE;
+
+  while (start + ((grub_disk_addr_t) num << GRUB_DISK_CACHE_BITS) < end
+	 && num < disk->max_agglomerate
+	 && (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
+	     || start + ((grub_disk_addr_t) (num + 1) << GRUB_DISK_CACHE_BITS)
+		< total_sectors)
+	 && ! grub_disk_cache_find (disk->dev->id, disk->id,
+				    start + (num << GRUB_DISK_CACHE_BITS))
+	 && ! grub_disk_prefetch_pending (disk,
+					  start + (num << GRUB_DISK_CACHE_BITS)))
+    num++;
+  if (! num)
+    return;
+
+  req = grub_zalloc (sizeof (*req));
+  if (! req)
+    goto fail;
+  req->buf = grub_malloc (num << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+  if (! req->buf)
+    goto fail;
+
+  req->prefetch = 1;
+  req->cache_sector = start;
+  req->num_units = num;
+  req->sector = transform_sector (disk, start);
+  req->size = num << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+		      - disk->log_sector_size);
+  if ((disk->dev->disk_read_start) (disk, req))
+    goto fail;
+
+  req->next = disk->pending;
+  disk->pending = req;
+  return;
+
+ fail:
+  if (req)
+    grub_free (req->buf);
+  grub_free (req);
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* Wait for the background read REQ of DISK and return its error.  */
+static grub_err_t
+grub_disk_request_wait (grub_disk_t disk, struct grub_disk_request *req)
+{
+  while (! grub_disk_request_poll (disk, req));
+  grub_disk_request_unlink (disk, req);
+  if (req->err)
+    return grub_error (req->err, N_("failure reading sector 0x%llx from `%s'"),
+		       (unsigned long long) req->sector, disk->name);
+  return GRUB_ERR_NONE;
+}
+
+/* Wait for and forget the read-aheads for direct reads of DISK, except the
+   one at SECTOR.  */
+static void
+grub_disk_read_ahead_drop (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  struct grub_disk_request *req, *next;
+
+  for (req = disk->pending; req; req = next)
+    {
+      next = req->next;
+      if (! req->direct || req->cache_sector == sector)
+	continue;
+      grub_disk_request_wait (disk, req);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (req->buf);
+      grub_free (req);
+    }
+}
+
+/* Read NUM cache units at SECTOR, which is aligned to a cache unit, into
+   BUF without going through the cache.  If the device can read in the
+   background, up to GRUB_DISK_MAX_PREFETCH parts of the read are kept in
+   flight, so that the device works on the next ones while the read hook
+   looks at the previous one.  */
+static grub_err_t
+grub_disk_read_direct (grub_disk_t disk, grub_disk_addr_t sector,
+		       grub_size_t num, char *buf)
+{
+  struct grub_disk_request *inflight[GRUB_DISK_MAX_PREFETCH];
+  struct grub_disk_request *req;
+  grub_size_t done = 0, started, chunk, n;
+  unsigned first = 0, count = 0;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  /* Take what the read-ahead after the previous direct read brought in.  */
+  for (req = disk->pending; req; req = req->next)
+    if (req->direct && req->cache_sector == sector)
+      break;
+  if (req)
+    {
+      if (grub_disk_request_wait (disk, req) == GRUB_ERR_NONE)
+	{
+	  done = req->num_units < num ? req->num_units : num;
+	  grub_memcpy (buf, req->buf,
+		       done << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+	  if (disk->read_hook)
+	    (disk->read_hook) (sector, 0, done << (GRUB_DISK_CACHE_BITS
+						   + GRUB_DISK_SECTOR_BITS),
+			       disk->read_hook_data);
+	}
+      /* Read-ahead is only a hint, so its errors don't matter.  */
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (req->buf);
+      grub_free (req);
+    }
+
+  chunk = disk->max_agglomerate;
+  if (disk->dev->disk_read_start && chunk > GRUB_DISK_MAX_READ_AHEAD)
+    chunk = GRUB_DISK_MAX_READ_AHEAD;
+
+  started = done;
+  while (done < num)
+    {
+      while (disk->dev->disk_read_start && started < num
+	     && count < GRUB_DISK_MAX_PREFETCH)
+	{
+	  n = num - started < chunk ? num - started : chunk;
+	  req = grub_zalloc (sizeof (*req));
+	  if (! req)
+	    break;
+	  req->sector = transform_sector (disk, sector
+					  + (started << GRUB_DISK_CACHE_BITS));
+	  req->size = n << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+			    - disk->log_sector_size);
+	  req->buf = buf + (started << (GRUB_DISK_CACHE_BITS
+					+ GRUB_DISK_SECTOR_BITS));
+	  req->num_units = n;
+	  if ((disk->dev->disk_read_start) (disk, req))
+	    {
+	      grub_free (req);
+	      break;
+	    }
+	  req->next = disk->pending;
+	  disk->pending = req;
+	  inflight[(first + count++) % GRUB_DISK_MAX_PREFETCH] = req;
+	  started += n;
+	}
+      /* Whatever couldn't be started is read synchronously below.  */
+      grub_errno = GRUB_ERR_NONE;
+
+      if (count)
+	{
+	  req = inflight[first];
+	  first = (first + 1) % GRUB_DISK_MAX_PREFETCH;
+	  count--;
+	  n = req->num_units;
+	  err = grub_disk_request_wait (disk, req);
+	  grub_free (req);
+	}
+      else
+	{
+	  n = num - done < chunk ? num - done : chunk;
+	  err = (disk->dev->disk_read) (disk,
+					transform_sector (disk, sector
+							  + (done << GRUB_DISK_CACHE_BITS)),
+					n << (GRUB_DISK_CACHE_BITS
+					      + GRUB_DISK_SECTOR_BITS
+					      - disk->log_sector_size),
+					buf + (done << (GRUB_DISK_CACHE_BITS
+							+ GRUB_DISK_SECTOR_BITS)));
+	  started += n;
+	}
+      if (err)
+	break;
+
+      if (disk->read_hook)
+	(disk->read_hook) (sector + (done << GRUB_DISK_CACHE_BITS), 0,
+			   n << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS),
+			   disk->read_hook_data);
+      done += n;
+    }
+
+  /* After an error the device may still be writing to BUF.  */
+  while (count)
+    {
+      req = inflight[first];
+      first = (first + 1) % GRUB_DISK_MAX_PREFETCH;
+      count--;
+      while (! grub_disk_request_poll (disk, req));
+      grub_disk_request_unlink (disk, req);
+      grub_free (req);
+    }
+
+  return err;
+}
+
+/* Start reading the NUM cache units following the last direct read of
+   DISK in the background, if the device can do that and the reads are
+   sequential, for the next direct read to pick up.  The data is kept out
+   of the cache.  */
+static void
+grub_disk_read_ahead_direct (grub_disk_t disk, grub_size_t num)
+{
+  struct grub_disk_request *req;
+  grub_disk_addr_t start, total_sectors;
+
+  if (! disk->dev->disk_read_start)
+    return;
+
+  start = ALIGN_UP (disk->read_ahead_next,
+		    (grub_disk_addr_t) GRUB_DISK_CACHE_SIZE);
+  grub_disk_read_ahead_drop (disk, start);
+  if (! disk->read_ahead_window || grub_disk_prefetch_pending (disk, start))
+    return;
+
+  if (num > GRUB_DISK_MAX_READ_AHEAD)
+    num = GRUB_DISK_MAX_READ_AHEAD;
+  if (num > disk->max_agglomerate)
+    num = disk->max_agglomerate;
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      total_sectors = disk->total_sectors << (disk->log_sector_size
+					      - GRUB_DISK_SECTOR_BITS);
+      if (start >= total_sectors)
+	return;
+      if (num > (total_sectors - start) >> GRUB_DISK_CACHE_BITS)
+	num = (total_sectors - start) >> GRUB_DISK_CACHE_BITS;
+    }
+  if (! num)
+    return;
+
+  req = grub_zalloc (sizeof (*req));
+  if (! req)
+    goto fail;
+  req->buf = grub_malloc (num << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+  if (! req->buf)
+    goto fail;
+
+  req->prefetch = 1;
+  req->direct = 1;
+  req->cache_sector = start;
+  req->num_units = num;
+  req->sector = transform_sector (disk, start);
+  req->size = num << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS
+		      - disk->log_sector_size);
+  if ((disk->dev->disk_read_start) (disk, req))
+    goto fail;
+
+  req->next = disk->pending;
+  disk->pending = req;
+  return;
+
+ fail:
+  if (req)
+    grub_free (req->buf);
+  grub_free (req);
+  grub_errno = GRUB_ERR_NONE;
+}
+
 void
 grub_disk_close (grub_disk_t disk)
 {
   grub_partition_t part;
   grub_dprintf ("disk", "Closing `%s'.\n", disk->name);
 
+  /* The device may still be writing to the buffers of these.  */
+  while (disk->pending)
+    {
+      struct grub_disk_request *req = disk->pending;
+
+      if (req->prefetch && ! req->direct)
+	grub_disk_prefetch_finish (disk, req);
+      else
+	{
+	  while (! grub_disk_request_poll (disk, req));
+	  grub_disk_request_unlink (disk, req);
+	  if (req->direct)
+	    {
+	      grub_free (req->buf);
+	      grub_free (req);
+	    }
+	}
+    }
+
   if (disk->dev && disk->dev->disk_close)
     (disk->dev->disk_close) (disk);
 
@@ -310,6 +831,65 @@ grub_disk_close (grub_disk_t disk)
   grub_free (disk);
 }
 
+/* Update the sequential access detector with a read of SIZE bytes at
+   SECTOR and OFFSET.  Every read continuing the previous one doubles the
+   read-ahead window, anything else disables read-ahead.  */
+static void
+grub_disk_update_read_ahead (grub_disk_t disk, grub_disk_addr_t sector,
+			     grub_off_t offset, grub_size_t size)
+{
+  unsigned max;
+
+  /* A read may start in the last, partially consumed sector.  */
+  if (sector <= disk->read_ahead_next && sector + 1 >= disk->read_ahead_next)
+    {
+      max = disk->max_agglomerate;
+      if (max > GRUB_DISK_MAX_READ_AHEAD)
+	max = GRUB_DISK_MAX_READ_AHEAD;
+      /* Don't let read-ahead evict more than a quarter of the cache.  */
+      if (max > grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS / 4)
+	max = grub_disk_cache_num_sets * GRUB_DISK_CACHE_WAYS / 4;
+
+      if (! disk->read_ahead_window)
+	disk->read_ahead_window = 1;
+      else
+	disk->read_ahead_window *= 2;
+      if (disk->read_ahead_window > max)
+	disk->read_ahead_window = max;
+    }
+  else
+    disk->read_ahead_window = 0;
+
+  disk->read_ahead_next = sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+				    >> GRUB_DISK_SECTOR_BITS);
+}
+
+/* Return how many cache units starting at SECTOR to read on a cache miss:
+   the unit itself plus as much of the read-ahead window as is within the
+   disk and not cached yet.  Devices which can read in the background get
+   their read-ahead from grub_disk_prefetch instead.  */
+static unsigned
+grub_disk_read_ahead_units (grub_disk_t disk, grub_disk_addr_t sector)
+{
+  grub_disk_addr_t total_sectors;
+  unsigned num = 1;
+
+  if (disk->dev->disk_read_start)
+    return 1;
+
+  total_sectors = disk->total_sectors << (disk->log_sector_size
+					  - GRUB_DISK_SECTOR_BITS);
+
+  while (num <= disk->read_ahead_window && num < disk->max_agglomerate
+	 && (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
+	     || sector + ((num + 1) << GRUB_DISK_CACHE_BITS) < total_sectors)
+	 && ! grub_disk_cache_find (disk->dev->id, disk->id,
+				    sector + (num << GRUB_DISK_CACHE_BITS)))
+    num++;
+
+  return num;
+}
+
 /* Small read (less than cache size and not pass across cache unit boundaries).
    sector is already adjusted and is divisible by cache unit size.
  */
@@ -330,33 +910,47 @@ grub_disk_read_small_real (grub_disk_t disk, grub_disk_addr_t sector,
       return GRUB_ERR_NONE;
     }
 
-  /* Allocate a temporary buffer.  */
-  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
-  if (! tmp_buf)
-    return grub_errno;
-
   /* Otherwise read data from the disk actually.  */
   if (disk->total_sectors == GRUB_DISK_SIZE_UNKNOWN
       || sector + GRUB_DISK_CACHE_SIZE
       < (disk->total_sectors << (disk->log_sector_size - GRUB_DISK_SECTOR_BITS)))
     {
       grub_err_t err;
+      unsigned num, i;
+
+      num = grub_disk_read_ahead_units (disk, sector);
+
+      /* Allocate a temporary buffer.  */
+      tmp_buf = grub_malloc (num << (GRUB_DISK_CACHE_BITS
+				     + GRUB_DISK_SECTOR_BITS));
+      if (! tmp_buf && num > 1)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  num = 1;
+	  tmp_buf = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+	}
+      if (! tmp_buf)
+	return grub_errno;
+
       err = (disk->dev->disk_read) (disk, transform_sector (disk, sector),
-				    1U << (GRUB_DISK_CACHE_BITS
-					   + GRUB_DISK_SECTOR_BITS
-					   - disk->log_sector_size), tmp_buf);
+				    num << (GRUB_DISK_CACHE_BITS
+					    + GRUB_DISK_SECTOR_BITS
+					    - disk->log_sector_size), tmp_buf);
       if (!err)
 	{
 	  /* Copy it and store it in the disk cache.  */
 	  grub_memcpy (buf, tmp_buf + offset, size);
-	  grub_disk_cache_store (disk->dev->id, disk->id,
-				 sector, tmp_buf);
+	  for (i = 0; i < num; i++)
+	    grub_disk_cache_store (disk->dev->id, disk->id,
+				   sector + (i << GRUB_DISK_CACHE_BITS),
+				   tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+						    + GRUB_DISK_SECTOR_BITS)));
 	  grub_free (tmp_buf);
 	  return GRUB_ERR_NONE;
 	}
+      grub_free (tmp_buf);
     }
 
-  grub_free (tmp_buf);
   grub_errno = GRUB_ERR_NONE;
 
   {
@@ -413,6 +1007,8 @@ grub_err_t
 grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		grub_off_t offset, grub_size_t size, void *buf)
 {
+  int direct;
+
   /* First of all, check if the region is within the disk.  */
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     {
@@ -423,6 +1019,19 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       return grub_errno;
     }
 
+  /* Bulk data is read straight into BUF and not stored in the cache, so
+     that it doesn't evict metadata which will be used again.  */
+  direct = (size >= GRUB_DISK_DIRECT_READ_SIZE
+	    || (disk->direct_read && disk->read_hook
+		&& size >= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS)));
+
+  if (disk->pending)
+    grub_disk_prefetch_reap (disk, sector,
+			     sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+				       >> GRUB_DISK_SECTOR_BITS), direct);
+
+  grub_disk_update_read_ahead (disk, sector, offset, size);
+
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -448,6 +1057,22 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
       offset &= ((1 << GRUB_DISK_SECTOR_BITS) - 1);
     }
 
+  if (direct && size >= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS))
+    {
+      grub_size_t num;
+      grub_err_t err;
+
+      num = size >> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
+      err = grub_disk_read_direct (disk, sector, num, buf);
+      if (err)
+	return err;
+      sector += num << GRUB_DISK_CACHE_BITS;
+      size -= num << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+      buf = (char *) buf + (num << (GRUB_DISK_CACHE_BITS
+				    + GRUB_DISK_SECTOR_BITS));
+      grub_disk_read_ahead_direct (disk, num);
+    }
+
   /* Until SIZE is zero...  */
   while (size >= (GRUB_DISK_CACHE_SIZE << GRUB_DISK_SECTOR_BITS))
     {
@@ -529,6 +1154,10 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	return err;
     }
 
+  /* Direct reads started their own read-ahead above.  */
+  if (! direct)
+    grub_disk_prefetch (disk);
+
   return grub_errno;
 }
 
@@ -57,6 +57,25 @@ grub_file_get_device_name (const char *name)
   return 0;
 }
 
+/* Files which loaders read once in bulk.  Their data shouldn't displace
+   filesystem metadata from the disk cache.  */
+static int
+grub_file_type_is_bulk (enum grub_file_type type)
+{
+  switch (type & GRUB_FILE_TYPE_MASK)
+    {
+    case GRUB_FILE_TYPE_LINUX_KERNEL:
+    case GRUB_FILE_TYPE_LINUX_INITRD:
+    case GRUB_FILE_TYPE_MULTIBOOT_KERNEL:
+    case GRUB_FILE_TYPE_MULTIBOOT_MODULE:
+    case GRUB_FILE_TYPE_XEN_HYPERVISOR:
+    case GRUB_FILE_TYPE_XEN_MODULE:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
 grub_file_t
 grub_file_open (const char *name, enum grub_file_type type)
 {
@@ -87,6 +106,7 @@ grub_file_open (const char *name, enum grub_file_type type)
     goto fail;
 
   file->device = device;
+  file->direct_read = grub_file_type_is_bulk (type);
 
   /* In case of relative pathnames and non-Unix systems (like Windows)
    * name of host files may not start with `/'. Blocklists for host files
@@ -143,12 +163,24 @@ grub_file_open (const char *name, enum grub_file_type type)
 
 grub_disk_read_hook_t grub_file_progress_hook;
 
+/* Filesystems only set the read hook of the disk while reading file data,
+   which is what tells grub_disk_read that a read may bypass the cache.  */
+static void
+grub_file_data_hook (grub_disk_addr_t sector __attribute__ ((unused)),
+		     unsigned offset __attribute__ ((unused)),
+		     unsigned length __attribute__ ((unused)),
+		     void *data __attribute__ ((unused)))
+{
+}
+
 grub_ssize_t
 grub_file_read (grub_file_t file, void *buf, grub_size_t len)
 {
   grub_ssize_t res;
   grub_disk_read_hook_t read_hook;
   void *read_hook_data;
+  grub_disk_t disk = file->device ? file->device->disk : NULL;
+  int direct_read = 0;
 
   if (file->offset > file->size)
     {
@@ -177,7 +209,16 @@ grub_file_read (grub_file_t file, void *buf, grub_size_t len)
       file->read_hook_data = file;
       file->progress_offset = file->offset;
     }
+  if (file->direct_read && !file->read_hook)
+    file->read_hook = grub_file_data_hook;
+  if (disk)
+    {
+      direct_read = disk->direct_read;
+      disk->direct_read = file->direct_read;
+    }
   res = (file->fs->fs_read) (file, buf, len);
+  if (disk)
+    disk->direct_read = direct_read;
   file->read_hook = read_hook;
   file->read_hook_data = read_hook_data;
   if (res > 0)
@@ -0,0 +1,540 @@
+/* argon2.c - Argon2 password hashing (RFC 9106).  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/crypto.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define ARGON2_VERSION 0x13
+#define ARGON2_BLOCK_SIZE 1024
+#define ARGON2_QWORDS_IN_BLOCK (ARGON2_BLOCK_SIZE / 8)
+#define ARGON2_SYNC_POINTS 4
+#define ARGON2_PREHASH_LEN 64
+
+#define BLAKE2B_BLOCK_SIZE 128
+#define BLAKE2B_OUT_SIZE 64
+
+struct blake2b_state
+{
+  grub_uint64_t h[8];
+  grub_uint64_t t[2];
+  grub_uint8_t buf[BLAKE2B_BLOCK_SIZE];
+  grub_size_t buflen;
+  grub_size_t outlen;
+};
+
+struct argon2_block
+{
+  grub_uint64_t v[ARGON2_QWORDS_IN_BLOCK];
+};
+
+static const grub_uint64_t blake2b_iv[8] =
+  {
+    0x6a09e667f3bcc908ULL, 0xbb67ae8584caa73bULL,
+    0x3c6ef372fe94f82bULL, 0xa54ff53a5f1d36f1ULL,
+    0x510e527fade682d1ULL, 0x9b05688c2b3e6c1fULL,
+    0x1f83d9abfb41bd6bULL, 0x5be0cd19137e2179ULL
+  };
+
+static const grub_uint8_t blake2b_sigma[12][16] =
+  {
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+    { 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+    {  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+    {  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+    {  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+    { 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+    { 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+    {  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+    { 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+    {  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+    { 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+  };
+
+static inline grub_uint64_t
+rotr64 (grub_uint64_t x, unsigned n)
+{
+  return (x >> n) | (x << (64 - n));
+}
+
+static inline grub_uint64_t
+load64 (const grub_uint8_t *p)
+{
+  grub_uint64_t v;
+
+  grub_memcpy (&v, p, sizeof (v));
+  return grub_le_to_cpu64 (v);
+}
+
+static inline void
+store64 (grub_uint8_t *p, grub_uint64_t v)
+{
+  v = grub_cpu_to_le64 (v);
+  grub_memcpy (p, &v, sizeof (v));
+}
+
+static inline void
+store32 (grub_uint8_t *p, grub_uint32_t v)
+{
+  v = grub_cpu_to_le32 (v);
+  grub_memcpy (p, &v, sizeof (v));
+}
+
+#define BLAKE2B_G(r, i, a, b, c, d)				\
+  do {								\
+    a = a + b + m[blake2b_sigma[r][2 * i]];			\
+    d = rotr64 (d ^ a, 32);					\
+    c = c + d;							\
+    b = rotr64 (b ^ c, 24);					\
+    a = a + b + m[blake2b_sigma[r][2 * i + 1]];			\
+    d = rotr64 (d ^ a, 16);					\
+    c = c + d;							\
+    b = rotr64 (b ^ c, 63);					\
+  } while (0)
+
+static void
+blake2b_compress (struct blake2b_state *S, const grub_uint8_t *block,
+		  int last)
+{
+  grub_uint64_t m[16], v[16];
+  unsigned i, r;
+
+  for (i = 0; i < 16; i++)
+    m[i] = load64 (block + 8 * i);
+  for (i = 0; i < 8; i++)
+    {
+      v[i] = S->h[i];
+      v[i + 8] = blake2b_iv[i];
+    }
+  v[12] ^= S->t[0];
+  v[13] ^= S->t[1];
+  if (last)
+    v[14] = ~v[14];
+
+  for (r = 0; r < 12; r++)
+    {
+      BLAKE2B_G (r, 0, v[0], v[4], v[8], v[12]);
+      BLAKE2B_G (r, 1, v[1], v[5], v[9], v[13]);
+      BLAKE2B_G (r, 2, v[2], v[6], v[10], v[14]);
+      BLAKE2B_G (r, 3, v[3], v[7], v[11], v[15]);
+      BLAKE2B_G (r, 4, v[0], v[5], v[10], v[15]);
+      BLAKE2B_G (r, 5, v[1], v[6], v[11], v[12]);
+      BLAKE2B_G (r, 6, v[2], v[7], v[8], v[13]);
+      BLAKE2B_G (r, 7, v[3], v[4], v[9], v[14]);
+    }
+
+  for (i = 0; i < 8; i++)
+    S->h[i] ^= v[i] ^ v[i + 8];
+}
+
+static void
+blake2b_init (struct blake2b_state *S, grub_size_t outlen)
+{
+  unsigned i;
+
+  grub_memset (S, 0, sizeof (*S));
+  for (i = 0; i < 8; i++)
+    S->h[i] = blake2b_iv[i];
+  /* Digest length, no key, fanout and depth of 1.  */
+  S->h[0] ^= 0x01010000 ^ outlen;
+  S->outlen = outlen;
+}
+
+static void
+blake2b_increment (struct blake2b_state *S, grub_uint64_t inc)
+{
+  S->t[0] += inc;
+  if (S->t[0] < inc)
+    S->t[1]++;
+}
+
+static void
+blake2b_update (struct blake2b_state *S, const void *in, grub_size_t inlen)
+{
+  const grub_uint8_t *ptr = in;
+
+  while (inlen)
+    {
+      grub_size_t fill;
+
+      /* The last block is compressed differently, so keep a full block
+	 buffered until more data arrives.  */
+      if (S->buflen == BLAKE2B_BLOCK_SIZE)
+	{
+	  blake2b_increment (S, BLAKE2B_BLOCK_SIZE);
+	  blake2b_compress (S, S->buf, 0);
+	  S->buflen = 0;
+	}
+      fill = BLAKE2B_BLOCK_SIZE - S->buflen;
+      if (fill > inlen)
+	fill = inlen;
+      grub_memcpy (S->buf + S->buflen, ptr, fill);
+      S->buflen += fill;
+      ptr += fill;
+      inlen -= fill;
+    }
+}
+
+static void
+blake2b_final (struct blake2b_state *S, grub_uint8_t *out)
+{
+  grub_uint8_t buf[BLAKE2B_OUT_SIZE];
+  unsigned i;
+
+  blake2b_increment (S, S->buflen);
+  grub_memset (S->buf + S->buflen, 0, BLAKE2B_BLOCK_SIZE - S->buflen);
+  blake2b_compress (S, S->buf, 1);
+  for (i = 0; i < 8; i++)
+    store64 (buf + 8 * i, S->h[i]);
+  grub_memcpy (out, buf, S->outlen);
+  grub_memset (buf, 0, sizeof (buf));
+  grub_memset (S, 0, sizeof (*S));
+}
+
+/* The variable length hash H' of RFC 9106, section 3.3.  */
+static void
+argon2_hash_long (grub_uint8_t *out, grub_uint32_t outlen,
+		  const void *in, grub_size_t inlen)
+{
+  struct blake2b_state S;
+  grub_uint8_t lenbuf[4];
+  grub_uint8_t V[BLAKE2B_OUT_SIZE];
+  grub_uint32_t left;
+
+  store32 (lenbuf, outlen);
+  if (outlen <= BLAKE2B_OUT_SIZE)
+    {
+      blake2b_init (&S, outlen);
+      blake2b_update (&S, lenbuf, sizeof (lenbuf));
+      blake2b_update (&S, in, inlen);
+      blake2b_final (&S, out);
+      return;
+    }
+
+  blake2b_init (&S, BLAKE2B_OUT_SIZE);
+  blake2b_update (&S, lenbuf, sizeof (lenbuf));
+  blake2b_update (&S, in, inlen);
+  blake2b_final (&S, V);
+  grub_memcpy (out, V, BLAKE2B_OUT_SIZE / 2);
+  out += BLAKE2B_OUT_SIZE / 2;
+  left = outlen - BLAKE2B_OUT_SIZE / 2;
+  while (left > BLAKE2B_OUT_SIZE)
+    {
+      blake2b_init (&S, BLAKE2B_OUT_SIZE);
+      blake2b_update (&S, V, BLAKE2B_OUT_SIZE);
+      blake2b_final (&S, V);
+      grub_memcpy (out, V, BLAKE2B_OUT_SIZE / 2);
+      out += BLAKE2B_OUT_SIZE / 2;
+      left -= BLAKE2B_OUT_SIZE / 2;
+    }
+  blake2b_init (&S, left);
+  blake2b_update (&S, V, BLAKE2B_OUT_SIZE);
+  blake2b_final (&S, out);
+  grub_memset (V, 0, sizeof (V));
+}
+
+/* BLAKE2b round function with the multiplications of Argon2.  */
+static inline grub_uint64_t
+fblamka (grub_uint64_t x, grub_uint64_t y)
+{
+  return x + y + 2 * (x & 0xffffffff) * (y & 0xffffffff);
+}
+
+#define ARGON2_G(a, b, c, d)					\
+  do {								\
+    a = fblamka (a, b);						\
+    d = rotr64 (d ^ a, 32);					\
+    c = fblamka (c, d);						\
+    b = rotr64 (b ^ c, 24);					\
+    a = fblamka (a, b);						\
+    d = rotr64 (d ^ a, 16);					\
+    c = fblamka (c, d);						\
+    b = rotr64 (b ^ c, 63);					\
+  } while (0)
+
+#define ARGON2_ROUND(v0, v1, v2, v3, v4, v5, v6, v7,		\
+		     v8, v9, v10, v11, v12, v13, v14, v15)	\
+  do {								\
+    ARGON2_G (v0, v4, v8, v12);					\
+    ARGON2_G (v1, v5, v9, v13);					\
+    ARGON2_G (v2, v6, v10, v14);				\
+    ARGON2_G (v3, v7, v11, v15);				\
+    ARGON2_G (v0, v5, v10, v15);				\
+    ARGON2_G (v1, v6, v11, v12);				\
+    ARGON2_G (v2, v7, v8, v13);					\
+    ARGON2_G (v3, v4, v9, v14);					\
+  } while (0)
+
+/* The compression function G: NEXT = G (PREV, REF), XORed into the old
+   NEXT on passes after the first one.  */
+static void
+fill_block (const struct argon2_block *prev, const struct argon2_block *ref,
+	    struct argon2_block *next, int with_xor)
+{
+  struct argon2_block r, tmp;
+  grub_uint64_t *v = r.v;
+  unsigned i;
+
+  for (i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++)
+    r.v[i] = prev->v[i] ^ ref->v[i];
+  tmp = r;
+  if (with_xor)
+    for (i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++)
+      tmp.v[i] ^= next->v[i];
+
+  /* Rows of 16 words.  */
+  for (i = 0; i < 8; i++)
+    ARGON2_ROUND (v[16 * i], v[16 * i + 1], v[16 * i + 2], v[16 * i + 3],
+		  v[16 * i + 4], v[16 * i + 5], v[16 * i + 6], v[16 * i + 7],
+		  v[16 * i + 8], v[16 * i + 9], v[16 * i + 10],
+		  v[16 * i + 11], v[16 * i + 12], v[16 * i + 13],
+		  v[16 * i + 14], v[16 * i + 15]);
+  /* Columns of pairs of words.  */
+  for (i = 0; i < 8; i++)
+    ARGON2_ROUND (v[2 * i], v[2 * i + 1], v[2 * i + 16], v[2 * i + 17],
+		  v[2 * i + 32], v[2 * i + 33], v[2 * i + 48], v[2 * i + 49],
+		  v[2 * i + 64], v[2 * i + 65], v[2 * i + 80], v[2 * i + 81],
+		  v[2 * i + 96], v[2 * i + 97], v[2 * i + 112],
+		  v[2 * i + 113]);
+
+  for (i = 0; i < ARGON2_QWORDS_IN_BLOCK; i++)
+    next->v[i] = tmp.v[i] ^ r.v[i];
+}
+
+struct argon2_instance
+{
+  struct argon2_block *memory;
+  grub_uint32_t passes;
+  grub_uint32_t memory_blocks;
+  grub_uint32_t lanes;
+  grub_uint32_t lane_length;
+  grub_uint32_t segment_length;
+  grub_crypto_argon2_type_t type;
+};
+
+/* Next block of pseudo-random reference indices for Argon2i.  */
+static void
+next_addresses (struct argon2_block *address, struct argon2_block *input)
+{
+  struct argon2_block zero;
+
+  grub_memset (&zero, 0, sizeof (zero));
+  input->v[6]++;
+  fill_block (&zero, input, address, 0);
+  fill_block (&zero, address, address, 0);
+}
+
+/* Map the 32-bit PSEUDO_RAND to a block of the reference area, RFC 9106
+   section 3.4.1.2.  */
+static grub_uint32_t
+index_alpha (const struct argon2_instance *inst, grub_uint32_t pass,
+	     grub_uint32_t slice, grub_uint32_t index,
+	     grub_uint32_t pseudo_rand, int same_lane)
+{
+  grub_uint32_t area_size, start = 0;
+  grub_uint64_t rel;
+
+  if (pass == 0)
+    {
+      if (slice == 0)
+	area_size = index - 1;
+      else if (same_lane)
+	area_size = slice * inst->segment_length + index - 1;
+      else
+	area_size = slice * inst->segment_length - (index == 0);
+    }
+  else
+    {
+      if (same_lane)
+	area_size = inst->lane_length - inst->segment_length + index - 1;
+      else
+	area_size = inst->lane_length - inst->segment_length - (index == 0);
+    }
+
+  rel = pseudo_rand;
+  rel = (rel * rel) >> 32;
+  rel = area_size - 1 - ((area_size * rel) >> 32);
+
+  if (pass != 0 && slice != ARGON2_SYNC_POINTS - 1)
+    start = (slice + 1) * inst->segment_length;
+
+  return (start + rel) % inst->lane_length;
+}
+
+static void
+fill_segment (const struct argon2_instance *inst, grub_uint32_t pass,
+	      grub_uint32_t slice, grub_uint32_t lane)
+{
+  struct argon2_block address, input;
+  grub_uint32_t start = 0, i, ref_lane, ref_index;
+  grub_uint32_t curr, prev;
+  grub_uint64_t pseudo_rand;
+  int independent;
+
+  independent = (inst->type == GRUB_CRYPTO_ARGON2I
+		 || (inst->type == GRUB_CRYPTO_ARGON2ID && pass == 0
+		     && slice < ARGON2_SYNC_POINTS / 2));
+
+  if (independent)
+    {
+      grub_memset (&input, 0, sizeof (input));
+      input.v[0] = pass;
+      input.v[1] = lane;
+      input.v[2] = slice;
+      input.v[3] = inst->memory_blocks;
+      input.v[4] = inst->passes;
+      input.v[5] = inst->type;
+    }
+
+  /* The first two blocks of each lane come from the initial hash.  */
+  if (pass == 0 && slice == 0)
+    {
+      start = 2;
+      if (independent)
+	next_addresses (&address, &input);
+    }
+
+  curr = lane * inst->lane_length + slice * inst->segment_length + start;
+  if (curr % inst->lane_length == 0)
+    prev = curr + inst->lane_length - 1;
+  else
+    prev = curr - 1;
+
+  for (i = start; i < inst->segment_length; i++, curr++, prev++)
+    {
+      if (curr % inst->lane_length == 1)
+	prev = curr - 1;
+
+      if (independent)
+	{
+	  if (i % ARGON2_QWORDS_IN_BLOCK == 0)
+	    next_addresses (&address, &input);
+	  pseudo_rand = address.v[i % ARGON2_QWORDS_IN_BLOCK];
+	}
+      else
+	pseudo_rand = inst->memory[prev].v[0];
+
+      ref_lane = (pseudo_rand >> 32) % inst->lanes;
+      if (pass == 0 && slice == 0)
+	ref_lane = lane;
+      ref_index = index_alpha (inst, pass, slice, i, pseudo_rand & 0xffffffff,
+			       ref_lane == lane);
+
+      fill_block (&inst->memory[prev],
+		  &inst->memory[inst->lane_length * ref_lane + ref_index],
+		  &inst->memory[curr], pass != 0);
+    }
+}
+
+gcry_err_code_t
+grub_crypto_argon2 (grub_crypto_argon2_type_t type,
+		    const grub_uint8_t *P, grub_size_t Plen,
+		    const grub_uint8_t *S, grub_size_t Slen,
+		    grub_uint32_t t_cost, grub_uint32_t m_cost,
+		    grub_uint32_t lanes,
+		    grub_uint8_t *DK, grub_size_t dkLen)
+{
+  struct argon2_instance inst;
+  struct blake2b_state H;
+  grub_uint8_t blockhash[ARGON2_PREHASH_LEN + 8];
+  grub_uint8_t buf[ARGON2_BLOCK_SIZE];
+  grub_uint8_t param[4];
+  struct argon2_block final;
+  grub_uint32_t pass, slice, lane, i, j;
+  grub_uint64_t memsize;
+
+  if (type != GRUB_CRYPTO_ARGON2I && type != GRUB_CRYPTO_ARGON2ID)
+    return GPG_ERR_INV_ARG;
+  if (t_cost == 0 || lanes == 0 || lanes > 0xffffff
+      || dkLen < 4 || dkLen > 0xffffffff
+      || Plen > 0xffffffff || Slen > 0xffffffff
+      || m_cost < 2 * ARGON2_SYNC_POINTS * lanes)
+    return GPG_ERR_INV_ARG;
+
+  inst.type = type;
+  inst.passes = t_cost;
+  inst.lanes = lanes;
+  inst.segment_length = m_cost / (lanes * ARGON2_SYNC_POINTS);
+  inst.lane_length = inst.segment_length * ARGON2_SYNC_POINTS;
+  inst.memory_blocks = inst.lane_length * lanes;
+  memsize = (grub_uint64_t) inst.memory_blocks * sizeof (struct argon2_block);
+  if (memsize != (grub_size_t) memsize)
+    return GPG_ERR_OUT_OF_MEMORY;
+  inst.memory = grub_malloc (memsize);
+  if (!inst.memory)
+    return GPG_ERR_OUT_OF_MEMORY;
+
+  /* H0, with neither secret nor associated data.  */
+  blake2b_init (&H, ARGON2_PREHASH_LEN);
+#define ADD32(x) do { store32 (param, (x)); \
+    blake2b_update (&H, param, sizeof (param)); } while (0)
+  ADD32 (lanes);
+  ADD32 (dkLen);
+  ADD32 (m_cost);
+  ADD32 (t_cost);
+  ADD32 (ARGON2_VERSION);
+  ADD32 (type);
+  ADD32 (Plen);
+  blake2b_update (&H, P, Plen);
+  ADD32 (Slen);
+  blake2b_update (&H, S, Slen);
+  ADD32 (0);
+  ADD32 (0);
+#undef ADD32
+  blake2b_final (&H, blockhash);
+
+  for (lane = 0; lane < lanes; lane++)
+    for (i = 0; i < 2; i++)
+      {
+	struct argon2_block *b = &inst.memory[lane * inst.lane_length + i];
+
+	store32 (blockhash + ARGON2_PREHASH_LEN, i);
+	store32 (blockhash + ARGON2_PREHASH_LEN + 4, lane);
+	argon2_hash_long (buf, ARGON2_BLOCK_SIZE, blockhash,
+			  sizeof (blockhash));
+	for (j = 0; j < ARGON2_QWORDS_IN_BLOCK; j++)
+	  b->v[j] = load64 (buf + 8 * j);
+      }
+
+  /* Lanes would be independent within a slice, but we have one CPU.  */
+  for (pass = 0; pass < t_cost; pass++)
+    for (slice = 0; slice < ARGON2_SYNC_POINTS; slice++)
+      for (lane = 0; lane < lanes; lane++)
+	fill_segment (&inst, pass, slice, lane);
+
+  final = inst.memory[inst.lane_length - 1];
+  for (lane = 1; lane < lanes; lane++)
+    for (j = 0; j < ARGON2_QWORDS_IN_BLOCK; j++)
+      final.v[j] ^= inst.memory[lane * inst.lane_length
+				+ inst.lane_length - 1].v[j];
+  for (j = 0; j < ARGON2_QWORDS_IN_BLOCK; j++)
+    store64 (buf + 8 * j, final.v[j]);
+  argon2_hash_long (DK, dkLen, buf, sizeof (buf));
+
+  grub_memset (inst.memory, 0, memsize);
+  grub_free (inst.memory);
+  grub_memset (buf, 0, sizeof (buf));
+  grub_memset (&final, 0, sizeof (final));
+  grub_memset (blockhash, 0, sizeof (blockhash));
+  return GPG_ERR_NO_ERROR;
+}
@@ -212,6 +212,11 @@ grub_crypto_ecb_decrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->decrypt_blocks)
+    {
+      cipher->cipher->decrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
@@ -232,6 +237,11 @@ grub_crypto_ecb_encrypt (grub_crypto_cipher_handle_t cipher,
   if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
       || ((size & (blocksize - 1)) != 0))
     return GPG_ERR_INV_ARG;
+  if (cipher->cipher->encrypt_blocks)
+    {
+      cipher->cipher->encrypt_blocks (cipher->ctx, out, in, size / blocksize);
+      return GPG_ERR_NO_ERROR;
+    }
   end = (const grub_uint8_t *) in + size;
   for (inptr = in, outptr = out; inptr < end;
        inptr += blocksize, outptr += blocksize)
@@ -296,6 +306,135 @@ grub_crypto_cbc_decrypt (grub_crypto_cipher_handle_t cipher,
   return GPG_ERR_NO_ERROR;
 }
 
+gcry_err_code_t
+grub_crypto_cbc_decrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs)
+{
+  grub_uint8_t *ptr = data, *saved;
+  const grub_uint8_t *iv = ivs;
+  grub_size_t blocksize, i;
+  gcry_err_code_t err;
+
+  blocksize = cipher->cipher->blocksize;
+  if (blocksize == 0 || (((blocksize - 1) & blocksize) != 0)
+      || blocksize > GRUB_CRYPTO_MAX_CIPHER_BLOCKSIZE
+      || sector_size == 0 || ((sector_size & (blocksize - 1)) != 0)
+      || (size % sector_size) != 0)
+    return GPG_ERR_INV_ARG;
+
+  /* CBC decryption doesn't chain, so decrypt every block of all sectors
+     in one call and XOR the previous ciphertext block afterwards.  */
+  saved = grub_malloc (size);
+  if (!saved)
+    return GPG_ERR_OUT_OF_MEMORY;
+  grub_memcpy (saved, ptr, size);
+  err = grub_crypto_ecb_decrypt (cipher, ptr, saved, size);
+  if (err)
+    {
+      grub_free (saved);
+      return err;
+    }
+  for (i = 0; i < size; i += sector_size, iv += blocksize)
+    {
+      grub_crypto_xor (ptr + i, ptr + i, iv, blocksize);
+      grub_crypto_xor (ptr + i + blocksize, ptr + i + blocksize, saved + i,
+		       sector_size - blocksize);
+    }
+  grub_free (saved);
+  return GPG_ERR_NO_ERROR;
+}
+
+#define XTS_BLOCKSIZE 16
+/* Lowest byte of x^128+x^7+x^2+x+1.  */
+#define XTS_POLYNOM 0x87
+
+/* OUT = IN * x in GF(2^128), both little endian.  */
+static void
+xts_mul_x (grub_uint8_t *out, const grub_uint8_t *in)
+{
+  grub_uint64_t lo, hi, carry;
+
+  grub_memcpy (&lo, in, sizeof (lo));
+  grub_memcpy (&hi, in + sizeof (lo), sizeof (hi));
+  lo = grub_le_to_cpu64 (lo);
+  hi = grub_le_to_cpu64 (hi);
+  carry = hi >> 63;
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (carry * XTS_POLYNOM);
+  lo = grub_cpu_to_le64 (lo);
+  hi = grub_cpu_to_le64 (hi);
+  grub_memcpy (out, &lo, sizeof (lo));
+  grub_memcpy (out + sizeof (lo), &hi, sizeof (hi));
+}
+
+static gcry_err_code_t
+xts_crypt_sectors (grub_crypto_cipher_handle_t cipher,
+		   grub_crypto_cipher_handle_t tweak_cipher,
+		   void *data, grub_size_t size,
+		   grub_size_t sector_size, const void *ivs, int do_encrypt)
+{
+  grub_uint8_t *tweaks, *t;
+  grub_size_t nsectors, i, j;
+  gcry_err_code_t err;
+
+  if (cipher->cipher->blocksize != XTS_BLOCKSIZE
+      || tweak_cipher->cipher->blocksize != XTS_BLOCKSIZE
+      || sector_size == 0 || (sector_size % XTS_BLOCKSIZE) != 0
+      || (size % sector_size) != 0)
+    return GPG_ERR_INV_ARG;
+  nsectors = size / sector_size;
+
+  /* One tweak per block, followed by the encrypted IVs.  */
+  tweaks = grub_malloc (size + nsectors * XTS_BLOCKSIZE);
+  if (!tweaks)
+    return GPG_ERR_OUT_OF_MEMORY;
+  err = grub_crypto_ecb_encrypt (tweak_cipher, tweaks + size, ivs,
+				 nsectors * XTS_BLOCKSIZE);
+  if (err)
+    goto out;
+  for (i = 0; i < nsectors; i++)
+    {
+      t = tweaks + i * sector_size;
+      grub_memcpy (t, tweaks + size + i * XTS_BLOCKSIZE, XTS_BLOCKSIZE);
+      for (j = XTS_BLOCKSIZE; j < sector_size; j += XTS_BLOCKSIZE)
+	xts_mul_x (t + j, t + j - XTS_BLOCKSIZE);
+    }
+
+  grub_crypto_xor (data, data, tweaks, size);
+  if (do_encrypt)
+    err = grub_crypto_ecb_encrypt (cipher, data, data, size);
+  else
+    err = grub_crypto_ecb_decrypt (cipher, data, data, size);
+  if (err)
+    goto out;
+  grub_crypto_xor (data, data, tweaks, size);
+
+ out:
+  grub_free (tweaks);
+  return err;
+}
+
+gcry_err_code_t
+grub_crypto_xts_encrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 grub_crypto_cipher_handle_t tweak_cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs)
+{
+  return xts_crypt_sectors (cipher, tweak_cipher, data, size, sector_size,
+			    ivs, 1);
+}
+
+gcry_err_code_t
+grub_crypto_xts_decrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 grub_crypto_cipher_handle_t tweak_cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs)
+{
+  return xts_crypt_sectors (cipher, tweak_cipher, data, size, sector_size,
+			    ivs, 0);
+}
+
 /* Based on gcry/cipher/md.c.  */
 struct grub_crypto_hmac_handle *
 grub_crypto_hmac_init (const struct gcry_md_spec *md,
@@ -0,0 +1,185 @@
+/* lz4.c - LZ4 block decompression.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A block is a sequence of sequences, each made of a token byte, the
+ * literal length if the top half of the token is 15, the literals, a
+ * 16-bit little-endian match offset and the match length if the bottom
+ * half of the token is 15.  Matches are at least 4 bytes long.  The last
+ * sequence has literals only and ends the block.
+ *
+ * Literals and matches are copied 16 bytes at a time, which may write past
+ * their end: this is only done when both buffers have room left for it.
+ * Most sequences are short, so as long as the input and output are far
+ * enough from their ends, sequences with short literals and matches are
+ * copied with a fixed number of wide moves.
+ */
+
+#include <grub/dl.h>
+#include <grub/err.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define LZ4_MIN_MATCH 4
+#define LZ4_WILD_COPY 16
+
+static inline void
+copy8 (grub_uint8_t *dst, const grub_uint8_t *src)
+{
+  grub_set_unaligned64 (dst, grub_get_unaligned64 (src));
+}
+
+/* Copy from SRC to DST in steps of 16 bytes until DST reaches END,
+   writing up to 15 bytes past it.  If the two overlap, SRC must be at
+   least 8 bytes before DST.  */
+static inline void
+wild_copy (grub_uint8_t *dst, const grub_uint8_t *src, grub_uint8_t *end)
+{
+  while (dst < end)
+    {
+      copy8 (dst, src);
+      copy8 (dst + 8, src + 8);
+      dst += LZ4_WILD_COPY;
+      src += LZ4_WILD_COPY;
+    }
+}
+
+/* Add the extra length bytes at *IP to *LEN.  */
+static int
+read_length (const grub_uint8_t **ip, const grub_uint8_t *iend,
+	     grub_size_t *len)
+{
+  grub_uint8_t s;
+
+  do
+    {
+      if (*ip >= iend || *len > GRUB_SIZE_MAX - 255)
+	return 0;
+      s = *(*ip)++;
+      *len += s;
+    }
+  while (s == 255);
+  return 1;
+}
+
+/* Smallest multiple of the offset which is at least 8, for offsets below
+   8.  */
+static const grub_uint8_t pattern_step[8] =
+  { 0, 8, 8, 9, 8, 10, 12, 14 };
+
+grub_ssize_t
+grub_lz4_decompress (const void *inbuf, grub_size_t insize,
+		     void *outbuf, grub_size_t outsize)
+{
+  const grub_uint8_t *ip = inbuf;
+  const grub_uint8_t *const iend = ip + insize;
+  grub_uint8_t *op = outbuf;
+  grub_uint8_t *const ostart = op;
+  grub_uint8_t *const oend = op + outsize;
+  const grub_uint8_t *match;
+  grub_size_t lit, len, offset, i;
+  unsigned token;
+
+  while (1)
+    {
+      if (ip >= iend)
+	goto corrupted;
+      token = *ip++;
+      lit = token >> 4;
+      len = token & 15;
+
+      /*
+       * Fast path.  With at least 16 input bytes left this isn't the last
+       * sequence, and at most 14 literals and 18 match bytes fit in the
+       * 32 output bytes left.
+       */
+      if (lit < 15 && iend - ip >= 16 && oend - op >= 32)
+	{
+	  copy8 (op, ip);
+	  copy8 (op + 8, ip + 8);
+	  op += lit;
+	  ip += lit;
+	  offset = grub_le_to_cpu16 (grub_get_unaligned16 (ip));
+	  ip += 2;
+	  if (len < 15 && offset >= 8
+	      && offset <= (grub_size_t) (op - ostart))
+	    {
+	      match = op - offset;
+	      copy8 (op, match);
+	      copy8 (op + 8, match + 8);
+	      grub_set_unaligned16 (op + 16, grub_get_unaligned16 (match + 16));
+	      op += len + LZ4_MIN_MATCH;
+	      continue;
+	    }
+	  goto copy_match;
+	}
+
+      if (lit == 15 && !read_length (&ip, iend, &lit))
+	goto corrupted;
+      if (lit > (grub_size_t) (iend - ip) || lit > (grub_size_t) (oend - op))
+	goto corrupted;
+      if ((grub_size_t) (iend - ip) - lit >= LZ4_WILD_COPY
+	  && (grub_size_t) (oend - op) - lit >= LZ4_WILD_COPY)
+	wild_copy (op, ip, op + lit);
+      else
+	grub_memmove (op, ip, lit);
+      op += lit;
+      ip += lit;
+
+      if (ip == iend)
+	break;
+      if (iend - ip < 2)
+	goto corrupted;
+      offset = grub_le_to_cpu16 (grub_get_unaligned16 (ip));
+      ip += 2;
+
+    copy_match:
+      if (len == 15 && !read_length (&ip, iend, &len))
+	goto corrupted;
+      len += LZ4_MIN_MATCH;
+      if (offset == 0 || offset > (grub_size_t) (op - ostart)
+	  || len > (grub_size_t) (oend - op))
+	goto corrupted;
+      match = op - offset;
+
+      if ((grub_size_t) (oend - op) - len < LZ4_WILD_COPY)
+	for (i = 0; i < len; i++)
+	  op[i] = match[i];
+      else if (offset < 8)
+	{
+	  /* Lay out the repeating pattern, then copy it from far enough
+	     back for the wide copies not to overlap.  */
+	  for (i = 0; i < 8; i++)
+	    op[i] = match[i];
+	  wild_copy (op + 8, op + 8 - pattern_step[offset], op + len);
+	}
+      else
+	wild_copy (op, match, op + len);
+      op += len;
+    }
+
+  return op - ostart;
+
+ corrupted:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 block");
+  return -1;
+}
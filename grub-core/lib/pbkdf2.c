@@ -42,18 +42,24 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   unsigned int hLen = md->mdlen;
   grub_uint8_t U[GRUB_CRYPTO_MAX_MDLEN];
   grub_uint8_t T[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t key[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint8_t counter[4];
   unsigned int u;
   unsigned int l;
   unsigned int r;
   unsigned int i;
   unsigned int k;
-  gcry_err_code_t rc;
-  grub_uint8_t *tmp;
-  grub_size_t tmplen = Slen + 4;
+  grub_uint8_t *pad;
+  grub_size_t ctxsize;
+  grub_uint8_t *mem;
+  void *ictx, *octx, *ctx;
 
   if (md->mdlen > GRUB_CRYPTO_MAX_MDLEN || md->mdlen == 0)
     return GPG_ERR_INV_ARG;
 
+  if (md->mdlen > md->blocksize)
+    return GPG_ERR_INV_ARG;
+
   if (c == 0)
     return GPG_ERR_INV_ARG;
 
@@ -66,11 +72,35 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   l = ((dkLen - 1) / hLen) + 1;
   r = dkLen - (l - 1) * hLen;
 
-  tmp = grub_malloc (tmplen);
-  if (tmp == NULL)
+  /* The HMAC key is the same for every iteration: hash the padded key into
+     the inner and outer contexts once, and only copy them afterwards.  */
+  ctxsize = ALIGN_UP (md->contextsize, sizeof (grub_uint64_t));
+  mem = grub_malloc (3 * ctxsize + md->blocksize);
+  if (mem == NULL)
     return GPG_ERR_OUT_OF_MEMORY;
+  ictx = mem;
+  octx = mem + ctxsize;
+  ctx = mem + 2 * ctxsize;
+  pad = mem + 3 * ctxsize;
+
+  if (Plen > md->blocksize)
+    {
+      grub_crypto_hash (md, key, P, Plen);
+      P = key;
+      Plen = hLen;
+    }
+
+  grub_memset (pad, 0x36, md->blocksize);
+  for (k = 0; k < Plen; k++)
+    pad[k] ^= P[k];
+  md->init (ictx);
+  md->write (ictx, pad, md->blocksize);
 
-  grub_memcpy (tmp, S, Slen);
+  grub_memset (pad, 0x5c, md->blocksize);
+  for (k = 0; k < Plen; k++)
+    pad[k] ^= P[k];
+  md->init (octx);
+  md->write (octx, pad, md->blocksize);
 
   for (i = 1; i - 1 < l; i++)
     {
@@ -78,23 +108,26 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 
       for (u = 0; u < c; u++)
 	{
+	  grub_memcpy (ctx, ictx, md->contextsize);
 	  if (u == 0)
 	    {
-	      tmp[Slen + 0] = (i & 0xff000000) >> 24;
-	      tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
-	      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
-	      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
+	      counter[0] = (i & 0xff000000) >> 24;
+	      counter[1] = (i & 0x00ff0000) >> 16;
+	      counter[2] = (i & 0x0000ff00) >> 8;
+	      counter[3] = (i & 0x000000ff) >> 0;
 
-	      rc = grub_crypto_hmac_buffer (md, P, Plen, tmp, tmplen, U);
+	      md->write (ctx, S, Slen);
+	      md->write (ctx, counter, sizeof (counter));
 	    }
 	  else
-	    rc = grub_crypto_hmac_buffer (md, P, Plen, U, hLen, U);
+	    md->write (ctx, U, hLen);
+	  md->final (ctx);
+	  grub_memcpy (U, md->read (ctx), hLen);
 
-	  if (rc != GPG_ERR_NO_ERROR)
-	    {
-	      grub_free (tmp);
-	      return rc;
-	    }
+	  grub_memcpy (ctx, octx, md->contextsize);
+	  md->write (ctx, U, hLen);
+	  md->final (ctx);
+	  grub_memcpy (U, md->read (ctx), hLen);
 
 	  for (k = 0; k < hLen; k++)
 	    T[k] ^= U[k];
@@ -103,7 +136,11 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
       grub_memcpy (DK + (i - 1) * hLen, T, i == l ? r : hLen);
     }
 
-  grub_free (tmp);
+  grub_memset (mem, 0, 3 * ctxsize + md->blocksize);
+  grub_free (mem);
+  grub_memset (key, 0, sizeof (key));
+  grub_memset (U, 0, sizeof (U));
+  grub_memset (T, 0, sizeof (T));
 
   return GPG_ERR_NO_ERROR;
 }
@@ -0,0 +1,322 @@
+/* aesni.c - AES using the AES-NI instructions.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/types.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/crypto.h>
+#include <grub/i386/cpuid.h>
+#include <grub/x86_64/simd.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* CPUID leaf 1, ECX.  */
+#define AESNI_CPUID_AES (1 << 25)
+
+#define AESNI_BLOCKSIZE 16
+#define AESNI_MAX_ROUNDS 14
+
+struct aesni_context
+{
+  unsigned rounds;
+  /* Encryption then decryption round keys, aligned at run time as the
+     instructions require for memory operands.  */
+  grub_uint8_t keys[2 * (AESNI_MAX_ROUNDS + 1) * AESNI_BLOCKSIZE
+		    + AESNI_BLOCKSIZE - 1];
+};
+
+static inline grub_uint8_t *
+aesni_enc_keys (struct aesni_context *ctx)
+{
+  return (grub_uint8_t *) ALIGN_UP ((grub_addr_t) ctx->keys, AESNI_BLOCKSIZE);
+}
+
+static inline grub_uint8_t *
+aesni_dec_keys (struct aesni_context *ctx)
+{
+  return aesni_enc_keys (ctx) + (AESNI_MAX_ROUNDS + 1) * AESNI_BLOCKSIZE;
+}
+
+/* Apply the S-box to each byte of W.  */
+static GRUB_SIMD_FUNCTION ("sse2") grub_uint32_t
+aesni_sub_word (grub_uint32_t w)
+{
+  grub_uint32_t r;
+
+  asm volatile ("movd %1, %%xmm0\n\t"
+		"pshufd $0, %%xmm0, %%xmm0\n\t"
+		"aeskeygenassist $0, %%xmm0, %%xmm0\n\t"
+		"movd %%xmm0, %0"
+		: "=r" (r)
+		: "r" (w)
+		: "xmm0");
+  return r;
+}
+
+static GRUB_SIMD_FUNCTION ("sse2") gcry_err_code_t
+aesni_setkey (void *context, const unsigned char *key, unsigned keylen)
+{
+  struct aesni_context *ctx = context;
+  grub_uint32_t w[4 * (AESNI_MAX_ROUNDS + 1)];
+  grub_uint32_t t, rcon = 1;
+  grub_uint8_t *enc, *dec;
+  unsigned nk, total, i, r;
+
+  if (keylen != 16 && keylen != 24 && keylen != 32)
+    return GPG_ERR_INV_KEYLEN;
+
+  /* FIPS-197 key expansion, words in little endian.  */
+  nk = keylen / 4;
+  ctx->rounds = nk + 6;
+  total = 4 * (ctx->rounds + 1);
+  grub_memcpy (w, key, keylen);
+  for (i = nk; i < total; i++)
+    {
+      t = w[i - 1];
+      if (i % nk == 0)
+	{
+	  t = aesni_sub_word ((t >> 8) | (t << 24)) ^ rcon;
+	  rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+	}
+      else if (nk > 6 && i % nk == 4)
+	t = aesni_sub_word (t);
+      w[i] = w[i - nk] ^ t;
+    }
+
+  enc = aesni_enc_keys (ctx);
+  dec = aesni_dec_keys (ctx);
+  grub_memcpy (enc, w, total * sizeof (w[0]));
+  grub_memset (w, 0, sizeof (w));
+
+  /* Decryption with aesdec needs the Equivalent Inverse Cipher keys.  */
+  grub_memcpy (dec, enc + ctx->rounds * AESNI_BLOCKSIZE, AESNI_BLOCKSIZE);
+  for (r = 1; r < ctx->rounds; r++)
+    asm volatile ("movdqa %1, %%xmm0\n\t"
+		  "aesimc %%xmm0, %%xmm0\n\t"
+		  "movdqa %%xmm0, %0"
+		  : "=m" (*(grub_uint8_t (*)[AESNI_BLOCKSIZE])
+			  (dec + r * AESNI_BLOCKSIZE))
+		  : "m" (*(const grub_uint8_t (*)[AESNI_BLOCKSIZE])
+			 (enc + (ctx->rounds - r) * AESNI_BLOCKSIZE))
+		  : "xmm0");
+  grub_memcpy (dec + ctx->rounds * AESNI_BLOCKSIZE, enc, AESNI_BLOCKSIZE);
+  return GPG_ERR_NO_ERROR;
+}
+
+/* One block.  KEY points to the round keys, N is the number of rounds
+   minus one.  */
+#define AESNI_CRYPT1(round, last)				\
+  "movdqa (%[key]), %%xmm1\n\t"					\
+  "movdqu (%[in]), %%xmm0\n\t"					\
+  "pxor %%xmm1, %%xmm0\n\t"					\
+  "1:\n\t"							\
+  "add $16, %[key]\n\t"						\
+  "movdqa (%[key]), %%xmm1\n\t"					\
+  round " %%xmm1, %%xmm0\n\t"					\
+  "dec %[n]\n\t"						\
+  "jnz 1b\n\t"							\
+  "movdqa 16(%[key]), %%xmm1\n\t"				\
+  last " %%xmm1, %%xmm0\n\t"					\
+  "movdqu %%xmm0, (%[out])\n\t"
+
+#define AESNI_CLOBBERS1 "cc", "memory", "xmm0", "xmm1"
+
+/* Eight interleaved blocks, to hide the latency of the instructions.  */
+#define AESNI_CRYPT8(round, last)				\
+  "movdqa (%[key]), %%xmm8\n\t"					\
+  "movdqu 0(%[in]), %%xmm0\n\t"					\
+  "movdqu 16(%[in]), %%xmm1\n\t"				\
+  "movdqu 32(%[in]), %%xmm2\n\t"				\
+  "movdqu 48(%[in]), %%xmm3\n\t"				\
+  "movdqu 64(%[in]), %%xmm4\n\t"				\
+  "movdqu 80(%[in]), %%xmm5\n\t"				\
+  "movdqu 96(%[in]), %%xmm6\n\t"				\
+  "movdqu 112(%[in]), %%xmm7\n\t"				\
+  "pxor %%xmm8, %%xmm0\n\t"					\
+  "pxor %%xmm8, %%xmm1\n\t"					\
+  "pxor %%xmm8, %%xmm2\n\t"					\
+  "pxor %%xmm8, %%xmm3\n\t"					\
+  "pxor %%xmm8, %%xmm4\n\t"					\
+  "pxor %%xmm8, %%xmm5\n\t"					\
+  "pxor %%xmm8, %%xmm6\n\t"					\
+  "pxor %%xmm8, %%xmm7\n\t"					\
+  "1:\n\t"							\
+  "add $16, %[key]\n\t"						\
+  "movdqa (%[key]), %%xmm8\n\t"					\
+  round " %%xmm8, %%xmm0\n\t"					\
+  round " %%xmm8, %%xmm1\n\t"					\
+  round " %%xmm8, %%xmm2\n\t"					\
+  round " %%xmm8, %%xmm3\n\t"					\
+  round " %%xmm8, %%xmm4\n\t"					\
+  round " %%xmm8, %%xmm5\n\t"					\
+  round " %%xmm8, %%xmm6\n\t"					\
+  round " %%xmm8, %%xmm7\n\t"					\
+  "dec %[n]\n\t"						\
+  "jnz 1b\n\t"							\
+  "movdqa 16(%[key]), %%xmm8\n\t"				\
+  last " %%xmm8, %%xmm0\n\t"					\
+  last " %%xmm8, %%xmm1\n\t"					\
+  last " %%xmm8, %%xmm2\n\t"					\
+  last " %%xmm8, %%xmm3\n\t"					\
+  last " %%xmm8, %%xmm4\n\t"					\
+  last " %%xmm8, %%xmm5\n\t"					\
+  last " %%xmm8, %%xmm6\n\t"					\
+  last " %%xmm8, %%xmm7\n\t"					\
+  "movdqu %%xmm0, 0(%[out])\n\t"				\
+  "movdqu %%xmm1, 16(%[out])\n\t"				\
+  "movdqu %%xmm2, 32(%[out])\n\t"				\
+  "movdqu %%xmm3, 48(%[out])\n\t"				\
+  "movdqu %%xmm4, 64(%[out])\n\t"				\
+  "movdqu %%xmm5, 80(%[out])\n\t"				\
+  "movdqu %%xmm6, 96(%[out])\n\t"				\
+  "movdqu %%xmm7, 112(%[out])\n\t"
+
+#define AESNI_CLOBBERS8 "cc", "memory", "xmm0", "xmm1", "xmm2", "xmm3", \
+    "xmm4", "xmm5", "xmm6", "xmm7", "xmm8"
+
+static GRUB_SIMD_FUNCTION ("sse2") void
+aesni_encrypt_blocks (void *context, unsigned char *out,
+		      const unsigned char *in, grub_size_t nblocks)
+{
+  struct aesni_context *ctx = context;
+  const grub_uint8_t *key;
+  grub_size_t n;
+
+  for (; nblocks >= 8; nblocks -= 8, in += 8 * AESNI_BLOCKSIZE,
+	 out += 8 * AESNI_BLOCKSIZE)
+    {
+      key = aesni_enc_keys (ctx);
+      n = ctx->rounds - 1;
+      asm volatile (AESNI_CRYPT8 ("aesenc", "aesenclast")
+		    : [key] "+r" (key), [n] "+r" (n)
+		    : [in] "r" (in), [out] "r" (out)
+		    : AESNI_CLOBBERS8);
+    }
+  for (; nblocks; nblocks--, in += AESNI_BLOCKSIZE, out += AESNI_BLOCKSIZE)
+    {
+      key = aesni_enc_keys (ctx);
+      n = ctx->rounds - 1;
+      asm volatile (AESNI_CRYPT1 ("aesenc", "aesenclast")
+		    : [key] "+r" (key), [n] "+r" (n)
+		    : [in] "r" (in), [out] "r" (out)
+		    : AESNI_CLOBBERS1);
+    }
+}
+
+static GRUB_SIMD_FUNCTION ("sse2") void
+aesni_decrypt_blocks (void *context, unsigned char *out,
+		      const unsigned char *in, grub_size_t nblocks)
+{
+  struct aesni_context *ctx = context;
+  const grub_uint8_t *key;
+  grub_size_t n;
+
+  for (; nblocks >= 8; nblocks -= 8, in += 8 * AESNI_BLOCKSIZE,
+	 out += 8 * AESNI_BLOCKSIZE)
+    {
+      key = aesni_dec_keys (ctx);
+      n = ctx->rounds - 1;
+      asm volatile (AESNI_CRYPT8 ("aesdec", "aesdeclast")
+		    : [key] "+r" (key), [n] "+r" (n)
+		    : [in] "r" (in), [out] "r" (out)
+		    : AESNI_CLOBBERS8);
+    }
+  for (; nblocks; nblocks--, in += AESNI_BLOCKSIZE, out += AESNI_BLOCKSIZE)
+    {
+      key = aesni_dec_keys (ctx);
+      n = ctx->rounds - 1;
+      asm volatile (AESNI_CRYPT1 ("aesdec", "aesdeclast")
+		    : [key] "+r" (key), [n] "+r" (n)
+		    : [in] "r" (in), [out] "r" (out)
+		    : AESNI_CLOBBERS1);
+    }
+}
+
+static void
+aesni_encrypt (void *context, unsigned char *out, const unsigned char *in)
+{
+  aesni_encrypt_blocks (context, out, in, 1);
+}
+
+static void
+aesni_decrypt (void *context, unsigned char *out, const unsigned char *in)
+{
+  aesni_decrypt_blocks (context, out, in, 1);
+}
+
+#define AESNI_SPEC(bits)					\
+  {								\
+    .blocksize = AESNI_BLOCKSIZE,				\
+    .keylen = bits,						\
+    .contextsize = sizeof (struct aesni_context),		\
+    .setkey = aesni_setkey,					\
+    .encrypt = aesni_encrypt,					\
+    .decrypt = aesni_decrypt,					\
+    .encrypt_blocks = aesni_encrypt_blocks,			\
+    .decrypt_blocks = aesni_decrypt_blocks			\
+  }
+
+static gcry_cipher_spec_t aesni_specs[] =
+  {
+    AESNI_SPEC (128),
+    AESNI_SPEC (192),
+    AESNI_SPEC (256)
+  };
+
+/* Take the names of the gcry_rijndael ciphers.  Referring to them also
+   makes gcry_rijndael load, and register, before us, so that ours come
+   first in the lookups.  */
+static const gcry_cipher_spec_t *const aesni_generic[] =
+  {
+    &_gcry_cipher_spec_aes,
+    &_gcry_cipher_spec_aes192,
+    &_gcry_cipher_spec_aes256
+  };
+
+static int aesni_registered;
+
+GRUB_MOD_INIT(aesni)
+{
+  grub_uint32_t eax, ebx, ecx, edx;
+  unsigned i;
+
+  /* Otherwise gcry_rijndael keeps serving AES.  */
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(ecx & AESNI_CPUID_AES))
+    return;
+
+  for (i = 0; i < ARRAY_SIZE (aesni_specs); i++)
+    {
+      aesni_specs[i].name = aesni_generic[i]->name;
+      aesni_specs[i].aliases = aesni_generic[i]->aliases;
+      aesni_specs[i].oids = aesni_generic[i]->oids;
+      grub_cipher_register (&aesni_specs[i]);
+    }
+  aesni_registered = 1;
+}
+
+GRUB_MOD_FINI(aesni)
+{
+  unsigned i;
+
+  if (!aesni_registered)
+    return;
+  for (i = 0; i < ARRAY_SIZE (aesni_specs); i++)
+    grub_cipher_unregister (&aesni_specs[i]);
+}
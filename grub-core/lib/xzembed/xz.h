@@ -178,6 +178,21 @@ enum xz_ret xz_dec_run(struct xz_dec *s, struct xz_buf *b);
  */
 void xz_dec_reset(struct xz_dec *s);
 
+/**
+ * xz_dec_reset_block() - Prepare the decoder to decode a single Block
+ * @s:          Decoder state allocated using xz_dec_init()
+ *
+ * The Stream Header must have been decoded already, and the next input
+ * given to xz_dec_run() must start at a Block Header. The Block may be
+ * any Block of the Stream, e.g. one located with the help of the Index.
+ * xz_dec_run() returns XZ_STREAM_END once the Block, including its
+ * Check field, has been decoded. Call this function again to decode
+ * another Block. The Index is never validated in this mode.
+ *
+ * Only multi-call mode is supported.
+ */
+void xz_dec_reset_block(struct xz_dec *s);
+
 /**
  * xz_dec_end() - Free the memory allocated for the decoder state
  * @s:          Decoder state allocated using xz_dec_init(). If s is NULL,
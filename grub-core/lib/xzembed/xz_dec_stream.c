@@ -85,6 +85,9 @@ struct xz_dec {
 	/* True if we are operating in single-call mode. */
 	bool single_call;
 
+	/* True if we stop after one Block, see xz_dec_reset_block(). */
+	bool single_block;
+
 	/*
 	 * True if the next call to xz_dec_run() is allowed to return
 	 * XZ_BUF_ERROR.
@@ -820,6 +823,9 @@ static enum xz_ret dec_main(struct xz_dec *s, struct xz_buf *b)
 				return ret;
 
 			s->sequence = SEQ_BLOCK_START;
+			if (s->single_block)
+				return XZ_STREAM_END;
+
 			break;
 
 		case SEQ_INDEX:
@@ -990,6 +996,7 @@ error_bcj:
 void xz_dec_reset(struct xz_dec *s)
 {
 	s->sequence = SEQ_STREAM_HEADER;
+	s->single_block = false;
 	s->allow_buf_error = false;
 	s->pos = 0;
 
@@ -1022,6 +1029,23 @@ void xz_dec_reset(struct xz_dec *s)
 	s->have_hash_value = 0;
 }
 
+void xz_dec_reset_block(struct xz_dec *s)
+{
+	s->sequence = SEQ_BLOCK_START;
+	s->single_block = true;
+	s->allow_buf_error = false;
+	s->pos = 0;
+	s->temp.pos = 0;
+
+#ifndef GRUB_EMBED_DECOMPRESSOR
+	if (s->hash)
+		s->hash->init(s->hash_context);
+	if (s->crc32)
+		s->crc32->init(s->crc32_context);
+#endif
+	s->have_hash_value = 0;
+}
+
 void xz_dec_end(struct xz_dec *s)
 {
 	if (s != NULL) {
@@ -4,6 +4,7 @@
 #include <grub/misc.h>
 #include <grub/file.h>
 #include <grub/mm.h>
+#include <grub/time.h>
 
 struct newc_head
 {
@@ -244,15 +245,29 @@ grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
   initrd_ctx->components = 0;
 }
 
+/* Log how fast SIZE bytes were loaded since START, in milliseconds.  */
+static void
+report_rate (const char *what, grub_uint64_t size, grub_uint64_t start)
+{
+  grub_uint64_t ms = grub_get_time_ms () - start;
+
+  grub_dprintf ("linux", "%s: %" PRIuGRUB_UINT64_T " bytes in %"
+		PRIuGRUB_UINT64_T " ms, %" PRIuGRUB_UINT64_T " KiB/s\n",
+		what, size, ms,
+		grub_divmod64 (size * 1000 / 1024, ms ? : 1, 0));
+}
+
 grub_err_t
 grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 		  char *argv[], void *target)
 {
+  grub_uint64_t start = grub_get_time_ms ();
   grub_uint8_t *ptr = target;
   int i;
   int newc = 0;
   struct dir *root = 0;
   grub_ssize_t cursize = 0;
+  grub_uint64_t comp_start;
 
   for (i = 0; i < initrd_ctx->nfiles; i++)
     {
@@ -279,6 +294,7 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	}
 
       cursize = initrd_ctx->components[i].size;
+      comp_start = grub_get_time_ms ();
       if (grub_file_read (initrd_ctx->components[i].file, ptr, cursize)
 	  != cursize)
 	{
@@ -288,6 +304,7 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
+      report_rate (argv[i], cursize, comp_start);
       ptr += cursize;
     }
   if (newc)
@@ -298,5 +315,6 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
     }
   free_dir (root);
   root = 0;
+  report_rate ("initrd", initrd_ctx->size, start);
   return GRUB_ERR_NONE;
 }
@@ -0,0 +1,249 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/crypto.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* FIPS-197, appendix C.  */
+static struct
+{
+  const char *key;
+  grub_size_t keylen;
+  const char *plain;
+  const char *cipher;
+} ecb_vectors[] = {
+  {
+    "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f", 16,
+    "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff",
+    "\x69\xc4\xe0\xd8\x6a\x7b\x04\x30\xd8\xcd\xb7\x80\x70\xb4\xc5\x5a"
+  },
+  {
+    "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+    "\x10\x11\x12\x13\x14\x15\x16\x17", 24,
+    "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff",
+    "\xdd\xa9\x7c\xa4\x86\x4c\xdf\xe0\x6e\xaf\x70\xa0\xec\x0d\x71\x91"
+  },
+  {
+    "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f"
+    "\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19\x1a\x1b\x1c\x1d\x1e\x1f", 32,
+    "\x00\x11\x22\x33\x44\x55\x66\x77\x88\x99\xaa\xbb\xcc\xdd\xee\xff",
+    "\x8e\xa2\xb7\xca\x51\x67\x45\xbf\xea\xfc\x49\x90\x4b\x49\x60\x89"
+  }
+};
+
+/* SP 800-38A, F.2.2.  */
+static const char cbc_key[] =
+  "\x2b\x7e\x15\x16\x28\xae\xd2\xa6\xab\xf7\x15\x88\x09\xcf\x4f\x3c";
+static const char cbc_iv[] =
+  "\x00\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c\x0d\x0e\x0f";
+static const char cbc_cipher[] =
+  "\x76\x49\xab\xac\x81\x19\xb2\x46\xce\xe9\x8e\x9b\x12\xe9\x19\x7d"
+  "\x50\x86\xcb\x9b\x50\x72\x19\xee\x95\xdb\x11\x3a\x91\x76\x78\xb2"
+  "\x73\xbe\xd6\xb8\xe3\xc1\x74\x3b\x71\x16\xe6\x9e\x22\x22\x95\x16"
+  "\x3f\xf1\xca\xa1\x68\x1f\xac\x09\x12\x0e\xca\x30\x75\x86\xe1\xa7";
+static const char cbc_plain[] =
+  "\x6b\xc1\xbe\xe2\x2e\x40\x9f\x96\xe9\x3d\x7e\x11\x73\x93\x17\x2a"
+  "\xae\x2d\x8a\x57\x1e\x03\xac\x9c\x9e\xb7\x6f\xac\x45\xaf\x8e\x51"
+  "\x30\xc8\x1c\x46\xa3\x5c\xe4\x11\xe5\xfb\xc1\x19\x1a\x0a\x52\xef"
+  "\xf6\x9f\x24\x45\xdf\x4f\x9b\x17\xad\x2b\x41\x7b\xe6\x6c\x37\x10";
+
+/* IEEE 1619-2007, vector 2.  */
+static const char xts_tweak[] =
+  "\x33\x33\x33\x33\x33\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00";
+static const char xts_cipher[] =
+  "\xc4\x54\x18\x5e\x6a\x16\x93\x6e\x39\x33\x40\x38\xac\xef\x83\x8b"
+  "\xfb\x18\x6f\xff\x74\x80\xad\xc4\x28\x93\x82\xec\xd6\xd3\x94\xf0";
+
+#define LONG_SECTOR 512
+#define LONG_SIZE (4 * LONG_SECTOR)
+
+static grub_crypto_cipher_handle_t
+open_cipher (const gcry_cipher_spec_t *spec, const void *key,
+	     grub_size_t keylen)
+{
+  grub_crypto_cipher_handle_t cipher;
+  gcry_err_code_t err;
+
+  cipher = grub_crypto_cipher_open (spec);
+  grub_test_assert (cipher != NULL, "%s: can't open the cipher", spec->name);
+  if (!cipher)
+    return NULL;
+  err = grub_crypto_cipher_set_key (cipher, key, keylen);
+  grub_test_assert (err == 0, "%s: setkey error %d", spec->name, err);
+  if (err)
+    {
+      grub_crypto_cipher_close (cipher);
+      return NULL;
+    }
+  return cipher;
+}
+
+/* Known answers for one implementation.  */
+static void
+aes_test_kat (const gcry_cipher_spec_t *spec)
+{
+  grub_crypto_cipher_handle_t cipher, tweak;
+  grub_uint8_t buf[64];
+  grub_uint8_t key[16];
+  grub_size_t i;
+  gcry_err_code_t err;
+
+  for (i = 0; i < ARRAY_SIZE (ecb_vectors); i++)
+    {
+      cipher = open_cipher (spec, ecb_vectors[i].key, ecb_vectors[i].keylen);
+      if (!cipher)
+	continue;
+      err = grub_crypto_ecb_encrypt (cipher, buf, ecb_vectors[i].plain, 16);
+      grub_test_assert (err == 0 && grub_memcmp (buf, ecb_vectors[i].cipher,
+						 16) == 0,
+			"%s: AES-%d encryption mismatch", spec->name,
+			(int) ecb_vectors[i].keylen * 8);
+      err = grub_crypto_ecb_decrypt (cipher, buf, buf, 16);
+      grub_test_assert (err == 0 && grub_memcmp (buf, ecb_vectors[i].plain,
+						 16) == 0,
+			"%s: AES-%d decryption mismatch", spec->name,
+			(int) ecb_vectors[i].keylen * 8);
+      grub_crypto_cipher_close (cipher);
+    }
+
+  cipher = open_cipher (spec, cbc_key, 16);
+  if (cipher)
+    {
+      grub_memcpy (buf, cbc_cipher, sizeof (buf));
+      err = grub_crypto_cbc_decrypt_sectors (cipher, buf, sizeof (buf),
+					     sizeof (buf), cbc_iv);
+      grub_test_assert (err == 0 && grub_memcmp (buf, cbc_plain,
+						 sizeof (buf)) == 0,
+			"%s: CBC decryption mismatch", spec->name);
+      grub_crypto_cipher_close (cipher);
+    }
+
+  grub_memset (key, 0x11, sizeof (key));
+  cipher = open_cipher (spec, key, sizeof (key));
+  grub_memset (key, 0x22, sizeof (key));
+  tweak = open_cipher (spec, key, sizeof (key));
+  if (cipher && tweak)
+    {
+      grub_memset (buf, 0x44, 32);
+      err = grub_crypto_xts_encrypt_sectors (cipher, tweak, buf, 32, 32,
+					     xts_tweak);
+      grub_test_assert (err == 0 && grub_memcmp (buf, xts_cipher, 32) == 0,
+			"%s: XTS encryption mismatch", spec->name);
+      err = grub_crypto_xts_decrypt_sectors (cipher, tweak, buf, 32, 32,
+					     xts_tweak);
+      for (i = 0; i < 32; i++)
+	if (buf[i] != 0x44)
+	  break;
+      grub_test_assert (err == 0 && i == 32, "%s: XTS decryption mismatch",
+			spec->name);
+    }
+  if (cipher)
+    grub_crypto_cipher_close (cipher);
+  if (tweak)
+    grub_crypto_cipher_close (tweak);
+}
+
+/* Bulk paths of SPEC against the portable implementation, over several
+   sectors of many blocks.  */
+static void
+aes_test_compare (const gcry_cipher_spec_t *spec)
+{
+  grub_crypto_cipher_handle_t c1 = NULL, t1 = NULL, c2 = NULL, t2 = NULL;
+  grub_uint8_t *a = NULL, *b = NULL;
+  grub_uint8_t key[32], ivs[4 * 16];
+  grub_size_t i;
+  gcry_err_code_t err1, err2;
+
+  for (i = 0; i < sizeof (key); i++)
+    key[i] = i * 7 + 1;
+  for (i = 0; i < sizeof (ivs); i++)
+    ivs[i] = i * 13 + 5;
+
+  a = grub_malloc (LONG_SIZE);
+  b = grub_malloc (LONG_SIZE);
+  grub_test_assert (a && b, "out of memory");
+  if (!a || !b)
+    goto out;
+  c1 = open_cipher (spec, key, 32);
+  t1 = open_cipher (spec, key + 16, 16);
+  c2 = open_cipher (GRUB_CIPHER_AES, key, 32);
+  t2 = open_cipher (GRUB_CIPHER_AES, key + 16, 16);
+  if (!c1 || !t1 || !c2 || !t2)
+    goto out;
+
+  for (i = 0; i < LONG_SIZE; i++)
+    a[i] = b[i] = i ^ (i >> 8);
+
+  err1 = grub_crypto_ecb_encrypt (c1, a, a, LONG_SIZE);
+  err2 = grub_crypto_ecb_encrypt (c2, b, b, LONG_SIZE);
+  grub_test_assert (err1 == 0 && err2 == 0
+		    && grub_memcmp (a, b, LONG_SIZE) == 0,
+		    "%s: ECB encryption differs", spec->name);
+
+  err1 = grub_crypto_cbc_decrypt_sectors (c1, a, LONG_SIZE, LONG_SECTOR, ivs);
+  err2 = grub_crypto_cbc_decrypt_sectors (c2, b, LONG_SIZE, LONG_SECTOR, ivs);
+  grub_test_assert (err1 == 0 && err2 == 0
+		    && grub_memcmp (a, b, LONG_SIZE) == 0,
+		    "%s: CBC decryption differs", spec->name);
+
+  err1 = grub_crypto_xts_decrypt_sectors (c1, t1, a, LONG_SIZE, LONG_SECTOR,
+					  ivs);
+  err2 = grub_crypto_xts_decrypt_sectors (c2, t2, b, LONG_SIZE, LONG_SECTOR,
+					  ivs);
+  grub_test_assert (err1 == 0 && err2 == 0
+		    && grub_memcmp (a, b, LONG_SIZE) == 0,
+		    "%s: XTS decryption differs", spec->name);
+
+ out:
+  if (c1)
+    grub_crypto_cipher_close (c1);
+  if (t1)
+    grub_crypto_cipher_close (t1);
+  if (c2)
+    grub_crypto_cipher_close (c2);
+  if (t2)
+    grub_crypto_cipher_close (t2);
+  grub_free (a);
+  grub_free (b);
+}
+
+static void
+aes_test (void)
+{
+  const gcry_cipher_spec_t *spec;
+
+  aes_test_kat (GRUB_CIPHER_AES);
+
+  /* Accelerated implementation, if any for this platform and CPU.  */
+  grub_dl_load ("aesni");
+  grub_errno = GRUB_ERR_NONE;
+  spec = grub_crypto_lookup_cipher_by_name ("AES");
+  if (spec && spec != GRUB_CIPHER_AES)
+    {
+      aes_test_kat (spec);
+      aes_test_compare (spec);
+    }
+}
+
+/* Register aes_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (aes_test, aes_test);
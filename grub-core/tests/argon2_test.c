@@ -0,0 +1,93 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/crypto.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Computed with an implementation checked against the RFC 9106 vectors,
+   which need secret and associated data we don't support.  */
+static struct
+{
+  grub_crypto_argon2_type_t type;
+  const char *P;
+  grub_size_t Plen;
+  const char *S;
+  grub_size_t Slen;
+  grub_uint32_t t_cost;
+  grub_uint32_t m_cost;
+  grub_uint32_t lanes;
+  grub_size_t dkLen;
+  const char *DK;
+} vectors[] = {
+  {
+    GRUB_CRYPTO_ARGON2I,
+    "password", 8,
+    "somesalt", 8,
+    2, 32, 1, 32,
+    "\xe1\x54\xf7\x79\xba\xb7\x4e\xda\x8e\x4b\x96\x48\x9f\xf3\x8b\x59"
+    "\x56\x52\x41\x9a\x30\xc1\x61\x4f\xfb\xbe\xf2\x27\x63\x60\x4e\x08"
+  },
+  {
+    GRUB_CRYPTO_ARGON2ID,
+    "password", 8,
+    "somesalt", 8,
+    2, 64, 2, 32,
+    "\x94\x38\x74\x15\xdf\xb8\x4e\xd1\x97\x74\x65\xa1\xe8\x62\x60\x73"
+    "\xad\xf4\x2b\xd4\xee\xae\x1f\xaa\x1d\xd4\xe2\x3a\x1f\xf6\x85\x9f"
+  },
+  {
+    GRUB_CRYPTO_ARGON2ID,
+    "\0secret pass", 12,
+    "0123456789abcdef", 16,
+    1, 96, 4, 64,
+    "\x3d\xfa\x34\xd0\x71\x29\x4f\xf7\xd8\x53\x4b\xef\xc5\x7a\xd7\x4d"
+    "\xba\x9f\x47\xc0\xf9\x72\x8f\x12\x2e\xc0\x14\xbf\x22\xc5\x3b\x77"
+    "\x44\x47\x69\x0b\x91\x14\xb8\x57\x7e\xc9\xb9\x1e\x42\x5b\xfd\x40"
+    "\x23\xc3\x8d\xcf\xd8\x39\x4b\x7c\xbf\x80\x59\x83\xec\x37\xc9\xfe"
+  }
+};
+
+static void
+argon2_test (void)
+{
+  grub_size_t i;
+
+  for (i = 0; i < ARRAY_SIZE (vectors); i++)
+    {
+      gcry_err_code_t err;
+      grub_uint8_t DK[64];
+      err = grub_crypto_argon2 (vectors[i].type,
+				(const grub_uint8_t *) vectors[i].P,
+				vectors[i].Plen,
+				(const grub_uint8_t *) vectors[i].S,
+				vectors[i].Slen,
+				vectors[i].t_cost, vectors[i].m_cost,
+				vectors[i].lanes,
+				DK, vectors[i].dkLen);
+      grub_test_assert (err == 0, "gcry error %d", err);
+      grub_test_assert (grub_memcmp (DK, vectors[i].DK, vectors[i].dkLen) == 0,
+			"Argon2 mismatch");
+    }
+}
+
+/* Register argon2_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (argon2_test, argon2_test);
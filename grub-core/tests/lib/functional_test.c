@@ -72,6 +72,10 @@ grub_functional_all_tests (grub_extcmd_context_t ctxt __attribute__ ((unused)),
   grub_dl_load ("div_test");
   grub_dl_load ("xnu_uuid_test");
   grub_dl_load ("pbkdf2_test");
+  grub_dl_load ("aes_test");
+  grub_dl_load ("argon2_test");
+  grub_dl_load ("lz4_test");
+  grub_dl_load ("zfs_checksum_test");
   grub_dl_load ("signature_test");
   grub_dl_load ("sleep_test");
   grub_dl_load ("bswap_test");
@@ -0,0 +1,164 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+static struct
+{
+  const char *name;
+  const char *in;
+  grub_size_t inlen;
+  grub_size_t outsize;
+  const char *out;
+  grub_ssize_t outlen;
+} vectors[] = {
+  { "empty", "\x00", 1, 16, "", 0 },
+  { "literals", "\x50hello", 6, 16, "hello", 5 },
+  { "run", "\x1f" "a" "\x01\x00\x0b" "\x50" "bcdef", 11, 64,
+    "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaabcdef", 36 },
+  { "output too small", "\x1f" "a" "\x01\x00\x0b" "\x50" "bcdef", 11, 35,
+    NULL, -1 },
+  { "offset too far", "\x20" "ab" "\x03\x00" "\x00", 6, 64, NULL, -1 },
+  { "zero offset", "\x20" "ab" "\x00\x00" "\x00", 6, 64, NULL, -1 },
+  { "truncated literals", "\x50hell", 5, 16, NULL, -1 },
+  { "truncated offset", "\x20" "ab" "\x01", 4, 64, NULL, -1 },
+  { "truncated length", "\xf0", 1, 64, NULL, -1 }
+};
+
+#define MIN_MATCH 4
+#define GEN_SIZE 65536
+
+static grub_uint32_t seed = 1;
+
+static grub_uint32_t
+rnd (grub_uint32_t n)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 8) % n;
+}
+
+static grub_uint8_t *
+put_length (grub_uint8_t *p, grub_size_t len)
+{
+  for (len -= 15; len >= 255; len -= 255)
+    *p++ = 255;
+  *p++ = len;
+  return p;
+}
+
+/* Build a block of random sequences, with literal and match lengths on
+   both sides of 15 and offsets down to 1, and check that it decodes to
+   what a byte by byte copy gives.  */
+static void
+lz4_test_generated (void)
+{
+  grub_uint8_t *in, *expected, *out, *ip;
+  grub_size_t op = 0, lit, len, offset, i;
+  grub_ssize_t ret;
+
+  in = grub_malloc (2 * GEN_SIZE);
+  expected = grub_malloc (GEN_SIZE);
+  out = grub_malloc (GEN_SIZE);
+  grub_test_assert (in && expected && out, "out of memory");
+  if (!in || !expected || !out)
+    goto out;
+
+  ip = in;
+  while (1)
+    {
+      lit = rnd (4) ? rnd (16) : rnd (300);
+      if (op == 0 && lit == 0)
+	lit = 1;
+      len = MIN_MATCH + (rnd (4) ? rnd (16) : rnd (600));
+      if (op + lit + len > GEN_SIZE - 16)
+	{
+	  /* The last sequence only has literals.  */
+	  lit = GEN_SIZE - op;
+	  *ip++ = 15 << 4;
+	  ip = put_length (ip, lit);
+	  for (i = 0; i < lit; i++)
+	    expected[op++] = *ip++ = rnd (256);
+	  break;
+	}
+      offset = 1 + (rnd (2) ? rnd (16) : rnd (op + lit));
+      if (offset > op + lit)
+	offset = op + lit;
+
+      *ip++ = ((lit < 15 ? lit : 15) << 4)
+	| (len - MIN_MATCH < 15 ? len - MIN_MATCH : 15);
+      if (lit >= 15)
+	ip = put_length (ip, lit);
+      for (i = 0; i < lit; i++)
+	expected[op++] = *ip++ = rnd (4) ? 'a' + rnd (4) : rnd (256);
+      *ip++ = offset & 0xff;
+      *ip++ = offset >> 8;
+      if (len - MIN_MATCH >= 15)
+	ip = put_length (ip, len - MIN_MATCH);
+      for (i = 0; i < len; i++, op++)
+	expected[op] = expected[op - offset];
+    }
+
+  ret = grub_lz4_decompress (in, ip - in, out, GEN_SIZE);
+  grub_test_assert (ret == GEN_SIZE
+		    && grub_memcmp (out, expected, GEN_SIZE) == 0,
+		    "generated block mismatch");
+
+  ret = grub_lz4_decompress (in, ip - in, out, GEN_SIZE - 1);
+  grub_test_assert (ret < 0, "generated block overflowed its output");
+  grub_errno = GRUB_ERR_NONE;
+
+ out:
+  grub_free (in);
+  grub_free (expected);
+  grub_free (out);
+}
+
+static void
+lz4_test (void)
+{
+  grub_uint8_t out[64];
+  grub_ssize_t ret;
+  grub_size_t i;
+
+  for (i = 0; i < ARRAY_SIZE (vectors); i++)
+    {
+      ret = grub_lz4_decompress (vectors[i].in, vectors[i].inlen,
+				 out, vectors[i].outsize);
+      if (vectors[i].outlen < 0)
+	{
+	  grub_test_assert (ret < 0, "%s: corrupted block accepted",
+			    vectors[i].name);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+      grub_test_assert (ret == vectors[i].outlen
+			&& grub_memcmp (out, vectors[i].out, ret) == 0,
+			"%s: mismatch", vectors[i].name);
+    }
+
+  lz4_test_generated ();
+}
+
+/* Register lz4_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (lz4_test, lz4_test);
@@ -0,0 +1,163 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/test.h>
+#include <grub/dl.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+#include <grub/crypto.h>
+#include <grub/zfs/zfs.h>
+#include <grub/zfs/zio.h>
+#include <grub/zfs/zio_checksum.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define BUF_SIZE (131072 + 64)
+
+/* Lengths around the 16 bytes taken by each step of the fletcher4 lanes
+   and the 64-byte SHA-256 blocks.  */
+static const grub_size_t lengths[] =
+  { 0, 4, 12, 16, 20, 28, 32, 52, 56, 60, 64, 68, 116, 120, 124, 128, 508,
+    512, 4100, 65536, 131072 };
+
+static grub_uint32_t seed = 1;
+
+static grub_uint8_t
+rnd (void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 16;
+}
+
+static void
+fletcher_4_ref (const grub_uint8_t *buf, grub_size_t size,
+		grub_zfs_endian_t endian, grub_uint64_t sum[4])
+{
+  grub_size_t i;
+
+  sum[0] = sum[1] = sum[2] = sum[3] = 0;
+  for (i = 0; i + 4 <= size; i += 4)
+    {
+      sum[0] += grub_zfs_to_cpu32 (grub_get_unaligned32 (buf + i), endian);
+      sum[1] += sum[0];
+      sum[2] += sum[1];
+      sum[3] += sum[2];
+    }
+}
+
+static void
+zfs_checksum_test_fletcher_4 (const grub_uint8_t *buf, const char *impl)
+{
+  static const grub_zfs_endian_t endians[] =
+    { GRUB_ZFS_LITTLE_ENDIAN, GRUB_ZFS_BIG_ENDIAN };
+  grub_uint64_t ref[4];
+  zio_cksum_t ck;
+  unsigned i, e, w;
+
+  for (i = 0; i < ARRAY_SIZE (lengths); i++)
+    for (e = 0; e < ARRAY_SIZE (endians); e++)
+      {
+	fletcher_4_ref (buf, lengths[i], endians[e], ref);
+	fletcher_4 (buf, lengths[i], endians[e], &ck);
+	for (w = 0; w < 4; w++)
+	  if (grub_zfs_to_cpu64 (ck.zc_word[w], endians[e]) != ref[w])
+	    break;
+	grub_test_assert (w == 4, "%s fletcher4 of %" PRIuGRUB_SIZE
+			  " %s-endian bytes differs", impl, lengths[i],
+			  endians[e] == GRUB_ZFS_BIG_ENDIAN ? "big" : "little");
+      }
+}
+
+static void
+zfs_checksum_test_sha256 (const grub_uint8_t *buf, const char *impl)
+{
+  grub_uint8_t ref[32];
+  zio_cksum_t ck;
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (lengths); i++)
+    {
+      grub_crypto_hash (GRUB_MD_SHA256, ref, buf, lengths[i]);
+      /* Big endian gives the words in the byte order of the digest.  */
+      zio_checksum_SHA256 (buf, lengths[i], GRUB_ZFS_BIG_ENDIAN, &ck);
+      grub_test_assert (grub_memcmp (&ck, ref, sizeof (ref)) == 0,
+			"%s SHA-256 of %" PRIuGRUB_SIZE " bytes differs",
+			impl, lengths[i]);
+    }
+}
+
+static void
+zfs_checksum_test (void)
+{
+  grub_uint8_t *alloc, *buf;
+  unsigned i;
+#ifdef ZFS_CHECKSUM_SIMD
+  zio_cksum_t ck;
+  int fletcher_4_best, sha256_best;
+#endif
+
+  alloc = grub_malloc (BUF_SIZE + 4);
+  grub_test_assert (alloc != NULL, "out of memory");
+  if (!alloc)
+    return;
+  for (i = 0; i < BUF_SIZE + 4; i++)
+    alloc[i] = rnd ();
+
+#ifdef ZFS_CHECKSUM_SIMD
+  /* Let them pick the best for this CPU, then check it and every lesser
+     one against the references.  */
+  fletcher_4 (alloc, 0, GRUB_ZFS_LITTLE_ENDIAN, &ck);
+  zio_checksum_SHA256 (alloc, 0, GRUB_ZFS_LITTLE_ENDIAN, &ck);
+  fletcher_4_best = zfs_fletcher_4_impl;
+  sha256_best = zfs_sha256_impl;
+#endif
+
+  /* Aligned and misaligned.  */
+  for (buf = alloc; buf <= alloc + 4; buf += 4)
+    {
+#ifdef ZFS_CHECKSUM_SIMD
+      zfs_fletcher_4_impl = ZFS_CHECKSUM_SCALAR;
+      zfs_checksum_test_fletcher_4 (buf, "scalar");
+      zfs_fletcher_4_impl = ZFS_CHECKSUM_SSE2;
+      zfs_checksum_test_fletcher_4 (buf, "SSE2");
+      if (fletcher_4_best == ZFS_CHECKSUM_AVX2)
+	{
+	  zfs_fletcher_4_impl = ZFS_CHECKSUM_AVX2;
+	  zfs_checksum_test_fletcher_4 (buf, "AVX2");
+	}
+      zfs_fletcher_4_impl = fletcher_4_best;
+
+      zfs_sha256_impl = ZFS_CHECKSUM_SCALAR;
+      zfs_checksum_test_sha256 (buf, "scalar");
+      if (sha256_best == ZFS_CHECKSUM_SHA_NI)
+	{
+	  zfs_sha256_impl = ZFS_CHECKSUM_SHA_NI;
+	  zfs_checksum_test_sha256 (buf, "SHA-NI");
+	}
+      zfs_sha256_impl = sha256_best;
+#else
+      zfs_checksum_test_fletcher_4 (buf, "scalar");
+      zfs_checksum_test_sha256 (buf, "scalar");
+#endif
+    }
+
+  grub_free (alloc);
+}
+
+/* Register zfs_checksum_test method as a functional test.  */
+GRUB_FUNCTIONAL_TEST (zfs_checksum_test, zfs_checksum_test);
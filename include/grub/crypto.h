@@ -117,6 +117,13 @@ typedef void (*gcry_cipher_stdecrypt_t) (void *c,
 					 const unsigned char *inbuf,
 					 unsigned int n);
 
+/* Type for the cipher_encrypt_blocks and cipher_decrypt_blocks functions,
+   which process NBLOCKS consecutive blocks in one call.  */
+typedef void (*gcry_cipher_bulk_t) (void *c,
+				    unsigned char *outbuf,
+				    const unsigned char *inbuf,
+				    grub_size_t nblocks);
+
 typedef struct gcry_cipher_oid_spec
 {
   const char *oid;
@@ -137,6 +144,9 @@ typedef struct gcry_cipher_spec
   gcry_cipher_decrypt_t decrypt;
   gcry_cipher_stencrypt_t stencrypt;
   gcry_cipher_stdecrypt_t stdecrypt;
+  /* Optional, used by the ECB and sector functions when available.  */
+  gcry_cipher_bulk_t encrypt_blocks;
+  gcry_cipher_bulk_t decrypt_blocks;
 #ifdef GRUB_UTIL
   const char *modname;
 #endif
@@ -327,6 +337,27 @@ gcry_err_code_t
 grub_crypto_cbc_decrypt (grub_crypto_cipher_handle_t cipher,
 			 void *out, const void *in, grub_size_t size,
 			 void *iv);
+
+/* Decrypt SIZE bytes of DATA in place as consecutive CBC sectors of
+   SECTOR_SIZE bytes, the IV of each sector being the next block of IVS.  */
+gcry_err_code_t
+grub_crypto_cbc_decrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs);
+
+/* Same for XTS with 16-byte blocks.  IVS holds the plain tweak of each
+   sector, it is encrypted with TWEAK_CIPHER here.  */
+gcry_err_code_t
+grub_crypto_xts_encrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 grub_crypto_cipher_handle_t tweak_cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs);
+gcry_err_code_t
+grub_crypto_xts_decrypt_sectors (grub_crypto_cipher_handle_t cipher,
+				 grub_crypto_cipher_handle_t tweak_cipher,
+				 void *data, grub_size_t size,
+				 grub_size_t sector_size, const void *ivs);
+
 void 
 grub_cipher_register (gcry_cipher_spec_t *cipher);
 void
@@ -373,6 +404,8 @@ extern gcry_md_spec_t _gcry_digest_spec_sha256;
 extern gcry_md_spec_t _gcry_digest_spec_sha512;
 extern gcry_md_spec_t _gcry_digest_spec_crc32;
 extern gcry_cipher_spec_t _gcry_cipher_spec_aes;
+extern gcry_cipher_spec_t _gcry_cipher_spec_aes192;
+extern gcry_cipher_spec_t _gcry_cipher_spec_aes256;
 #define GRUB_MD_MD5 ((const gcry_md_spec_t *) &_gcry_digest_spec_md5)
 #define GRUB_MD_SHA1 ((const gcry_md_spec_t *) &_gcry_digest_spec_sha1)
 #define GRUB_MD_SHA256 ((const gcry_md_spec_t *) &_gcry_digest_spec_sha256)
@@ -393,6 +426,24 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    unsigned int c,
 		    grub_uint8_t *DK, grub_size_t dkLen);
 
+typedef enum
+  {
+    GRUB_CRYPTO_ARGON2D = 0,
+    GRUB_CRYPTO_ARGON2I = 1,
+    GRUB_CRYPTO_ARGON2ID = 2
+  } grub_crypto_argon2_type_t;
+
+/* Argon2 as per RFC 9106, without secret or associated data.  T_COST is
+   the number of passes, M_COST the memory in KiB and LANES the degree of
+   parallelism.  Only Argon2i and Argon2id are supported.  */
+gcry_err_code_t
+grub_crypto_argon2 (grub_crypto_argon2_type_t type,
+		    const grub_uint8_t *P, grub_size_t Plen,
+		    const grub_uint8_t *S, grub_size_t Slen,
+		    grub_uint32_t t_cost, grub_uint32_t m_cost,
+		    grub_uint32_t lanes,
+		    grub_uint8_t *DK, grub_size_t dkLen);
+
 int
 grub_crypto_memcmp (const void *a, const void *b, grub_size_t n);
 
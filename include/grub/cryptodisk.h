@@ -143,6 +143,21 @@ grub_cryptodisk_decrypt (struct grub_cryptodisk *dev,
 grub_err_t
 grub_cryptodisk_insert (grub_cryptodisk_t newdev, const char *name,
 			grub_disk_t source);
+
+/* Try PASSPHRASE on the volume.  Returns GRUB_ERR_ACCESS_DENIED if it
+   doesn't open any key slot.  */
+typedef grub_err_t (*grub_cryptodisk_passphrase_hook_t) (grub_disk_t source,
+							 grub_cryptodisk_t dev,
+							 const char *passphrase,
+							 void *data);
+
+/* Open DEV by trying the passphrases which opened other volumes earlier in
+   this session, then by asking the user.  A passphrase entered by the user
+   is remembered for later volumes once it works.  */
+grub_err_t
+grub_cryptodisk_recover_passphrase (grub_disk_t source, grub_cryptodisk_t dev,
+				    grub_cryptodisk_passphrase_hook_t hook,
+				    void *hook_data);
 #ifdef GRUB_UTIL
 grub_err_t
 grub_cryptodisk_cheat_insert (grub_cryptodisk_t newdev, const char *name,
@@ -50,6 +50,8 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
     GRUB_DISK_DEVICE_OBDISK_ID,
+    /* Must be the last one.  */
+    GRUB_DISK_DEVICE_MAX_ID
   };
 
 struct grub_disk;
@@ -67,6 +69,8 @@ typedef enum
 
 typedef int (*grub_disk_dev_iterate_hook_t) (const char *name, void *data);
 
+struct grub_disk_request;
+
 /* Disk device.  */
 struct grub_disk_dev
 {
@@ -94,6 +98,16 @@ struct grub_disk_dev
   grub_err_t (*disk_write) (struct grub_disk *disk, grub_disk_addr_t sector,
 		       grub_size_t size, const char *buf);
 
+  /* Start reading REQ->SIZE sectors from the sector REQ->SECTOR of the
+     disk DISK into REQ->BUF and return without waiting for the data.  An
+     error means that the read wasn't started.  May be NULL.  */
+  grub_err_t (*disk_read_start) (struct grub_disk *disk,
+				 struct grub_disk_request *req);
+
+  /* Return non-zero and set REQ->ERR once the read REQ has finished.  */
+  int (*disk_read_poll) (struct grub_disk *disk,
+			 struct grub_disk_request *req);
+
 #ifdef GRUB_UTIL
   struct grub_disk_memberlist *(*disk_memberlist) (struct grub_disk *disk);
   const char * (*disk_raidname) (struct grub_disk *disk);
@@ -130,6 +144,19 @@ struct grub_disk
   /* Maximum number of sectors read divided by GRUB_DISK_CACHE_SIZE.  */
   unsigned int max_agglomerate;
 
+  /* The sector following the previous read, to detect sequential access.  */
+  grub_disk_addr_t read_ahead_next;
+
+  /* Number of cache units to read ahead on the next cache miss.  */
+  unsigned int read_ahead_window;
+
+  /* Set by grub_file_read while reading a file which loaders read in
+     bulk.  Whole cache units of file data, which are the reads made with
+     READ_HOOK set, are then read directly into the caller's buffer, not
+     only those of reads of at least GRUB_DISK_DIRECT_READ_SIZE bytes.
+     Metadata still goes through the cache.  */
+  int direct_read;
+
   /* The id used by the disk cache manager.  */
   unsigned long id;
 
@@ -145,9 +172,38 @@ struct grub_disk
 
   /* Device-specific data.  */
   void *data;
+
+  /* Reads started and not yet waited for.  */
+  struct grub_disk_request *pending;
 };
 typedef struct grub_disk *grub_disk_t;
 
+/* A read running in the background.  */
+struct grub_disk_request
+{
+  /* The sector in device sectors and the number of sectors to read.  */
+  grub_disk_addr_t sector;
+  grub_size_t size;
+  char *buf;
+
+  /* Set by the device once the read has finished.  */
+  int done;
+  grub_err_t err;
+
+  /* Read ahead NUM_UNITS cache units at the cache sector CACHE_SECTOR.
+     Read-aheads for direct reads (DIRECT) are handed to the next direct
+     read and only go to the cache if a cached read needs them.  */
+  int prefetch;
+  int direct;
+  grub_disk_addr_t cache_sector;
+  unsigned num_units;
+
+  /* Device-specific data.  */
+  void *data;
+
+  struct grub_disk_request *next;
+};
+
 #ifdef GRUB_UTIL
 struct grub_disk_memberlist
 {
@@ -161,14 +217,31 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The default total size of the disk cache in KiB. It can be changed
+   at runtime with the disk_cache_size environment variable.  */
+#define GRUB_DISK_CACHE_DEFAULT_SIZE	32768
+
+/* Larger disk cache sizes are reduced to this many KiB.  */
+#define GRUB_DISK_CACHE_MAX_SIZE	(1024 * 1024)
+
+/* The number of disk cache entries sharing one set. Entries within a set
+   are replaced in least recently used order.  */
+#define GRUB_DISK_CACHE_WAYS	8
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
 #define GRUB_DISK_CACHE_BITS	6
 #define GRUB_DISK_CACHE_SIZE	(1 << GRUB_DISK_CACHE_BITS)
 
+/* Reads of at least this many bytes bypass the disk cache.  */
+#define GRUB_DISK_DIRECT_READ_SIZE	(256 * 1024)
+
+/* Upper bound of the read-ahead window in units of GRUB_DISK_CACHE_SIZE.  */
+#define GRUB_DISK_MAX_READ_AHEAD (4194304 >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS))
+
+/* Maximum number of background read-ahead requests per disk.  */
+#define GRUB_DISK_MAX_PREFETCH	4
+
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
@@ -177,6 +250,13 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 /* This is called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
 
+/* Incremented whenever the whole disk cache is invalidated, so that
+   other caches of on-disk data can follow.  */
+extern unsigned long EXPORT_VAR(grub_disk_cache_generation);
+
+/* This is called from the kernel main routine.  */
+void grub_disk_cache_init (void);
+
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
 static inline int
@@ -200,6 +280,7 @@ grub_err_t EXPORT_FUNC(grub_disk_read) (grub_disk_t disk,
 					grub_off_t offset,
 					grub_size_t size,
 					void *buf);
+
 grub_err_t grub_disk_write (grub_disk_t disk,
 			    grub_disk_addr_t sector,
 			    grub_off_t offset,
@@ -217,6 +298,10 @@ grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 #if DISK_CACHE_STATS
 void
 EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
+void
+EXPORT_FUNC(grub_disk_cache_get_dev_performance) (enum grub_disk_dev_id dev_id,
+						   unsigned long *hits,
+						   unsigned long *misses);
 #endif
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
@@ -242,9 +327,13 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  /* Value of the cache clock when the entry was last used.  */
+  unsigned long last_use;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* GRUB_DISK_CACHE_WAYS entries for each of grub_disk_cache_num_sets sets.  */
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_num_sets);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
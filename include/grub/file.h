@@ -162,6 +162,14 @@ struct grub_file
   /* If file is not easily seekable. Should be set by underlying layer.  */
   int not_easily_seekable;
 
+  /* Preferred size of reads, e.g. the filesystem block size, or 0 if
+     unknown. Should be set by underlying layer.  */
+  grub_size_t preferred_block_size;
+
+  /* Read the data of the file straight into the caller's buffer, bypassing
+     the disk cache.  Set for files which loaders read once in bulk.  */
+  int direct_read;
+
   /* Filesystem-specific data.  */
   void *data;
 
@@ -182,9 +190,10 @@ typedef enum grub_file_filter_id
     GRUB_FILE_FILTER_GZIO,
     GRUB_FILE_FILTER_XZIO,
     GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_ZSTDIO,
     GRUB_FILE_FILTER_MAX,
     GRUB_FILE_FILTER_COMPRESSION_FIRST = GRUB_FILE_FILTER_GZIO,
-    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_LZOPIO,
+    GRUB_FILE_FILTER_COMPRESSION_LAST = GRUB_FILE_FILTER_ZSTDIO,
   } grub_file_filter_id_t;
 
 typedef grub_file_t (*grub_file_filter_t) (grub_file_t in, enum grub_file_type type);
@@ -73,11 +73,57 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Operations allowing fshelp to cache directory lookups of a filesystem.  */
+struct grub_fshelp_node_ops
+{
+  /* Return the number identifying NODE within its filesystem.  */
+  grub_uint64_t (*get_ino) (grub_fshelp_node_t node);
+
+  /* Return a new malloc'ed node for inode INO of the filesystem DIR is
+     on, or NULL and set grub_errno.  */
+  grub_fshelp_node_t (*make_node) (grub_fshelp_node_t dir, grub_uint64_t ino);
+};
+
+/* Like grub_fshelp_find_file or grub_fshelp_find_file_lookup, whichever
+   of ITERATE_DIR and LOOKUP_FILE isn't NULL, but the results of looking
+   up names in directories, including names which don't exist, are cached
+   for all filesystems on DISK using the same OPS.  The cache is dropped
+   together with the disk cache.  If both are given, LOOKUP_FILE is tried
+   first and may return GRUB_ERR_NOT_IMPLEMENTED_YET for directories it
+   can't search, which are then searched with ITERATE_DIR.  A name which
+   doesn't exist is reported by LOOKUP_FILE leaving *FOUNDNODE NULL.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   grub_err_t (*lookup_file) (grub_fshelp_node_t dir,
+								      const char *name,
+								      grub_fshelp_node_t *foundnode,
+								      enum grub_fshelp_filetype *foundtype),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   grub_disk_t disk,
+					   const struct grub_fshelp_node_ops *ops);
+
+/* Return the number of directory lookups answered by the directory entry
+   cache, split into existing and missing names, and of those which had to
+   go to the filesystem.  */
+void
+EXPORT_FUNC(grub_fshelp_dentry_cache_get_stats) (unsigned long *hits,
+						 unsigned long *negative_hits,
+						 unsigned long *misses);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
    blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+   blocks have a size of LOG2BLOCKSIZE (in log2).  Runs of physically
+   contiguous blocks are read with a single disk read.  GET_BLOCK is
+   called for increasing block numbers, possibly ahead of the block
+   being read.  */
 grub_ssize_t
 EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_disk_read_hook_t read_hook,
@@ -88,4 +134,44 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Like grub_fshelp_read_file, but physically contiguous blocks of inode
+   INO which are known to the extent cache are read with a single disk
+   read.  GET_BLOCK is expected to add the extents it decodes to the
+   cache with grub_fshelp_extent_add.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extents) (grub_disk_t disk,
+					    grub_fshelp_node_t node,
+					    grub_uint64_t ino,
+					    grub_disk_read_hook_t read_hook,
+					    void *read_hook_data,
+					    grub_off_t pos, grub_size_t len,
+					    char *buf,
+					    grub_disk_addr_t (*get_block) (grub_fshelp_node_t node,
+									   grub_disk_addr_t block),
+					    grub_off_t filesize,
+					    int log2blocksize,
+					    grub_disk_addr_t blocks_start);
+
+/* Remember that LEN blocks of inode INO starting with file block START
+   are stored contiguously from disk block BLKNR on.  The cache is shared
+   by all opens of the filesystem on DISK, and dropped together with the
+   disk cache.  Blocks are 1 << LOG2BLOCKSIZE sectors big.  */
+void
+EXPORT_FUNC(grub_fshelp_extent_add) (grub_disk_t disk, grub_uint64_t ino,
+				     int log2blocksize,
+				     grub_disk_addr_t start,
+				     grub_disk_addr_t len,
+				     grub_disk_addr_t blknr);
+
+/* Look up file block BLOCK of inode INO in the extent cache.  On success
+   return 1, store the disk block in BLKNR and, if COUNT isn't NULL, the
+   number of contiguous blocks from BLOCK to the end of the extent in
+   COUNT.  */
+int
+EXPORT_FUNC(grub_fshelp_extent_lookup) (grub_disk_t disk, grub_uint64_t ino,
+					int log2blocksize,
+					grub_disk_addr_t block,
+					grub_disk_addr_t *blknr,
+					grub_disk_addr_t *count);
+
 #endif /* ! GRUB_FSHELP_HEADER */
@@ -75,11 +75,19 @@ grub_cpu_is_cpuid_supported (void)
   asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1" \
                 : "=a" (a), "=r" (b), "=c" (c), "=d" (d)  \
                 : "0" (num))
+#define grub_cpuid_count(num,sub,a,b,c,d) \
+  asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1" \
+                : "=a" (a), "=r" (b), "=c" (c), "=d" (d)  \
+                : "0" (num), "2" (sub))
 #else
 #define grub_cpuid(num,a,b,c,d) \
   asm volatile ("cpuid" \
                 : "=a" (a), "=b" (b), "=c" (c), "=d" (d)  \
                 : "0" (num))
+#define grub_cpuid_count(num,sub,a,b,c,d) \
+  asm volatile ("cpuid" \
+                : "=a" (a), "=b" (b), "=c" (c), "=d" (d)  \
+                : "0" (num), "2" (sub))
 #endif
 
 #endif
@@ -0,0 +1,29 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_CPU_SIMD_HEADER
+#define GRUB_CPU_SIMD_HEADER	1
+
+/* GRUB is built without SSE, and the compiler then refuses vector
+   registers in the clobber lists of asm statements.  Functions with such
+   asm statements enable the instruction set ISA, e.g. "sse2" or "avx2",
+   with this, so that they can declare what they clobber.  Only call them
+   once the CPU is known to support ISA.  */
+#define GRUB_SIMD_FUNCTION(isa)	__attribute__ ((target (isa)))
+
+#endif /* ! GRUB_CPU_SIMD_HEADER */
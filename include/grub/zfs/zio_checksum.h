@@ -30,4 +30,25 @@ extern void fletcher_2 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 extern void fletcher_4 (const void *, grub_uint64_t, grub_zfs_endian_t endian,
 			zio_cksum_t *);
 
+#if defined (__x86_64__) && defined (GRUB_MACHINE_EFI)
+#define ZFS_CHECKSUM_SIMD 1
+
+enum
+  {
+    ZFS_CHECKSUM_UNKNOWN,
+    ZFS_CHECKSUM_SCALAR,
+    ZFS_CHECKSUM_SSE2,
+    ZFS_CHECKSUM_AVX2,
+    ZFS_CHECKSUM_SHA_NI
+  };
+
+/*
+ * The implementations fletcher_4 and zio_checksum_SHA256 use, picked for
+ * the CPU on first use.  Setting them to a lesser one, down to
+ * ZFS_CHECKSUM_SCALAR, makes the checksums use that instead.
+ */
+extern int zfs_fletcher_4_impl;
+extern int zfs_sha256_impl;
+#endif
+
 #endif	/* _SYS_ZIO_CHECKSUM_H */